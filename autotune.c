@@ -0,0 +1,104 @@
+/**
+ * @file autotune.c
+ * @author Stefan Kleinschmiodt
+ * @date 13. Nov 2024
+ * @brief Contains the implementation of the compiler flag autotuning for cscript.
+ *
+ * Compiles and benchmarks flag variants of a script and keeps the fastest one.
+ */
+#include "autotune.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <wordexp.h>
+
+#include "bench.h"
+#include "script_file_type.h"
+
+#define AUTOTUNE_MAX_VARIANTS 32
+
+void autotune_compile(sf_handle handle) {
+    const auto sf = (script_file*)handle;
+    if (sf == nullptr) {
+        fprintf(stderr, "autotune_compile: handle must not be null\n");
+        exit(EXIT_FAILURE);
+    }
+    //The representative arguments, split like a shell does, but without command substitution
+    wordexp_t words;
+    if (wordexp(sf->autotune_args, &words, WRDE_NOCMD) != 0) {
+        fprintf(stderr, "autotune_compile: invalid autotune arguments: %s\n", sf->autotune_args);
+        exit(EXIT_FAILURE);
+    }
+    char **args = malloc((words.we_wordc + 2) * sizeof(char*));
+    args[0] = sf->file_path;
+    for (size_t i = 0; i < words.we_wordc; i++) {
+        args[i + 1] = words.we_wordv[i];
+    }
+    args[words.we_wordc + 1] = nullptr;
+
+    const char *val = getenv("CSCRIPT_AUTOTUNE_RUNS");
+    const int runs = val != nullptr && atoi(val) > 0 ? atoi(val) : 5;
+
+    char variants[sizeof(sf->autotune_variants)];
+    snprintf(variants, sizeof(variants), "%s",
+             strlen(sf->autotune_variants) > 0 ? sf->autotune_variants : AUTOTUNE_DEFAULT_VARIANTS);
+    char outputs[AUTOTUNE_MAX_VARIANTS][PATH_MAX + 16];
+    int count = 0;
+    int best = -1;
+    double best_ms = 0.0;
+    sf->tune_timings[0] = '\0';
+    char *save = nullptr;
+    for (const char *flags = strtok_r(variants, ";", &save); flags != nullptr && count < AUTOTUNE_MAX_VARIANTS;
+         flags = strtok_r(nullptr, ";", &save)) {
+        while (*flags == ' ') {
+            flags++;
+        }
+        snprintf(outputs[count], sizeof(outputs[count]), "%s.tune%d", sf->executable_path, count);
+        fprintf(stderr, "cscript: autotuning %s: %s: ", sf->file_name, flags);
+        if (!script_file_compile_variant(sf, flags, outputs[count])) {
+            fprintf(stderr, "compile failed\n");
+            unlink(outputs[count]);
+            continue;
+        }
+        bench_result result;
+        bench_executable(outputs[count], args, runs, 1, -1, &result);
+        if (result.failures == result.runs) {
+            fprintf(stderr, "all runs failed\n");
+            unlink(outputs[count]);
+            continue;
+        }
+        fprintf(stderr, "median %.3f ms\n", result.median_ms);
+        char timing[1024 + 32];
+        snprintf(timing, sizeof(timing), "%s%s = %.3f ms", strlen(sf->tune_timings) > 0 ? " | " : "", flags,
+                 result.median_ms);
+        if (strlen(sf->tune_timings) + strlen(timing) < sizeof(sf->tune_timings)) {
+            strcat(sf->tune_timings, timing);
+        }
+        if (best == -1 || result.median_ms < best_ms) {
+            best = count;
+            best_ms = result.median_ms;
+            snprintf(sf->tuned_flags, sizeof(sf->tuned_flags), "%s", flags);
+        }
+        count++;
+    }
+    wordfree(&words);
+    free(args);
+    if (best == -1) {
+        fprintf(stderr, "autotune_compile: no variant of %s could be compiled and run\n", sf->file_name);
+        exit(EXIT_FAILURE);
+    }
+    //Keep the winner, drop the other variants
+    for (int i = 0; i < count; i++) {
+        if (i == best) {
+            if (rename(outputs[i], sf->executable_path) != 0) {
+                fprintf(stderr, "autotune_compile: could not write %s\n", sf->executable_path);
+                exit(EXIT_FAILURE);
+            }
+        } else {
+            unlink(outputs[i]);
+        }
+    }
+    fprintf(stderr, "cscript: autotuning %s: selected %s\n", sf->file_name, sf->tuned_flags);
+}
@@ -0,0 +1,37 @@
+/**
+ * @file autotune.h
+ * @author Stefan Kleinschmiodt
+ * @date 13. Nov 2024
+ * @brief Contains the compiler flag autotuning for cscript.
+ *
+ * Scripts containing the directive @#cscript autotune are compiled in several
+ * flag variants, which are benchmarked with representative arguments. The
+ * fastest variant is stored as the executable of the cache entry.
+ */
+#pragma once
+
+#include "script_file.h"
+
+/**
+ * @brief The flag variants tried when the script doesn't name its own
+ */
+#define AUTOTUNE_DEFAULT_VARIANTS "-O2;-O3;-O2 -march=native;-O3 -march=native;-O3 -funroll-loops;" \
+    "-O3 -march=native -funroll-loops;-O3 -march=native -flto"
+
+/**
+ * @brief Compiles the script file with the fastest flags
+ *
+ * Compiles the script file once per flag variant (appended to the @#gcc
+ * arguments) and benchmarks each executable with the arguments given in
+ * @#cscript autotune="{args}" (see bench_executable()). The variants are taken
+ * from @#cscript autotune-variants="{flags};{flags}..." or AUTOTUNE_DEFAULT_VARIANTS.
+ * The fastest executable (by median) is moved to the executable path, the
+ * chosen flags and the timings of all variants are kept in the script file
+ * information and recorded in the cache entry by cache_update().
+ * The number of measured runs per variant is taken from CSCRIPT_AUTOTUNE_RUNS
+ * (default 5). Note that the script is really executed during tuning, so the
+ * arguments should not have side effects.
+ *
+ * @param handle A handle to the script file information
+ */
+void autotune_compile(sf_handle handle);
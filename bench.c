@@ -0,0 +1,124 @@
+/**
+ * @file bench.c
+ * @author Stefan Kleinschmiodt
+ * @date 13. Nov 2024
+ * @brief Contains the implementations of the benchmark related functions for cscript.
+ *
+ * Provides a micro-benchmark runner for compiled scripts.
+ */
+#include "bench.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cache.h"
+#include "process.h"
+#include "script_file_type.h"
+
+int compare_double(const void *a, const void *b) {
+    const double x = *(const double*)a;
+    const double y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+void bench_executable(const char *path, char **argv, const int runs, const int warmup, const int cpu,
+                      bench_result *result) {
+    if (path == nullptr || argv == nullptr || result == nullptr || runs < 1) {
+        fprintf(stderr, "bench_executable: invalid arguments\n");
+        exit(EXIT_FAILURE);
+    }
+    const process_options options = { .perf = false, .quiet = true, .cpu = cpu };
+    process_stats stats;
+    memset(result, 0, sizeof(bench_result));
+    for (int i = 0; i < warmup; i++) {
+        process_run(path, argv, &options, &stats);
+    }
+    double *walls = malloc(runs * sizeof(double));
+    double sum = 0.0;
+    for (int i = 0; i < runs; i++) {
+        process_run(path, argv, &options, &stats);
+        walls[i] = stats.wall_ms;
+        sum += stats.wall_ms;
+        result->cpu_ms += stats.task_clock_ms;
+        result->minor_faults += (double)stats.usage.ru_minflt;
+        if (stats.usage.ru_maxrss > result->max_rss_kb) {
+            result->max_rss_kb = stats.usage.ru_maxrss;
+        }
+        if (process_exit_code(&stats) != 0) {
+            result->failures++;
+        }
+    }
+    qsort(walls, runs, sizeof(double), compare_double);
+    result->runs = runs;
+    result->min_ms = walls[0];
+    result->median_ms = runs % 2 == 1 ? walls[runs / 2] : (walls[runs / 2 - 1] + walls[runs / 2]) / 2.0;
+    //Nearest rank
+    const int p95 = (int)ceil(0.95 * runs) - 1;
+    result->p95_ms = walls[p95 < 0 ? 0 : p95];
+    result->mean_ms = sum / runs;
+    double variance = 0.0;
+    for (int i = 0; i < runs; i++) {
+        variance += (walls[i] - result->mean_ms) * (walls[i] - result->mean_ms);
+    }
+    result->stddev_ms = runs > 1 ? sqrt(variance / (runs - 1)) : 0.0;
+    result->cpu_ms /= runs;
+    result->minor_faults /= runs;
+    free(walls);
+}
+
+void print_result(const char *label, const char *path, const bench_result *result) {
+    printf("%-9s %s\n", label, path);
+    printf("          min %.3f ms, median %.3f ms, p95 %.3f ms, mean %.3f ms, stddev %.3f ms\n",
+           result->min_ms, result->median_ms, result->p95_ms, result->mean_ms, result->stddev_ms);
+    printf("          cpu %.3f ms, max-rss %ld kB, minor faults %.1f", result->cpu_ms, result->max_rss_kb,
+           result->minor_faults);
+    if (result->failures > 0) {
+        printf(", %d of %d runs failed", result->failures, result->runs);
+    }
+    printf("\n");
+}
+
+void bench_script(sf_handle handle, const int runs, const int argc, char **argv) {
+    const auto sf = (script_file*)handle;
+    if (sf == nullptr) {
+        fprintf(stderr, "bench_script: handle must not be null\n");
+        exit(EXIT_FAILURE);
+    }
+    const char *val = getenv("CSCRIPT_BENCH_WARMUP");
+    const int warmup = val != nullptr && strlen(val) > 0 ? atoi(val) : 3;
+    val = getenv("CSCRIPT_BENCH_CPU");
+    const int cpu = val != nullptr && strlen(val) > 0 ? atoi(val) : -1;
+
+    //Same arguments as script_file_execute(), the script sees its own path as argv[0]
+    char **args = malloc((argc + 1) * sizeof(char*));
+    args[0] = sf->file_path;
+    for (int i = 1; i < argc; i++) {
+        args[i] = argv[i];
+    }
+    args[argc] = nullptr;
+
+    char **current_args = script_file_exec_args(sf, argc, argv);
+
+    printf("cscript: benchmarking %s: %d runs after %d warmup runs%s\n", sf->file_name, runs, warmup,
+           cpu >= 0 ? ", pinned" : "");
+    bench_result current;
+    bench_executable(sf->executable_path, current_args, runs, warmup, cpu, &current);
+    free(current_args);
+    print_result("current", sf->executable_path, &current);
+
+    //Compare with an explicit baseline or with the previous build of the script
+    const char *baseline = getenv("CSCRIPT_BENCH_BASELINE");
+    if (baseline == nullptr || strlen(baseline) == 0) {
+        baseline = cache_find_previous(sf);
+    }
+    if (baseline != nullptr) {
+        bench_result base;
+        bench_executable(baseline, args, runs, warmup, cpu, &base);
+        print_result("baseline", baseline, &base);
+        printf("          current vs. baseline: median %.2fx, min %.2fx (>1 means current is faster)\n",
+               base.median_ms / current.median_ms, base.min_ms / current.min_ms);
+    }
+    free(args);
+}
@@ -0,0 +1,62 @@
+/**
+ * @file bench.h
+ * @author Stefan Kleinschmiodt
+ * @date 13. Nov 2024
+ * @brief Contains the benchmark related functions for cscript.
+ *
+ * Provides a micro-benchmark runner for compiled scripts.
+ */
+#pragma once
+
+#include "script_file.h"
+
+/**
+ * @brief Defines the statistics of a benchmark
+ */
+typedef struct bench_result {
+    int runs; /**< The number of measured runs. */
+    double min_ms; /**< The minimum wall clock time in ms. */
+    double median_ms; /**< The median wall clock time in ms. */
+    double p95_ms; /**< The 95th percentile of the wall clock time in ms. */
+    double mean_ms; /**< The mean wall clock time in ms. */
+    double stddev_ms; /**< The standard deviation of the wall clock time in ms. */
+    double cpu_ms; /**< The mean cpu time (user + system) in ms. */
+    long max_rss_kb; /**< The maximum resident set size in kB. */
+    double minor_faults; /**< The mean number of minor page faults. */
+    int failures; /**< The number of runs that exited with a non-zero exit code. */
+} bench_result;
+
+/**
+ * @brief Benchmarks an executable
+ *
+ * Runs the executable @p path @p warmup times without measuring and then
+ * @p runs times with measuring. The stdout of the executable is redirected
+ * to /dev/null. The executable is run directly, so the numbers don't include
+ * the startup of cscript. If @p cpu is not -1, the executable is pinned to
+ * that cpu.
+ *
+ * @param path The path of the executable
+ * @param argv The arguments, terminated by nullptr
+ * @param runs The number of measured runs
+ * @param warmup The number of warmup runs
+ * @param cpu The cpu to pin the executable to or -1
+ * @param result Receives the statistics
+ */
+void bench_executable(const char *path, char **argv, int runs, int warmup, int cpu, bench_result *result);
+
+/**
+ * @brief Benchmarks a script file
+ *
+ * Benchmarks the cached executable of the script file (see bench_executable())
+ * and prints the statistics. If CSCRIPT_BENCH_BASELINE names an executable, or
+ * if the cache contains the previous build of the script, that executable is
+ * benchmarked with the same arguments and compared to the current one.
+ * The number of warmup runs is taken from CSCRIPT_BENCH_WARMUP (default 3),
+ * the cpu to pin to from CSCRIPT_BENCH_CPU.
+ *
+ * @param handle A handle to the script file information
+ * @param runs The number of measured runs
+ * @param argc The number of arguments provided.
+ * @param argv array of strings containing the arguments (argv[0] is the script file)
+ */
+void bench_script(sf_handle handle, int runs, int argc, char **argv);
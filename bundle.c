@@ -0,0 +1,407 @@
+/**
+ * @file bundle.c
+ * @author Stefan Kleinschmiodt
+ * @date 13. Nov 2024
+ * @brief Contains the implementations of the bundle related functions for cscript.
+ *
+ * Provides the creation and the lookup of multi-call bundles.
+ */
+#include "bundle.h"
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <linux/limits.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+
+#include "cache.h"
+#include "cpu.h"
+#include "module.h"
+#include "normalize.h"
+#include "script_file_type.h"
+#include "sha256.h"
+#include "tools.h"
+
+#define BUNDLE_MAX_SCRIPTS 256
+
+void bundle_index_path(char *path, const size_t size) {
+    snprintf(path, size, "%s/bundles/index", cache_get_dir());
+}
+
+bool bundle_index_name(char *name, const size_t size, const script_file *sf, const bool native) {
+    //A script is found by its content and its name, native bundles only on the same cpu
+    const int len = snprintf(name, size, "%s:%s%s%s", sf->key, sf->file_name, native ? ":" : "",
+                             native ? cpu_fingerprint() : "");
+    return len >= 0 && (size_t)len < size;
+}
+
+void write_dispatcher(const char *path, const int count, script_file **sfs) {
+    FILE *fp = fopen(path, "w");
+    if (fp == nullptr) {
+        fprintf(stderr, "bundle_create: could not write %s\n", path);
+        exit(EXIT_FAILURE);
+    }
+    fputs("#include <stdio.h>\n#include <string.h>\n\n", fp);
+    for (int i = 0; i < count; i++) {
+        fprintf(fp, "int cscript_main_%d(int argc, char **argv, char **envp);\n", i);
+    }
+    fputs("\nstatic const struct {\n    const char *name;\n    int (*main)(int argc, char **argv, char **envp);\n"
+          "} scripts[] = {\n", fp);
+    for (int i = 0; i < count; i++) {
+        fprintf(fp, "    { \"%s\", cscript_main_%d },\n", sfs[i]->file_name, i);
+    }
+    fputs("};\n\n"
+          "static int find(const char *name) {\n"
+          "    const char *base = strrchr(name, '/');\n"
+          "    base = base != NULL ? base + 1 : name;\n"
+          "    for (size_t i = 0; i < sizeof(scripts) / sizeof(scripts[0]); i++) {\n"
+          "        const char *dot = strrchr(scripts[i].name, '.');\n"
+          "        const size_t stem = dot != NULL ? (size_t)(dot - scripts[i].name) : strlen(scripts[i].name);\n"
+          "        if (strcmp(base, scripts[i].name) == 0\n"
+          "            || (strlen(base) == stem && strncmp(base, scripts[i].name, stem) == 0)) {\n"
+          "            return (int)i;\n"
+          "        }\n"
+          "    }\n"
+          "    return -1;\n"
+          "}\n\n"
+          "int main(int argc, char **argv, char **envp) {\n"
+          "    int i;\n"
+          "    if (argc > 2 && strcmp(argv[1], \"" BUNDLE_SCRIPT_ARG "\") == 0) {\n"
+          "        for (i = 0; i < (int)(sizeof(scripts) / sizeof(scripts[0])); i++) {\n"
+          "            if (strcmp(argv[2], scripts[i].name) == 0) {\n"
+          "                argv[2] = argv[0];\n"
+          "                return scripts[i].main(argc - 2, argv + 2, envp);\n"
+          "            }\n"
+          "        }\n"
+          "        fprintf(stderr, \"%s: no script %s in this bundle\\n\", argv[0], argv[2]);\n"
+          "        return 127;\n"
+          "    }\n"
+          "    i = find(argv[0]);\n"
+          "    if (i >= 0) {\n"
+          "        return scripts[i].main(argc, argv, envp);\n"
+          "    }\n"
+          "    if (argc > 1 && (i = find(argv[1])) >= 0) {\n"
+          "        return scripts[i].main(argc - 1, argv + 1, envp);\n"
+          "    }\n"
+          "    fprintf(stderr, \"usage: %s {script} [args...]\\nscripts:\\n\", argv[0]);\n"
+          "    for (size_t j = 0; j < sizeof(scripts) / sizeof(scripts[0]); j++) {\n"
+          "        fprintf(stderr, \"    %s\\n\", scripts[j].name);\n"
+          "    }\n"
+          "    return 127;\n"
+          "}\n", fp);
+    fclose(fp);
+}
+
+void append_link_args(char *target, const size_t size, const char *args) {
+    //Objects of modules shared by several scripts must only be linked once
+    char *copy = strdup(args);
+    char *save = nullptr;
+    for (char *arg = strtok_r(copy, " \t", &save); arg != nullptr; arg = strtok_r(nullptr, " \t", &save)) {
+        const size_t len = strlen(arg);
+        if (len > 2 && strcmp(arg + len - 2, ".o") == 0) {
+            const char *p = target;
+            bool found = false;
+            while (!found && (p = strstr(p, arg)) != nullptr) {
+                found = (p == target || p[-1] == ' ') && (p[len] == ' ' || p[len] == '\0');
+                p += len;
+            }
+            if (found) {
+                continue;
+            }
+        }
+        if (strlen(target) + len + 2 > size) {
+            fprintf(stderr, "bundle_create: linker arguments too long\n");
+            exit(EXIT_FAILURE);
+        }
+        strcat(target, " ");
+        strcat(target, arg);
+    }
+    free(copy);
+}
+
+void build_bundle(const char *dir, const char *bin, const int count, script_file **sfs) {
+    //Build in a private directory and move it into place, concurrent builds may race
+    char tmp_dir[PATH_MAX + 16];
+    char path[PATH_MAX + 64];
+    snprintf(tmp_dir, sizeof(tmp_dir), "%s.%d", dir, getpid());
+    mkdir_p(tmp_dir, cache_dir_mode());
+    const size_t size = (size_t)count * (sizeof(sfs[0]->gcc_args) + sizeof(sfs[0]->link_args) + PATH_MAX) + 4096;
+    char *gcc_line = (char*)malloc(size);
+    char *link_args = (char*)malloc(size);
+    link_args[0] = '\0';
+    snprintf(path, sizeof(path), "%s/dispatch.c", tmp_dir);
+    write_dispatcher(path, count, sfs);
+    //The bundle is linked by the compiler of its first script
+    snprintf(gcc_line, size, "%s -o %s/bundle.bin %s", sfs[0]->cc, tmp_dir, path);
+    for (int i = 0; i < count; i++) {
+        char main_name[32];
+        char cmd[2 * PATH_MAX + 128];
+        sprintf(main_name, "cscript_main_%d", i);
+        snprintf(path, sizeof(path), "%s/%d.o", tmp_dir, i);
+        if (!script_file_compile_object(sfs[i], path)) {
+            fprintf(stderr, "bundle_create: failed compiling %s\n", sfs[i]->file_path);
+            exit(EXIT_FAILURE);
+        }
+        //main is renamed in the object, so it keeps its implicit return 0, and all other global symbols become
+        //local, so the scripts can't clash
+        snprintf(cmd, sizeof(cmd), "objcopy --redefine-sym main=%s --keep-global-symbol=%s %s", main_name, main_name,
+                 path);
+        if (system(cmd) != 0) {
+            fprintf(stderr, "bundle_create: could not localize the symbols of %s\n", sfs[i]->file_path);
+            exit(EXIT_FAILURE);
+        }
+        strcat(gcc_line, " ");
+        strcat(gcc_line, path);
+        append_link_args(link_args, size, script_file_link_args(sfs[i]));
+    }
+    strcat(gcc_line, link_args);
+#if DEBUG == 1
+    printf("GCC: %s\n", gcc_line);
+#endif
+    const bool built = system(gcc_line) == 0;
+    free(gcc_line);
+    free(link_args);
+    for (int i = 0; i < count; i++) {
+        snprintf(path, sizeof(path), "%s/%d.o", tmp_dir, i);
+        unlink(path);
+    }
+    snprintf(path, sizeof(path), "%s/dispatch.c", tmp_dir);
+    unlink(path);
+    if (!built || rename(tmp_dir, dir) != 0) {
+        snprintf(path, sizeof(path), "%s/bundle.bin", tmp_dir);
+        unlink(path);
+        rmdir(tmp_dir);
+    }
+    if (!file_exists(bin)) {
+        fprintf(stderr, "bundle_create: failed linking the bundle\n");
+        exit(EXIT_FAILURE);
+    }
+}
+
+void copy_executable(const char *source, const char *target) {
+    char tmp_path[PATH_MAX + 16];
+    struct stat st;
+    snprintf(tmp_path, sizeof(tmp_path), "%s.%d", target, getpid());
+    const int in = open(source, O_RDONLY);
+    const int out = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC, 0755);
+    off_t offset = 0;
+    bool ok = in != -1 && out != -1 && fstat(in, &st) == 0;
+    while (ok && offset < st.st_size) {
+        ok = sendfile(out, in, &offset, st.st_size - offset) > 0;
+    }
+    if (in != -1) {
+        close(in);
+    }
+    if (out != -1) {
+        ok = close(out) == 0 && ok;
+    }
+    if (!ok || rename(tmp_path, target) != 0) {
+        unlink(tmp_path);
+        fprintf(stderr, "bundle_create: could not write %s\n", target);
+        exit(EXIT_FAILURE);
+    }
+}
+
+bool bundle_runs_code(const script_file *sf) {
+    //Constructors and destructors of one script would run whichever script the bundle dispatches to
+    static const char *const names[] = { "constructor", "__constructor__", "destructor", "__destructor__", nullptr };
+    if (sf->placement.mlockall || normalize_has_identifier(sf->source, sf->source_size, names)) {
+        return true;
+    }
+    char uses[sizeof(sf->uses)];
+    char *save = nullptr;
+    bool found = false;
+    strcpy(uses, sf->uses);
+    for (char *name = strtok_r(uses, " \t", &save); !found && name != nullptr; name = strtok_r(nullptr, " \t", &save)) {
+        char path[PATH_MAX];
+        FILE *fp = module_find(name, path, sizeof(path)) ? fopen(path, "r") : nullptr;
+        size_t size = 0;
+        char *source = fp != nullptr ? read_stream(fp, &size) : nullptr;
+        found = source != nullptr && normalize_has_identifier(source, size, names);
+        free(source);
+        if (fp != nullptr) {
+            fclose(fp);
+        }
+    }
+    return found;
+}
+
+void bundle_create(const char *out_path, const int count, char **scripts) {
+    if (out_path == nullptr || scripts == nullptr || count < 1 || count > BUNDLE_MAX_SCRIPTS) {
+        fprintf(stderr, "bundle_create: 1 to %d scripts are needed\n", BUNDLE_MAX_SCRIPTS);
+        exit(EXIT_FAILURE);
+    }
+    script_file *sfs[BUNDLE_MAX_SCRIPTS];
+    //The bundle is identified by the keys of its scripts
+    char *keys = (char*)malloc((size_t)count * (SHA256_HASH_LENGTH * 2 + 1) + 256);
+    keys[0] = '\0';
+    bool native = false;
+    for (int i = 0; i < count; i++) {
+        sfs[i] = (script_file*)script_file_open(scripts[i]);
+        if (strpbrk(sfs[i]->file_name, "=\n\"\\") != nullptr) {
+            fprintf(stderr, "bundle_create: %s can't be bundled, rename it\n", sfs[i]->file_path);
+            exit(EXIT_FAILURE);
+        }
+        if (bundle_runs_code(sfs[i])) {
+            fprintf(stderr, "bundle_create: %s can't be bundled, it or a module it uses has a constructor, "
+                    "a destructor or #cscript mlockall, which would run for every script of the bundle\n",
+                    sfs[i]->file_path);
+            exit(EXIT_FAILURE);
+        }
+        native = native || sfs[i]->native;
+        for (int j = 0; j < i; j++) {
+            if (strcmp(sfs[i]->file_name, sfs[j]->file_name) == 0) {
+                fprintf(stderr, "bundle_create: %s and %s have the same name\n", sfs[j]->file_path,
+                        sfs[i]->file_path);
+                exit(EXIT_FAILURE);
+            }
+        }
+        strcat(keys, sfs[i]->key);
+        strcat(keys, " ");
+    }
+    //A bundle containing a native build is built per cpu
+    if (native) {
+        strcat(keys, cpu_fingerprint());
+    }
+    char dir[PATH_MAX];
+    char bin[PATH_MAX + 16];
+    snprintf(dir, sizeof(dir), "%s/bundles/%s", cache_get_dir(), sha256_string(keys));
+    snprintf(bin, sizeof(bin), "%s/bundle.bin", dir);
+    free(keys);
+    if (!file_exists(bin)) {
+        build_bundle(dir, bin, count, sfs);
+    }
+    char index[PATH_MAX];
+    bundle_index_path(index, sizeof(index));
+    for (int i = 0; i < count; i++) {
+        char name[NAME_MAX + 512];
+        if (!bundle_index_name(name, sizeof(name), sfs[i], native)) {
+            fprintf(stderr, "bundle_create: script name too long: %s\n", sfs[i]->file_name);
+            exit(EXIT_FAILURE);
+        }
+        if (kv_write(index, name, bin) != 0) {
+            fprintf(stderr, "bundle_create: could not write %s\n", index);
+            exit(EXIT_FAILURE);
+        }
+        script_file_close(sfs[i]);
+    }
+    copy_executable(bin, out_path);
+    fprintf(stderr, "cscript: bundled %d scripts into %s\n", count, out_path);
+}
+
+bool bundle_select(sf_handle handle) {
+    const auto sf = (script_file*)handle;
+    if (sf == nullptr) {
+        fprintf(stderr, "bundle_select: handle must not be null\n");
+        exit(EXIT_FAILURE);
+    }
+    char index[PATH_MAX];
+    char bin[PATH_MAX];
+    char name[NAME_MAX + 512];
+    bundle_index_path(index, sizeof(index));
+    if (!bundle_index_name(name, sizeof(name), sf, true) || strlen(sf->file_name) >= sizeof(sf->bundle_script)) {
+        return false;
+    }
+    if (!kv_read(index, name, bin, sizeof(bin)) || !file_exists(bin)) {
+        bundle_index_name(name, sizeof(name), sf, false);
+        if (!kv_read(index, name, bin, sizeof(bin)) || !file_exists(bin)) {
+            return false;
+        }
+    }
+#if DEBUG == 1
+    printf("DBG: bundle_select: %s\n", bin);
+#endif
+    snprintf(sf->executable_path, sizeof(sf->executable_path), "%s", bin);
+    memcpy(sf->bundle_script, sf->file_name, strlen(sf->file_name) + 1);
+    *strrchr(bin, '/') = '\0';
+    cache_mark_used(bin);
+    return true;
+}
+
+bool bundle_removed(const char *dir, const char *name, const char *index, const char *prefix, const double max_age,
+                    const time_t now) {
+    //A bundle is removed if it is old enough and, with a prefix, contains a matching script
+    char path[PATH_MAX + NAME_MAX];
+    struct stat st;
+    snprintf(path, sizeof(path), "%s/%s", dir, name);
+    if (max_age >= 0 && (stat(path, &st) != 0 || difftime(now, st.st_mtime) <= max_age)) {
+        return false;
+    }
+    if (prefix != nullptr) {
+        char pattern[PATH_MAX + NAME_MAX + 16];
+        snprintf(pattern, sizeof(pattern), "=%s/bundle.bin\n", path);
+        bool matched = false;
+        for (const char *line = index; !matched && line != nullptr && *line != '\0'; ) {
+            const char *next = strchr(line, '\n');
+            next = next != nullptr ? next + 1 : line + strlen(line);
+            const char *value = memchr(line, '=', next - line);
+            matched = strncmp(line, prefix, strlen(prefix)) == 0 && value != nullptr
+                      && strncmp(value, pattern, strlen(pattern)) == 0;
+            line = next;
+        }
+        if (!matched) {
+            return false;
+        }
+    }
+    char trash_name[NAME_MAX + 16];
+    snprintf(trash_name, sizeof(trash_name), "bundles.%s", name);
+    return cache_remove(path, trash_name);
+}
+
+int bundle_invalidate(const char *prefix, const double max_age) {
+    char dir[PATH_MAX];
+    char index[PATH_MAX];
+    snprintf(dir, sizeof(dir), "%s/bundles", cache_get_dir());
+    bundle_index_path(index, sizeof(index));
+    FILE *fp = fopen(index, "r");
+    char *lines = fp != nullptr ? read_stream(fp, nullptr) : nullptr;
+    if (fp != nullptr) {
+        fclose(fp);
+    }
+    DIR *d = opendir(dir);
+    if (d == nullptr) {
+        free(lines);
+        return 0;
+    }
+    const time_t now = time(nullptr);
+    int count = 0;
+    const struct dirent *de;
+    while ((de = readdir(d)) != nullptr) {
+        if (cache_is_key(de->d_name) && bundle_removed(dir, de->d_name, lines, prefix, max_age, now)) {
+            count++;
+        }
+    }
+    closedir(d);
+    //The index keeps only the scripts whose bundle still exists
+    if (count > 0 && lines != nullptr) {
+        char tmp_path[PATH_MAX + 16];
+        snprintf(tmp_path, sizeof(tmp_path), "%s.%d", index, getpid());
+        FILE *out = fopen(tmp_path, "w");
+        for (char *line = lines; out != nullptr && *line != '\0'; ) {
+            char *next = strchr(line, '\n');
+            next = next != nullptr ? next + 1 : line + strlen(line);
+            const char saved = *next;
+            *next = '\0';
+            const char *value = strchr(line, '=');
+            char bin[PATH_MAX];
+            snprintf(bin, sizeof(bin), "%.*s", value != nullptr ? (int)strcspn(value + 1, "\n") : 0,
+                     value != nullptr ? value + 1 : "");
+            if (value != nullptr && file_exists(bin)) {
+                fputs(line, out);
+            }
+            *next = saved;
+            line = next;
+        }
+        if (out == nullptr || fclose(out) != 0 || rename(tmp_path, index) != 0) {
+            unlink(tmp_path);
+            fprintf(stderr, "cscript: could not write %s\n", index);
+        }
+    }
+    free(lines);
+    return count;
+}
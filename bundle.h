@@ -0,0 +1,63 @@
+/**
+ * @file bundle.h
+ * @author Stefan Kleinschmiodt
+ * @date 13. Nov 2024
+ * @brief Contains the bundle related functions for cscript.
+ *
+ * A bundle is a single multi-call executable containing several scripts, like
+ * busybox. Each script is compiled with a renamed main function, a dispatcher
+ * selects the script by the name the bundle has been called with (argv[0]) or
+ * by the first argument. Shared libraries are loaded once for all scripts of
+ * a pipeline then. Bundles are kept in the cache and used automatically for
+ * the scripts they contain.
+ */
+#pragma once
+
+#include "script_file.h"
+
+/**
+ * @brief The argument cscript passes to a bundle in front of the name of the script to run
+ */
+#define BUNDLE_SCRIPT_ARG "--cscript-bundle-script"
+
+/**
+ * @brief Creates a bundle
+ *
+ * Compiles the scripts into one executable, keeps it in the cache and
+ * registers it for the scripts, then copies it to @p out_path.
+ * The bundle runs a script if it is called by the file name of the script
+ * (with or without extension, e.g. through a symlink) or with the name as
+ * first argument. Scripts with constructors, destructors or @#cscript mlockall,
+ * directly or in a module they use, are refused, as that code would run for
+ * every script of the bundle.
+ *
+ * @param out_path The path of the bundle executable
+ * @param count The number of script files
+ * @param scripts The paths of the script files
+ */
+void bundle_create(const char *out_path, int count, char **scripts);
+
+/**
+ * @brief Selects the bundle containing a script file
+ *
+ * If the current version of the script file has been bundled under its file
+ * name (and for this cpu, if the bundle contains a build for the cpu), the
+ * bundle is set as executable of the script file, running the script by name.
+ *
+ * @param handle A handle to the script file information
+ * @return true if a bundle has been selected
+ */
+bool bundle_select(sf_handle handle);
+
+/**
+ * @brief Invalidates bundles
+ *
+ * Removes the bundles that have not been used for more than @p max_age seconds
+ * and, with a @p prefix, contain a script whose key starts with it, like
+ * cache_invalidate(). The index forgets the scripts of removed bundles.
+ *
+ * @param prefix The key prefix, nullptr for all keys
+ * @param max_age The age in seconds, negative for any age
+ * @return The number of removed bundles
+ */
+int bundle_invalidate(const char *prefix, double max_age);
@@ -7,41 +7,383 @@
  * Provides functionality to manage the cache..
  */
 
+#define _GNU_SOURCE
 #include "cache.h"
 #include <dirent.h>
 #include <errno.h>
 
+#include <fcntl.h>
+#include <ftw.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
+#include <unistd.h>
 #include <linux/limits.h>
-#include "tools.h"
+#include <sys/resource.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include "bundle.h"
+#include "cpu.h"
+#include "elf.h"
 #include "sha256.h"
+#include "tools.h"
 #include "script_file_type.h"
 
+#define CACHE_MAX_LAYERS 8
+#define CACHE_TRASH ".trash"
+#define CACHE_USE_INTERVAL 60
+
 char cache_dir[PATH_MAX] = "";
+char cache_layers[CACHE_MAX_LAYERS][PATH_MAX];
+int cache_layer_count = 0;
+bool cache_writes = true;
+bool cache_shared = false;
+
+void expand_home(char *target, const size_t size, const char *path, const size_t len) {
+    if (len > 0 && path[0] == '~' && (len == 1 || path[1] == '/')) {
+        snprintf(target, size, "%s%.*s", getenv("HOME"), (int)len - 1, path + 1);
+    } else {
+        snprintf(target, size, "%.*s", (int)len, path);
+    }
+}
 
 void init_cache() {
     if (strlen(cache_dir) == 0) {
-        sprintf(cache_dir, "%s/.cscript/cache/", getenv("HOME"));
-        mkdir_p(cache_dir, 0700);
+        const char *layers = getenv("CSCRIPT_CACHE_PATH");
+        if (layers != nullptr && strlen(layers) > 0) {
+            //All layers but the last one are read-only, the last one is the writable cache directory
+            const char *p = layers;
+            const char *last = strrchr(layers, ':');
+            while (last != nullptr && p < last) {
+                const char *end = strchr(p, ':');
+                if (end > p && cache_layer_count < CACHE_MAX_LAYERS) {
+                    expand_home(cache_layers[cache_layer_count++], PATH_MAX, p, end - p);
+                }
+                p = end + 1;
+            }
+            expand_home(cache_dir, sizeof(cache_dir), p, strlen(p));
+        } else if (getenv("CSCRIPT_CACHE_DIR") != nullptr && strlen(getenv("CSCRIPT_CACHE_DIR")) > 0) {
+            sprintf(cache_dir, "%s/", getenv("CSCRIPT_CACHE_DIR"));
+        } else {
+            sprintf(cache_dir, "%s/.cscript/cache/", getenv("HOME"));
+        }
+        //A shared cache is readable by everybody, an existing one is recognized by its permissions
+        struct stat st;
+        cache_shared = env_flag("CSCRIPT_CACHE_SHARED")
+                       || (stat(cache_dir, &st) == 0 && (st.st_mode & (S_IROTH | S_IXOTH)) == (S_IROTH | S_IXOTH));
+        mkdir_p(cache_dir, cache_dir_mode());
 #if DEBUG == 1
-        printf("DBG: init_cache: cache dir: %s\n", cache_dir);
+        printf("DBG: init_cache: cache dir: %s%s\n", cache_dir, cache_shared ? " (shared)" : "");
+        for (int i = 0; i < cache_layer_count; i++) {
+            printf("DBG: init_cache: read-only layer: %s\n", cache_layers[i]);
+        }
 #endif
     }
 }
 
-const char* get_cache_path(const char *filePath);
+bool cache_dir_configured() {
+    return env_flag("CSCRIPT_CACHE_DIR") || env_flag("CSCRIPT_CACHE_PATH");
+}
+
+void cache_disable_writes() {
+    cache_writes = false;
+}
 
-void cache_clear() {
+bool cache_writes_enabled() {
+    return cache_writes;
+}
+
+mode_t cache_dir_mode() {
+    init_cache();
+    return cache_shared ? 0755 : 0700;
+}
+
+mode_t cache_file_mode(const mode_t mode) {
+    init_cache();
+    if (!cache_shared) {
+        return mode & 0700;
+    }
+    const mode_t mask = umask(0);
+    umask(mask);
+    return mode & 0755 & ~mask;
+}
+
+bool is_trusted(const char *path, const bool directory) {
+    //Shared files must belong to root or the current user and must not be writable by anybody else
+    struct stat st;
+    if (stat(path, &st) != 0 || (directory ? !S_ISDIR(st.st_mode) : !S_ISREG(st.st_mode))) {
+        return false;
+    }
+    return (st.st_uid == 0 || st.st_uid == geteuid()) && (st.st_mode & (S_IWGRP | S_IWOTH)) == 0;
+}
+
+bool select_executable(script_file *sf, const char *entry_path) {
+    sf->native_fallback = false;
+    if (file_exists(sf->executable_path)) {
+        return true;
+    }
+    if (!sf->native) {
+        return false;
+    }
+    //No build for this cpu yet, use the build of the most capable cpu whose features this cpu has
+    char meta_file[PATH_MAX];
+    sprintf(meta_file, "%s/meta", entry_path);
+    FILE *fp = fopen(meta_file, "r");
+    if (fp == nullptr) {
+        return false;
+    }
+    char *line = nullptr;
+    size_t len = 0;
+    int best_score = -1;
+    while (getline(&line, &len, fp) != -1) {
+        line[strcspn(line, "\n")] = '\0';
+        char *value = strchr(line, '=');
+        int score;
+        if (strncmp(line, "cpu.", 4) != 0 || value == nullptr) {
+            continue;
+        }
+        *value++ = '\0';
+        char bin[sizeof(sf->executable_path)];
+        format_path(bin, sizeof(bin), "%s/%s.%s.bin", entry_path, sf->file_name, line + 4);
+        if (cpu_compatible(value, &score) && score > best_score && file_exists(bin)) {
+            best_score = score;
+            snprintf(sf->executable_path, sizeof(sf->executable_path), "%s", bin);
+        }
+    }
+    free(line);
+    fclose(fp);
+#if DEBUG == 1
+    printf("DBG: select_executable: %s\n", best_score >= 0 ? sf->executable_path : "no compatible build");
+#endif
+    sf->native_fallback = best_score >= 0;
+    return best_score >= 0;
+}
+
+bool layer_entry_check(script_file *sf, const char *layer, const char *entry_path) {
+    char meta_file[PATH_MAX];
+    char key[256];
+    sprintf(meta_file, "%s/meta", entry_path);
+    if (!kv_read(meta_file, "key", key, sizeof(key)) || strcmp(key, sf->key) != 0
+        || !select_executable(sf, entry_path)) {
+        return false;
+    }
+    if (!is_trusted(layer, true) || !is_trusted(entry_path, true)
+        || !is_trusted(meta_file, false) || !is_trusted(sf->executable_path, false)) {
+        fprintf(stderr, "cscript: ignoring cache entry with unsafe owner or permissions: %s\n", entry_path);
+        return false;
+    }
+    return true;
+}
+
+const char* cache_get_dir() {
+    init_cache();
+    return cache_dir;
+}
+
+const char* cache_get_entry_path(const char *key) {
+    static char cache_path[PATH_MAX];
     init_cache();
-    char clear_cmd[4096];
+    format_path(cache_path, sizeof(cache_path), "%s/%s", cache_dir, key);
+#if DEBUG == 1
+    printf("DBG: cache_get_entry_path: cache path: %s\n", cache_path);
+#endif
+    return cache_path;
+}
+
+bool cache_is_key(const char *name) {
+    if (strlen(name) != SHA256_HASH_LENGTH * 2) {
+        return false;
+    }
+    return strspn(name, "0123456789abcdef") == SHA256_HASH_LENGTH * 2;
+}
+
+int remove_file(const char *path, const struct stat *st, const int type, struct FTW *ftw) {
+    //The trash directory itself is kept, it may already receive new entries
+    if (ftw->level == 0 && strcmp(path + ftw->base, CACHE_TRASH) == 0) {
+        return 0;
+    }
+    if (type == FTW_DP) {
+        rmdir(path);
+    } else {
+        unlink(path);
+    }
+    return 0;
+}
 
-    printf("clearing complete cscript cache\n%s", cache_dir);
+void remove_detached(const char *path) {
+    //Deleting a large cache takes a while, nobody has to wait for it
+    fflush(stdout);
+    fflush(stderr);
+    const pid_t pid = fork();
+    if (pid == -1) {
+        nftw(path, remove_file, 64, FTW_DEPTH | FTW_PHYS);
+        return;
+    }
+    if (pid == 0) {
+        //The grandchild is reparented, so it is neither waited for nor keeps the terminal or pipes open
+        setsid();
+        if (fork() == 0) {
+            const int null_fd = open("/dev/null", O_RDWR);
+            dup2(null_fd, STDIN_FILENO);
+            dup2(null_fd, STDOUT_FILENO);
+            dup2(null_fd, STDERR_FILENO);
+            close(null_fd);
+            setpriority(PRIO_PROCESS, 0, 10);
+            nftw(path, remove_file, 64, FTW_DEPTH | FTW_PHYS);
+        }
+        _exit(EXIT_SUCCESS);
+    }
+    waitpid(pid, nullptr, 0);
+}
 
-    sprintf(clear_cmd, "rm -Rf %s", cache_dir);
+bool move_to_trash(const char *path, const char *name) {
+    //The rename is atomic, concurrent runs either see the complete entry or nothing
+    static int counter = 0;
+    char trash[PATH_MAX];
+    char target[PATH_MAX + NAME_MAX + 32];
+    format_path(trash, sizeof(trash), "%s/%s", cache_dir, CACHE_TRASH);
+    snprintf(target, sizeof(target), "%s/%s.%d.%d", trash, name, getpid(), counter++);
+    for (int attempt = 0; attempt < 2; attempt++) {
+        mkdir_p(trash, 0700);
+        if (rename(path, target) == 0) {
+            return true;
+        }
+        //The trash directory may have been removed concurrently
+        if (errno != ENOENT) {
+            break;
+        }
+    }
+    return false;
+}
 
-    system(clear_cmd);
+bool cache_remove(const char *path, const char *name) {
+    if (move_to_trash(path, name)) {
+        return true;
+    }
+    fprintf(stderr, "cscript: could not remove %s: %s\n", path, strerror(errno));
+    return false;
+}
+
+int adopt_stale_trash() {
+    //A cleared cache root is renamed to <root>.trash.<pid>.<time> next to it. If the deleting
+    //process has been killed, it is left there, so it is moved into the trash of the new root.
+    char root[PATH_MAX];
+    snprintf(root, sizeof(root), "%s", cache_dir);
+    while (strlen(root) > 1 && root[strlen(root) - 1] == '/') {
+        root[strlen(root) - 1] = '\0';
+    }
+    const char *base = get_file_name(root);
+    char parent[PATH_MAX];
+    snprintf(parent, sizeof(parent), "%.*s", base > root + 1 ? (int)(base - root - 1) : 1, root);
+    DIR *d = opendir(parent);
+    if (d == nullptr) {
+        return 0;
+    }
+    int count = 0;
+    const size_t base_len = strlen(base);
+    const struct dirent *de;
+    while ((de = readdir(d)) != nullptr) {
+        char path[PATH_MAX + NAME_MAX];
+        const char *suffix = de->d_name + base_len;
+        if (strncmp(de->d_name, base, base_len) != 0 || strncmp(suffix, ".trash.", 7) != 0
+            || strspn(suffix + 7, "0123456789.") != strlen(suffix + 7)) {
+            continue;
+        }
+        format_path(path, sizeof(path), "%s/%s", parent, de->d_name);
+        if (move_to_trash(path, de->d_name)) {
+            count++;
+        }
+    }
+    closedir(d);
+    return count;
+}
+
+void empty_trash() {
+    adopt_stale_trash();
+    char trash[PATH_MAX];
+    format_path(trash, sizeof(trash), "%s/%s", cache_dir, CACHE_TRASH);
+    remove_detached(trash);
+}
+
+void cache_clear() {
+    init_cache();
+    printf("clearing complete cscript cache\n%s\n", cache_dir);
+    //Rename the whole cache directory if possible, otherwise (e.g. a mount point) move its entries
+    char root[PATH_MAX];
+    char target[PATH_MAX + 64];
+    snprintf(root, sizeof(root), "%s", cache_dir);
+    while (strlen(root) > 1 && root[strlen(root) - 1] == '/') {
+        root[strlen(root) - 1] = '\0';
+    }
+    snprintf(target, sizeof(target), "%s.trash.%d.%ld", root, getpid(), (long)time(nullptr));
+    adopt_stale_trash();
+    if (rename(root, target) == 0) {
+        remove_detached(target);
+        return;
+    }
+    DIR *d = opendir(cache_dir);
+    if (d == nullptr) {
+        return;
+    }
+    const struct dirent *de;
+    while ((de = readdir(d)) != nullptr) {
+        char path[PATH_MAX + NAME_MAX];
+        if (strcmp(de->d_name, ".") == 0 || strcmp(de->d_name, "..") == 0 || strcmp(de->d_name, CACHE_TRASH) == 0) {
+            continue;
+        }
+        format_path(path, sizeof(path), "%s/%s", cache_dir, de->d_name);
+        if (!move_to_trash(path, de->d_name)) {
+            fprintf(stderr, "cscript: could not remove %s: %s\n", path, strerror(errno));
+        }
+    }
+    closedir(d);
+    empty_trash();
+}
+
+int remove_script_entries(const char *script, const char *key, const bool keep_previous) {
+    //Earlier versions of the script left their own entries behind, they are found by the script path
+    DIR *d = opendir(cache_dir);
+    if (d == nullptr) {
+        return 0;
+    }
+    char previous[PATH_MAX + NAME_MAX] = "";
+    struct timespec newest = { 0, 0 };
+    int count = 0;
+    const struct dirent *de;
+    while ((de = readdir(d)) != nullptr) {
+        char path[PATH_MAX + NAME_MAX];
+        char meta_file[PATH_MAX + NAME_MAX + 8];
+        char value[PATH_MAX];
+        struct stat st;
+        if (!cache_is_key(de->d_name) || strcmp(de->d_name, key) == 0) {
+            continue;
+        }
+        format_path(path, sizeof(path), "%s/%s", cache_dir, de->d_name);
+        snprintf(meta_file, sizeof(meta_file), "%s/meta", path);
+        if (!kv_read(meta_file, "script", value, sizeof(value)) || strcmp(value, script) != 0) {
+            continue;
+        }
+        //The newest of them is kept as the baseline of --cscript-bench, the others go
+        if (keep_previous && stat(meta_file, &st) == 0
+            && (st.st_mtim.tv_sec > newest.tv_sec
+                || (st.st_mtim.tv_sec == newest.tv_sec && st.st_mtim.tv_nsec > newest.tv_nsec))) {
+            newest = st.st_mtim;
+            char swap[sizeof(previous)];
+            snprintf(swap, sizeof(swap), "%s", previous);
+            snprintf(previous, sizeof(previous), "%s", de->d_name);
+            if (swap[0] == '\0') {
+                continue;
+            }
+            format_path(path, sizeof(path), "%s/%s", cache_dir, swap);
+        }
+        if (cache_remove(path, get_file_name(path))) {
+            count++;
+        }
+    }
+    closedir(d);
+    return count;
 }
 
 void cache_clear_single(sf_handle handle) {
@@ -51,57 +393,173 @@ void cache_clear_single(sf_handle handle) {
         exit(EXIT_FAILURE);
     }
     init_cache();
-    const char *full_cache_path = get_cache_path(sf->file_path);
-    printf("clearing single cscript cache\n%s", full_cache_path);
-    printf("for script: %s", sf->file_name);
-    char clear_cmd[4096];
-    sprintf(clear_cmd, "rm -Rf %s", full_cache_path);
-    system(clear_cmd);
+    char script[PATH_MAX];
+    snprintf(script, sizeof(script), "%s", sf->file_path[0] == '<' ? sf->file_path : get_real_path(sf->file_path));
+    printf("clearing single cscript cache\n%s\n", cache_get_entry_path(sf->key));
+    printf("for script: %s\n", sf->file_name);
+    char path[PATH_MAX + NAME_MAX];
+    format_path(path, sizeof(path), "%s/%s", cache_dir, sf->key);
+    if (dir_exists(path)) {
+        cache_remove(path, sf->key);
+    }
+    remove_script_entries(script, sf->key, false);
+    empty_trash();
+}
+
+void cache_mark_used(const char *path) {
+    //The last use is recorded in the modification time, at most once per interval to keep hits cheap
+    struct stat st;
+    if (cache_writes && stat(path, &st) == 0 && difftime(time(nullptr), st.st_mtime) > CACHE_USE_INTERVAL) {
+        utimensat(AT_FDCWD, path, nullptr, 0);
+    }
+}
+
+const char* item_id(const char *name) {
+    //Items are named <id>, <id>.<suffix> or <name>.<id>.o, temporary files end with a pid
+    static char id[SHA256_HASH_LENGTH * 2 + 1];
+    const char *last = strrchr(name, '.');
+    if (last == nullptr || strcmp(last, ".o") == 0 || strcmp(last, ".so") == 0) {
+        const size_t len = last != nullptr ? (size_t)(last - name) : strlen(name);
+        if (len >= SHA256_HASH_LENGTH * 2 && (len == SHA256_HASH_LENGTH * 2
+                                              || name[len - SHA256_HASH_LENGTH * 2 - 1] == '.')) {
+            snprintf(id, sizeof(id), "%.*s", SHA256_HASH_LENGTH * 2, name + len - SHA256_HASH_LENGTH * 2);
+            if (cache_is_key(id)) {
+                return id;
+            }
+        }
+    }
+    return nullptr;
+}
+
+int invalidate_items(const char *subdir, const char *prefix, const double max_age, const time_t now) {
+    //Runtime libraries, modules, embedded file ids, pkg-config results, repl snippets and toolchain versions
+    char dir[PATH_MAX];
+    format_path(dir, sizeof(dir), "%s/%s", cache_dir, subdir);
+    DIR *d = opendir(dir);
+    if (d == nullptr) {
+        return 0;
+    }
+    int count = 0;
+    const struct dirent *de;
+    while ((de = readdir(d)) != nullptr) {
+        char path[PATH_MAX + NAME_MAX];
+        char trash_name[NAME_MAX + 32];
+        struct stat st;
+        const char *id = item_id(de->d_name);
+        if (id == nullptr || (prefix != nullptr && strncmp(id, prefix, strlen(prefix)) != 0)) {
+            continue;
+        }
+        format_path(path, sizeof(path), "%s/%s", dir, de->d_name);
+        if (max_age >= 0 && stat(path, &st) == 0 && difftime(now, st.st_mtime) <= max_age) {
+            continue;
+        }
+        snprintf(trash_name, sizeof(trash_name), "%s.%s", subdir, de->d_name);
+        if (cache_remove(path, trash_name)) {
+            count++;
+        }
+    }
+    closedir(d);
+    return count;
+}
+
+int cache_invalidate(const char *prefix, const double max_age) {
+    init_cache();
+    if (prefix != nullptr && strspn(prefix, "0123456789abcdef") != strlen(prefix)) {
+        fprintf(stderr, "cscript: invalid key prefix %s\n", prefix);
+        exit(EXIT_FAILURE);
+    }
+    DIR *d = opendir(cache_dir);
+    if (d == nullptr) {
+        return 0;
+    }
+    const time_t now = time(nullptr);
+    int count = 0;
+    const struct dirent *de;
+    while ((de = readdir(d)) != nullptr) {
+        char path[PATH_MAX + NAME_MAX];
+        struct stat st;
+        struct stat meta_st;
+        if (!cache_is_key(de->d_name)
+            || (prefix != nullptr && strncmp(de->d_name, prefix, strlen(prefix)) != 0)) {
+            continue;
+        }
+        //The age of an entry is the time of its last use or compilation, whichever is later
+        format_path(path, sizeof(path), "%s/%s/meta", cache_dir, de->d_name);
+        const bool has_meta = stat(path, &meta_st) == 0;
+        format_path(path, sizeof(path), "%s/%s", cache_dir, de->d_name);
+        if (max_age >= 0 && stat(path, &st) == 0) {
+            const time_t used = has_meta && meta_st.st_mtime > st.st_mtime ? meta_st.st_mtime : st.st_mtime;
+            if (difftime(now, used) <= max_age) {
+                continue;
+            }
+        }
+        if (move_to_trash(path, de->d_name)) {
+            count++;
+        } else {
+            fprintf(stderr, "cscript: could not remove %s: %s\n", path, strerror(errno));
+        }
+    }
+    closedir(d);
+    const char *subdirs[] = { "runtime", "modules", "placement", "embed", "pkg", "repl", "toolchain" };
+    for (size_t i = 0; i < sizeof(subdirs) / sizeof(subdirs[0]); i++) {
+        count += invalidate_items(subdirs[i], prefix, max_age, now);
+    }
+    count += bundle_invalidate(prefix, max_age);
+    if (count > 0 || adopt_stale_trash() > 0) {
+        empty_trash();
+    }
+    return count;
 }
 
 bool cache_check(sf_handle handle) {
     const auto sf = (script_file*)handle;
-    char * line = nullptr;
-    size_t len = 0;
     if (sf == nullptr) {
         fprintf(stderr, "cache_check: handle must not be null/n");
         exit(EXIT_FAILURE);
     }
     init_cache();
 
-    const char *full_cache_path = get_cache_path(sf->file_path);
+    //The read-only layers are searched first, in the given order
+    for (int i = 0; i < cache_layer_count; i++) {
+        char layer_path[PATH_MAX];
+        //A layer too deep for an entry path can't hold one
+        const int len = snprintf(layer_path, sizeof(layer_path), "%s/%s", cache_layers[i], sf->key);
+        if (len < 0 || (size_t)len >= sizeof(layer_path)) {
+            continue;
+        }
+        script_file_set_executable_path(sf, layer_path);
+        if (layer_entry_check(sf, cache_layers[i], layer_path)) {
+            //The layers are read-only, a compatible build found there is used as it is
+            sf->native_fallback = false;
+#if DEBUG == 1
+            printf("DBG: cache_check: found in read-only layer %s\n", cache_layers[i]);
+#endif
+            return true;
+        }
+    }
+
+    const char *full_cache_path = cache_get_entry_path(sf->key);
     script_file_set_executable_path(sf, full_cache_path);
 #if DEBUG == 1
     printf("DBG: cache_check: sf->executable_path: %s\n", sf->executable_path);
 #endif
 
     if (!dir_exists(full_cache_path)) {
-        mkdir_p(full_cache_path, 0700);
+        mkdir_p(full_cache_path, cache_dir_mode());
 #if DEBUG == 1
         printf("DBG: cache_check: return false\n");
 #endif
         return false;
     }
-    char hash_file[PATH_MAX];
-    sprintf(hash_file, "%s/hash", full_cache_path);
-    FILE *fp = fopen(hash_file, "r");
-    if (!fp) {
-#if DEBUG == 1
-        printf("DBG: cache_check: return false\n");
-#endif
-        return false;
+    //The key is written last by cache_update(), so it marks a complete entry
+    char meta_file[PATH_MAX];
+    char key[256];
+    format_path(meta_file, sizeof(meta_file), "%s/meta", full_cache_path);
+    bool result = kv_read(meta_file, "key", key, sizeof(key)) && strcmp(key, sf->key) == 0
+                  && select_executable(sf, full_cache_path);
+    if (result) {
+        cache_mark_used(full_cache_path);
     }
-    bool result = false;
-    if (getline(&line, &len, fp) != -1) {
-#if DEBUG == 1
-        printf("DBG: loaded hash    : %s\n", line);
-        printf("DBG: calculated hash: %s\n", sf->hash);
-#endif
-        if (strcmp(line, sf->hash) == 0) {
-            result = true;
-        }
-    }
-    fclose(fp);
 #if DEBUG == 1
     printf("DBG: cache_check: return %s\n", result ? "true" : "false");
 #endif
@@ -110,40 +568,180 @@ bool cache_check(sf_handle handle) {
 
 void cache_update(sf_handle handle) {
     const auto sf = (script_file*)handle;
-    char * line = nullptr;
-    size_t len = 0;
     if (sf == nullptr) {
         fprintf(stderr, "cache_check: handle must not be null/n");
         exit(EXIT_FAILURE);
     }
     init_cache();
 
-    const char *cache_path = get_cache_path(sf->file_path);
+    const char *cache_path = cache_get_entry_path(sf->key);
     if (!dir_exists(cache_path)) {
-        mkdir_p(cache_path, 0700);
+        mkdir_p(cache_path, cache_dir_mode());
     }
-    char hash_file[PATH_MAX];
-    sprintf(hash_file, "%s/hash", cache_path);
-    FILE *fp = fopen(hash_file, "w");
-    if (!fp) {
-        fprintf(stderr, "cache_update: could not write to hash file: %s/n", hash_file);
+    //Keep the debug information of -g builds next to the executable instead of in it
+    if (file_exists(sf->executable_path)) {
+        elf_split_debug(sf->executable_path);
+    }
+    char meta_file[PATH_MAX];
+    char compile_ms[32];
+    char cpu_name[32];
+    format_path(meta_file, sizeof(meta_file), "%s/meta", cache_path);
+    sprintf(compile_ms, "%.3f", sf->compile_ms);
+    sprintf(cpu_name, "cpu.%s", cpu_fingerprint());
+    if (kv_write(meta_file, "source", sf->hash) != 0
+        || kv_write(meta_file, "gcc_args", sf->gcc_args) != 0
+        || kv_write(meta_file, "toolchain", sf->toolchain) != 0
+        || kv_write(meta_file, "cc", sf->cc) != 0
+        || (sf->ld[0] != '\0' && kv_write(meta_file, "ld", sf->ld) != 0)
+        || (sf->deps[0] != '\0' && kv_write(meta_file, "deps", sf->deps) != 0)
+        || kv_write(meta_file, "script", sf->file_path[0] == '<' ? sf->file_path : get_real_path(sf->file_path)) != 0
+        || (sf->compile_ms > 0.0 && kv_write(meta_file, "compile_ms", compile_ms) != 0)
+        || (sf->autotune && kv_write(meta_file, "autotune_flags", sf->tuned_flags) != 0)
+        || (sf->autotune && kv_write(meta_file, "autotune_timings", sf->tune_timings) != 0)
+        || (sf->native && kv_write(meta_file, cpu_name, cpu_features()) != 0)
+        || kv_write(meta_file, "key", sf->key) != 0) {
+        fprintf(stderr, "cache_update: could not write to meta file: %s\n", meta_file);
         exit(EXIT_FAILURE);
     }
-    fputs(sf->hash, fp);
-    fclose(fp);
+    //A script has its current entry and the previous one, older versions are removed
+    if (sf->file_path[0] != '<' && cache_writes
+        && remove_script_entries(get_real_path(sf->file_path), sf->key, true) > 0) {
+        empty_trash();
+    }
 #if DEBUG == 1
-    printf("DBG: cache_update: wrote hash file %s\n", hash_file);
+    printf("DBG: cache_update: wrote meta file %s\n", meta_file);
 #endif
 }
 
+void print_meta(const char *meta_file, const char *label, const char *name) {
+    char value[4096];
+    if (kv_read(meta_file, name, value, sizeof(value))) {
+        printf("%-16s %s\n", label, value);
+    }
+}
 
-const char* get_cache_path(const char *filePath) {
-    static char cache_path[PATH_MAX];
-    const char *fullPath = get_real_path(filePath);
-    char* hash = sha256_string(fullPath);
-    sprintf(cache_path, "%s/%s", cache_dir, hash);
+void cache_print_compile_report(sf_handle handle) {
+    const auto sf = (script_file*)handle;
+    if (sf == nullptr) {
+        fprintf(stderr, "cache_print_compile_report: handle must not be null\n");
+        exit(EXIT_FAILURE);
+    }
+    if (!cache_check(sf)) {
+        fprintf(stderr, "cscript: %s is not cached, run it once first\n", sf->file_path);
+        exit(EXIT_FAILURE);
+    }
+    char path[PATH_MAX + 32];
+    sprintf(path, "%s/meta", sf->entry_path);
+    printf("%-16s %s\n", "script:", sf->file_path);
+    printf("%-16s %s\n", "cache entry:", sf->entry_path);
+    print_meta(path, "compiler:", "cc");
+    print_meta(path, "linker:", "ld");
+    print_meta(path, "gcc arguments:", "gcc_args");
+    print_meta(path, "toolchain:", "toolchain");
+    print_meta(path, "compile time ms:", "compile_ms");
+    print_meta(path, "autotune flags:", "autotune_flags");
+    print_meta(path, "autotune times:", "autotune_timings");
+    sprintf(path, "%s/compile-trace.json", sf->entry_path);
+    if (file_exists(path)) {
+        printf("%-16s %s\n", "time trace:", path);
+    }
+    sprintf(path, "%s/compile-report", sf->entry_path);
+    FILE *fp = fopen(path, "r");
+    if (fp == nullptr) {
+        printf("No compile report stored. Compile with CSCRIPT_COMPILE_REPORT=1 or #cscript compile-report.\n");
+        return;
+    }
+    char *content = read_stream(fp, nullptr);
+    fclose(fp);
+    if (content != nullptr) {
+        fputs(content, stdout);
+        free(content);
+    }
+}
+
+const char* cache_find_previous(sf_handle handle) {
+    const auto sf = (script_file*)handle;
+    if (sf == nullptr) {
+        fprintf(stderr, "cache_find_previous: handle must not be null\n");
+        exit(EXIT_FAILURE);
+    }
+    //Scripts without a path have no history
+    if (sf->file_path[0] == '<') {
+        return nullptr;
+    }
+    static char previous[PATH_MAX];
+    char script[PATH_MAX];
+    snprintf(script, sizeof(script), "%s", get_real_path(sf->file_path));
+    init_cache();
+    DIR *d = opendir(cache_dir);
+    if (d == nullptr) {
+        return nullptr;
+    }
+    struct timespec newest = { 0, 0 };
+    previous[0] = '\0';
+    const struct dirent *de;
+    while ((de = readdir(d)) != nullptr) {
+        char meta_file[PATH_MAX];
+        char value[PATH_MAX];
+        char bin[PATH_MAX];
+        struct stat st;
+        if (de->d_name[0] == '.' || strcmp(de->d_name, sf->key) == 0) {
+            continue;
+        }
+        format_path(meta_file, sizeof(meta_file), "%s/%s/meta", cache_dir, de->d_name);
+        format_path(bin, sizeof(bin), "%s/%s/%s", cache_dir, de->d_name, get_file_name(sf->executable_path));
+        if (!kv_read(meta_file, "script", value, sizeof(value)) || strcmp(value, script) != 0
+            || !kv_read(meta_file, "key", value, sizeof(value)) || stat(meta_file, &st) != 0 || !file_exists(bin)) {
+            continue;
+        }
+        if (st.st_mtim.tv_sec > newest.tv_sec
+            || (st.st_mtim.tv_sec == newest.tv_sec && st.st_mtim.tv_nsec > newest.tv_nsec)) {
+            newest = st.st_mtim;
+            strcpy(previous, bin);
+        }
+    }
+    closedir(d);
 #if DEBUG == 1
-    printf("DBG: get_cache_path: cache path: %s\n", cache_path);
+    printf("DBG: cache_find_previous: %s\n", previous);
+#endif
+    return previous[0] != '\0' ? previous : nullptr;
+}
+
+void cache_store_image(sf_handle handle, const int fd) {
+    const auto sf = (script_file*)handle;
+    if (sf == nullptr) {
+        fprintf(stderr, "cache_store_image: handle must not be null\n");
+        exit(EXIT_FAILURE);
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        fprintf(stderr, "cache_store_image: could not stat image of %s\n", sf->file_name);
+        exit(EXIT_FAILURE);
+    }
+    //Write to a temporary file first, so a concurrent run never sees a partial executable
+    char tmp_path[PATH_MAX + 16];
+    sprintf(tmp_path, "%s.%d", sf->executable_path, getpid());
+    const int out = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC, cache_file_mode(0755));
+    if (out == -1) {
+        fprintf(stderr, "cache_store_image: could not write to %s\n", tmp_path);
+        exit(EXIT_FAILURE);
+    }
+    off_t offset = 0;
+    while (offset < st.st_size) {
+        if (sendfile(out, fd, &offset, st.st_size - offset) <= 0) {
+            fprintf(stderr, "cache_store_image: could not write to %s\n", tmp_path);
+            close(out);
+            unlink(tmp_path);
+            exit(EXIT_FAILURE);
+        }
+    }
+    close(out);
+    if (rename(tmp_path, sf->executable_path) != 0) {
+        fprintf(stderr, "cache_store_image: could not write to %s\n", sf->executable_path);
+        unlink(tmp_path);
+        exit(EXIT_FAILURE);
+    }
+#if DEBUG == 1
+    printf("DBG: cache_store_image: wrote %s\n", sf->executable_path);
 #endif
-    return cache_path;
 }
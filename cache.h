@@ -9,16 +9,22 @@
 
 #pragma once
 
+#include <sys/types.h>
+
 #include "script_file.h"
 
 /**
  * @brief Checks if a cache for a given script file exists.
  *
- * Checks if a cache for a given script file exists.  If yes, it also
- * checks if the script file has changed since the last execution.
- * Returns true if the cache exists and the file has not changed.
- * The cache directory ({~/.cscript/cache/{hash-of-filepath}) will be
+ * Checks if a cache for a given script file exists.  The cache entries are
+ * addressed by the key of the script file, which covers the source, the gcc
+ * arguments and the toolchain, so a changed script file never finds an
+ * outdated entry. Returns true if the entry is complete.
+ * The cache directory ({~/.cscript/cache/{key}) will be
  * created if it does not exist yet.
+ * If CSCRIPT_CACHE_PATH contains read-only layers, they are searched first.
+ * Their entries are only used when they belong to root or the current user
+ * and are not writable by group or others.
  *
  * @param handle The handle of the script information
  * @return true if the file is cached and has not changed.
@@ -29,22 +35,183 @@ bool cache_check(sf_handle handle);
  * @brief Updates the cache for script file
  *
  * Used when a script file has changed or is being executed for the first time.
- * Updates tha hash file that determines if the script file has changed.
+ * Writes the meta file of the cache entry, which records the hashes and the
+ * toolchain identity. The key is written last and marks the entry as complete.
+ * Of the other entries recorded for the same script path, only the newest is
+ * kept as the previous build, the older ones are removed.
  *
  * @param handle The handle of the script information
  */
 void cache_update(sf_handle handle);
 
+/**
+ * @brief Gets the cache directory
+ *
+ * @return The path of the writable cache directory
+ */
+const char* cache_get_dir();
+
+/**
+ * @brief Gets the path of a cache entry
+ *
+ * The pointer to the buffer containing the path will be overwritten
+ * on a subsequent use of this function. Not thread safe!
+ *
+ * @param key The key of the cache entry
+ * @return The path of the cache entry directory
+ */
+const char* cache_get_entry_path(const char *key);
+
+/**
+ * @brief Checks if the cache directory has been set explicitly
+ *
+ * The cache directory defaults to ~/.cscript/cache/ and can be moved
+ * to another path by setting the environment variable CSCRIPT_CACHE_DIR.
+ * CSCRIPT_CACHE_PATH can be set to a colon-separated list of cache directories,
+ * e.g. /var/cache/cscript:~/.cscript/cache. All but the last one are read-only
+ * layers (usually system-wide caches populated by an admin), the last one is
+ * the writable cache directory.
+ *
+ * @return true if CSCRIPT_CACHE_DIR or CSCRIPT_CACHE_PATH is set.
+ */
+bool cache_dir_configured();
+
+/**
+ * @brief Disables the writes of helper data to the cache directory
+ *
+ * Used in diskless mode without a configured cache directory, so nothing is
+ * written to the disk. Helper data (e.g. resolved packages) is determined on
+ * every run then.
+ */
+void cache_disable_writes();
+
+/**
+ * @brief Checks if helper data may be written to the cache directory
+ *
+ * @return false if cache_disable_writes() has been called
+ */
+bool cache_writes_enabled();
+
+/**
+ * @brief Returns the mode for new directories in the cache directory
+ *
+ * A shared cache (CSCRIPT_CACHE_SHARED=1, or an existing cache directory that
+ * is readable by everybody, e.g. a system-wide layer) must be readable by all
+ * users, a private cache only by its owner.
+ *
+ * @return 0755 for a shared cache, 0700 otherwise
+ */
+mode_t cache_dir_mode();
+
+/**
+ * @brief Returns the mode for a new file in the cache directory
+ *
+ * @param mode The mode the file should have
+ * @return @p mode masked by the umask for a shared cache, limited to the owner otherwise
+ */
+mode_t cache_file_mode(mode_t mode);
+
+/**
+ * @brief Prints the compile report of a script file
+ *
+ * Prints the compile time recorded in the cache entry of the script file
+ * and the compile time report (gcc -ftime-report) if it has been stored.
+ * Reports are stored when the script has been compiled with
+ * CSCRIPT_COMPILE_REPORT=1 or contains the directive @#cscript compile-report.
+ * For clang, the path of the -ftime-trace file is printed instead.
+ *
+ * @param handle The handle of the script information
+ */
+void cache_print_compile_report(sf_handle handle);
+
+/**
+ * @brief Finds the previous build of a script file
+ *
+ * Searches the writable cache directory for the most recent complete entry
+ * that has been built from an earlier version of the same script file
+ * (same path, other key).
+ * The pointer to the buffer containing the path will be overwritten
+ * on a subsequent use of this function. Not thread safe!
+ *
+ * @param handle The handle of the script information
+ * @return The path of the executable of the previous build or nullptr
+ */
+const char* cache_find_previous(sf_handle handle);
+
+/**
+ * @brief Stores an in-memory executable in the cache
+ *
+ * Copies the executable image referenced by @p fd (e.g. created by
+ * script_file_compile_memfd()) to the executable path of the script file.
+ * The image is read through pread semantics, the file offset of @p fd is not changed.
+ *
+ * @param handle The handle of the script information
+ * @param fd The file descriptor of the executable image
+ */
+void cache_store_image(sf_handle handle, int fd);
+
 /**
  * @brief Clears the complete cache
  *
- * Deletes the complete cache for the current user
+ * Deletes the complete cache for the current user. The cache directory is
+ * renamed first, so the cache is empty at once for all concurrent runs, then
+ * a detached child process deletes the files. Renamed roots left behind by an
+ * earlier clear whose child process has been killed are deleted as well, also
+ * whenever the trash of the cache is emptied.
  */
 void cache_clear();
 
 /**
  * @brief Clears the cache for the script file
  *
-  * @param handle The handle of the script information
+ * Moves the cache entry of the script file and the entries left behind by
+ * earlier versions of it (found by the script path in their meta file) to the
+ * trash directory of the cache, from where a detached child process deletes them.
+ *
+ * @param handle The handle of the script information
+ */
+void cache_clear_single(sf_handle handle);
+
+/**
+ * @brief Invalidates cache entries
+ *
+ * Removes the cache entries whose key starts with @p prefix and that have not
+ * been used or written for more than @p max_age seconds, like cache_clear_single().
+ * The runtime libraries, module and placement objects, embedded file ids, pkg-config results,
+ * repl snippets and toolchain versions are removed by their id and last use the same way.
+ *
+ * @param prefix The key prefix, nullptr or empty for all keys
+ * @param max_age The age in seconds, negative for any age
+ * @return The number of removed entries
+ */
+int cache_invalidate(const char *prefix, double max_age);
+
+/**
+ * @brief Removes a cache item
+ *
+ * Moves @p path to the trash directory of the cache, which is emptied by the
+ * end of cache_invalidate() in the background.
+ *
+ * @param path The path of the cache entry directory or item
+ * @param name The name of the item in the trash directory
+ * @return true if the item has been moved, false with a message otherwise
+ */
+bool cache_remove(const char *path, const char *name);
+
+/**
+ * @brief Records the use of a cache item
+ *
+ * Sets the modification time of @p path to now, which cache_invalidate() takes
+ * as the last use. To keep cache hits cheap, the time is only updated once a minute.
+ *
+ * @param path The path of the cache entry directory or item
+ */
+void cache_mark_used(const char *path);
+
+/**
+ * @brief Checks a cache entry name
+ *
+ * @param name The name of a file in the cache directory
+ * @return true if the name is a cache key, i.e. the name of a cache entry
  */
-void cache_clear_single(sf_handle handle);
\ No newline at end of file
+bool cache_is_key(const char *name);
\ No newline at end of file
@@ -0,0 +1,137 @@
+/**
+ * @file cpu.c
+ * @author Stefan Kleinschmiodt
+ * @date 13. Nov 2024
+ * @brief Contains the implementations of the cpu related functions for cscript.
+ *
+ * Provides the cpu fingerprint for -march=native builds.
+ */
+#define _GNU_SOURCE
+#include "cpu.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#elif defined(__aarch64__)
+#include <sys/auxv.h>
+#endif
+
+#include "sha256.h"
+
+/**
+ * @brief The identity of the current cpu, determined once
+ */
+static struct {
+    bool done;
+    bool known; /**< The feature mask could be determined. */
+    uint32_t words[CPU_FEATURE_WORDS];
+    char model[128];
+    char features[CPU_FEATURE_WORDS * 8 + 1];
+    char fingerprint[17];
+} cpu;
+
+void cpu_detect() {
+    if (cpu.done) {
+        return;
+    }
+    cpu.done = true;
+    memset(cpu.words, 0, sizeof(cpu.words));
+#if defined(__x86_64__) || defined(__i386__)
+    unsigned a, b, c, d;
+    char vendor[13] = "";
+    const unsigned max = __get_cpuid_max(0, nullptr);
+    __cpuid(0, a, b, c, d);
+    memcpy(vendor, &b, 4);
+    memcpy(vendor + 4, &d, 4);
+    memcpy(vendor + 8, &c, 4);
+    vendor[12] = '\0';
+    if (max >= 1) {
+        __cpuid(1, a, b, c, d);
+        cpu.words[0] = c;
+        cpu.words[1] = d;
+        snprintf(cpu.model, sizeof(cpu.model), "%s-%x-%x", vendor, (a >> 8 & 0xf) + (a >> 20 & 0xff),
+                 (a >> 4 & 0xf) | (a >> 12 & 0xf0));
+    }
+    if (max >= 7) {
+        __cpuid_count(7, 0, a, b, c, d);
+        cpu.words[2] = b;
+        cpu.words[3] = c;
+        cpu.words[4] = d;
+        __cpuid_count(7, 1, a, b, c, d);
+        cpu.words[5] = a;
+    }
+    if (__get_cpuid_max(0x80000000, nullptr) >= 0x80000001) {
+        __cpuid(0x80000001, a, b, c, d);
+        cpu.words[6] = c;
+        cpu.words[7] = d;
+    }
+    cpu.known = true;
+#elif defined(__aarch64__)
+    const unsigned long hwcap = getauxval(AT_HWCAP);
+    const unsigned long hwcap2 = getauxval(AT_HWCAP2);
+    cpu.words[0] = (uint32_t)hwcap;
+    cpu.words[1] = (uint32_t)(hwcap >> 32);
+    cpu.words[2] = (uint32_t)hwcap2;
+    cpu.words[3] = (uint32_t)(hwcap2 >> 32);
+    snprintf(cpu.model, sizeof(cpu.model), "aarch64");
+    cpu.known = true;
+#else
+    //Without a feature mask, every host gets its own build
+    snprintf(cpu.model, sizeof(cpu.model), "host-");
+    gethostname(cpu.model + 5, sizeof(cpu.model) - 6);
+    cpu.model[sizeof(cpu.model) - 1] = '\0';
+#endif
+    cpu.features[0] = '\0';
+    if (cpu.known) {
+        for (int i = 0; i < CPU_FEATURE_WORDS; i++) {
+            sprintf(cpu.features + i * 8, "%08x", cpu.words[i]);
+        }
+    }
+    char identity[sizeof(cpu.model) + sizeof(cpu.features) + 2];
+    snprintf(identity, sizeof(identity), "%s:%s", cpu.model, cpu.features);
+    snprintf(cpu.fingerprint, sizeof(cpu.fingerprint), "%s", sha256_string(identity));
+#if DEBUG == 1
+    printf("DBG: cpu_detect: %s -> %s\n", identity, cpu.fingerprint);
+#endif
+}
+
+const char* cpu_fingerprint() {
+    cpu_detect();
+    return cpu.fingerprint;
+}
+
+const char* cpu_features() {
+    cpu_detect();
+    return cpu.features;
+}
+
+bool cpu_compatible(const char *features, int *score) {
+    cpu_detect();
+    if (!cpu.known || features == nullptr || strlen(features) != CPU_FEATURE_WORDS * 8) {
+        return false;
+    }
+    int bits = 0;
+    for (int i = 0; i < CPU_FEATURE_WORDS; i++) {
+        char word[9];
+        memcpy(word, features + i * 8, 8);
+        word[8] = '\0';
+        const uint32_t required = (uint32_t)strtoul(word, nullptr, 16);
+        if ((required & ~cpu.words[i]) != 0) {
+            return false;
+        }
+        bits += __builtin_popcount(required);
+    }
+    if (score != nullptr) {
+        *score = bits;
+    }
+    return true;
+}
+
+bool cpu_native_args(const char *args) {
+    return args != nullptr && (strstr(args, "-march=native") != nullptr || strstr(args, "-mtune=native") != nullptr
+                               || strstr(args, "-mcpu=native") != nullptr);
+}
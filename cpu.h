@@ -0,0 +1,56 @@
+/**
+ * @file cpu.h
+ * @author Stefan Kleinschmiodt
+ * @date 13. Nov 2024
+ * @brief Contains the cpu related functions for cscript.
+ *
+ * Provides a fingerprint of the features of the current cpu. Executables built
+ * with -march=native only run on cpus providing the same features, so the cache
+ * keeps one executable per fingerprint and selects the one matching the cpu.
+ */
+#pragma once
+
+/**
+ * @brief The number of 32 bit words of a feature mask
+ */
+#define CPU_FEATURE_WORDS 8
+
+/**
+ * @brief Gets the fingerprint of the current cpu
+ *
+ * The fingerprint covers the feature flags (cpuid on x86, hwcaps on arm64) and
+ * the vendor, family and model, which select the tuning of -march=native.
+ * On other architectures, the host name is used, so every host gets its own build.
+ *
+ * @return The fingerprint as 16 hex digits, the buffer is reused on every call
+ */
+const char* cpu_fingerprint();
+
+/**
+ * @brief Gets the feature mask of the current cpu
+ *
+ * @return The feature mask as hex digits, an empty string if the features
+ *         can't be determined on this architecture
+ */
+const char* cpu_features();
+
+/**
+ * @brief Checks if an executable can run on the current cpu
+ *
+ * An executable is compatible if the cpu has all the features of the cpu it has
+ * been built on. The score is the number of features used by the executable, so
+ * the compatible executable with the highest score is the best one.
+ *
+ * @param features The feature mask of the cpu the executable has been built on
+ * @param score Receives the score of the executable, may be nullptr
+ * @return true if the executable can run on the current cpu
+ */
+bool cpu_compatible(const char *features, int *score);
+
+/**
+ * @brief Checks if compiler arguments request tuning for the current cpu
+ *
+ * @param args The compiler arguments
+ * @return true if @p args contain -march=native, -mtune=native or -mcpu=native
+ */
+bool cpu_native_args(const char *args);
@@ -40,8 +40,15 @@
 #include <string.h>
 #include <unistd.h>
 
+#include "bench.h"
+#include "bundle.h"
 #include "cache.h"
+#include "pack.h"
+#include "remote.h"
+#include "repl.h"
 #include "script_file.h"
+#include "tools.h"
+#include "warm.h"
 
 /**
  * @brief Entry point of cscript.
@@ -53,6 +60,30 @@
  * delete the cache files for the specific script.
  * If cscript has been called directly with the argument --cscriptclear, script will
  * delete all the cache files of all scripts run by the current user.
+ * cscript --cscript-invalidate key={prefix} deletes the cache entries whose key starts with the prefix,
+ * cscript --cscript-invalidate older={age} those not used for more than {age} (e.g. 30d, 12h).
+ * cscript --cscript-pack-export {file} [{scripts}...] writes the cache entries of the given
+ * scripts (or of all cached scripts) into a cache pack, cscript --cscript-pack-import {file}
+ * reads the entries back into the cache of another container or host.
+ * Instead of a script file, the c code can be given on the command line (cscript -e {code})
+ * or be read from stdin (cscript -). Additional gcc arguments for such scripts can be given
+ * with --gcc {args}. Their cache entries are keyed by content and arguments only.
+ * cscript --cscript-compile-report {script} shows the recorded compile time and the stored
+ * compile time report of a script (see cache_print_compile_report()).
+ * cscript --cscript-bundle {file} {scripts}... links the scripts into one multi-call executable
+ * (see bundle_create()). A bundled script is run from its bundle as long as it is unchanged.
+ * cscript --cscript-repl [{gcc args}...] starts an interactive session (see repl_run()).
+ * cscript --cscript-cache-server {address} [{dir}] serves cache entries to the remote caches
+ * of other hosts (see remote_serve()).
+ * cscript --cscript-warm {scripts}... reads the executables of the scripts and their libraries
+ * into the page cache and pins those of scripts marked with @#cscript pin (see warm_scripts()).
+ * Options for cscript itself (--cscript-...) can be given before the script file path:
+ * - --cscript-diskless (or CSCRIPT_DISKLESS=1): compile into memory and execute from there.
+ *   Nothing is written to the disk, unless CSCRIPT_CACHE_DIR names a cache directory to use.
+ * - --cscript-perf (or CSCRIPT_PERF=1): measure the script with hardware performance counters
+ *   and report them on exit (or append them as JSON to the file named by CSCRIPT_PERF_LOG).
+ * - --cscript-bench[=N]: run the compiled script N times (default 10) after some warmup runs
+ *   and print statistics of the run times, see bench_script().
  * @param argc The number of arguments provided.
  * @param argv array of strings containing the arguments.
  * @return EXIT_SUCCESS on success, EXIT_FAILURE on error.
@@ -74,31 +105,171 @@ int main(const int argc, char *argv[]) {
         cache_clear();
         exit(EXIT_SUCCESS);
     }
-    //argv[1] should contain the script file path
-    sf_handle sf = script_file_open(argv[1]);
+    //Check if cache entries have to be invalidated
+    if (strcmp(argv[1], "--cscript-invalidate") == 0 && argc > 2) {
+        const char *prefix = nullptr;
+        double max_age = -1;
+        for (int i = 2; i < argc; i++) {
+            bool valid = true;
+            if (strncmp(argv[i], "key=", 4) == 0 && strlen(argv[i]) > 4) {
+                prefix = argv[i] + 4;
+            } else if (strncmp(argv[i], "older=", 6) == 0) {
+                max_age = parse_duration(argv[i] + 6);
+                valid = max_age >= 0;
+            } else {
+                valid = false;
+            }
+            if (!valid) {
+                fprintf(stderr, "cscript: invalid argument %s, use key={prefix} or older={age}\n", argv[i]);
+                exit(EXIT_FAILURE);
+            }
+        }
+        printf("invalidated %d cscript cache entries\n", cache_invalidate(prefix, max_age));
+        exit(EXIT_SUCCESS);
+    }
+    //Check if a cache pack has to be exported or imported
+    if (strcmp(argv[1], "--cscript-pack-export") == 0 && argc > 2) {
+        pack_export(argv[2], argc - 3, argv + 3);
+        exit(EXIT_SUCCESS);
+    }
+    if (strcmp(argv[1], "--cscript-pack-import") == 0 && argc > 2) {
+        pack_import(argv[2]);
+        exit(EXIT_SUCCESS);
+    }
+    //Check if the compile report of a script has to be shown
+    if (strcmp(argv[1], "--cscript-compile-report") == 0 && argc > 2) {
+        cache_print_compile_report(script_file_open(argv[2]));
+        exit(EXIT_SUCCESS);
+    }
+    //Check if scripts have to be bundled
+    if (strcmp(argv[1], "--cscript-bundle") == 0 && argc > 3) {
+        bundle_create(argv[2], argc - 3, argv + 3);
+        exit(EXIT_SUCCESS);
+    }
+    //Check if cache entries have to be served to other hosts
+    if (strcmp(argv[1], "--cscript-cache-server") == 0 && argc > 2) {
+        remote_serve(argv[2], argc > 3 ? argv[3] : nullptr);
+    }
+    //Check if the page cache has to be warmed for scripts
+    if (strcmp(argv[1], "--cscript-warm") == 0 && argc > 2) {
+        warm_scripts(argc - 2, argv + 2);
+        exit(EXIT_SUCCESS);
+    }
+    //Check if an interactive session has to be started
+    if (strcmp(argv[1], "--cscript-repl") == 0) {
+        repl_run(argc - 2, argv + 2);
+        exit(EXIT_SUCCESS);
+    }
+    //Options for cscript itself precede the script file path
+    bool diskless = env_flag("CSCRIPT_DISKLESS");
+    bool perf = env_flag("CSCRIPT_PERF");
+    int bench_runs = 0;
+    const char *inline_source = nullptr;
+    const char *gcc_args = nullptr;
+    bool from_stdin = false;
+    int first = 1;
+    while (first < argc) {
+        if (strcmp(argv[first], "--cscript-diskless") == 0) {
+            diskless = true;
+        } else if (strcmp(argv[first], "--cscript-perf") == 0) {
+            perf = true;
+        } else if (strncmp(argv[first], "--cscript-bench", 15) == 0
+                   && (argv[first][15] == '\0' || argv[first][15] == '=')) {
+            bench_runs = argv[first][15] == '=' ? atoi(argv[first] + 16) : 10;
+            if (bench_runs < 1) {
+                fprintf(stderr, "cscript: invalid number of runs: %s\n", argv[first]);
+                exit(EXIT_FAILURE);
+            }
+        } else if (strcmp(argv[first], "-e") == 0 && first + 1 < argc && !from_stdin) {
+            inline_source = argv[++first];
+        } else if (strcmp(argv[first], "-") == 0 && inline_source == nullptr && !from_stdin) {
+            from_stdin = true;
+        } else if (strcmp(argv[first], "--gcc") == 0 && first + 1 < argc) {
+            gcc_args = argv[++first];
+        } else if (strncmp(argv[first], "--cscript-", 10) == 0) {
+            fprintf(stderr, "cscript: unknown option %s\n", argv[first]);
+            exit(EXIT_FAILURE);
+        } else {
+            break;
+        }
+        first++;
+    }
+    if (diskless && !cache_dir_configured()) {
+        cache_disable_writes();
+    }
+    sf_handle sf;
+    if (inline_source != nullptr || from_stdin) {
+        //The script arguments follow the options, the name of the script takes the place in front of them
+        first--;
+        argv[first] = from_stdin ? "-" : "-e";
+        if (from_stdin) {
+            char *source = read_stream(stdin, nullptr);
+            if (source == nullptr) {
+                fprintf(stderr, "cscript: could not read the script from stdin\n");
+                exit(EXIT_FAILURE);
+            }
+            sf = script_file_open_source("stdin", source, gcc_args);
+            free(source);
+        } else {
+            sf = script_file_open_source("inline", inline_source, gcc_args);
+        }
+    } else {
+        if (first >= argc) {
+            fprintf(stderr, "cscript called without a script file.\n");
+            exit(EXIT_FAILURE);
+        }
+        if (gcc_args != nullptr) {
+            fprintf(stderr, "cscript: --gcc can only be used with -e or -\n");
+            exit(EXIT_FAILURE);
+        }
+        sf = script_file_open(argv[first]);
+    }
+    script_file_set_perf(sf, perf);
+    //From here on, script_argv[0] is the script file and the rest are its arguments
+    const int script_argc = argc - first;
+    char **script_argv = argv + first;
+
 #if DEBUG == 1
     printf("DBG: initial script_file:\n");
     script_file_dump(sf);
 #endif
     //Check if script cache clear is due
-    if (argc > 2 && strcmp(argv[2], "--cscriptclear") == 0) {
+    if (script_argc > 1 && strcmp(script_argv[1], "--cscriptclear") == 0) {
         cache_clear_single(sf);
         exit(EXIT_SUCCESS);
     }
 
-    //Check if there is a current build available
-    if (!cache_check(sf)) {
-        //If not, compile the script file
-        script_file_compile(sf);
-        //and update the hash in the cacha
-        cache_update(sf);
+    if (diskless && bench_runs > 0) {
+        fprintf(stderr, "cscript: --cscript-bench needs the cache and can't be used with --cscript-diskless\n");
+        exit(EXIT_FAILURE);
+    }
+    if (diskless) {
+        //Without an explicitly configured cache directory nothing touches the disk
+        const bool cached = cache_dir_configured();
+        if (cached && (bundle_select(sf) || cache_check(sf))) {
+            script_file_execute(sf, script_argc, script_argv);
+            return 0;
+        }
+        const int fd = script_file_compile_memfd(sf);
+        if (cached) {
+            cache_store_image(sf, fd);
+            cache_update(sf);
+        }
+        script_file_execute_memfd(sf, fd, script_argc, script_argv);
     }
+
+    //Use a current build or compile one
+    script_file_build(sf);
 #if DEBUG == 1
     printf("DBG: after cache_check script_file:\n");
     script_file_dump(sf);
 #endif
+    if (bench_runs > 0) {
+        bench_script(sf, bench_runs, script_argc, script_argv);
+        exit(EXIT_SUCCESS);
+    }
     //Execute the executable
-    script_file_execute(sf, argc, argv);
+    script_file_execute(sf, script_argc, script_argv);
 
     return 0;
 }
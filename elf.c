@@ -0,0 +1,220 @@
+/**
+ * @file elf.c
+ * @author Stefan Kleinschmiodt
+ * @date 13. Nov 2024
+ * @brief Contains the implementations of the ELF related functions for cscript.
+ *
+ * Provides the detection and the separation of the debug information of executables
+ * and the libraries an executable needs.
+ */
+#include "elf.h"
+
+#include <elf.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <linux/limits.h>
+
+/**
+ * @brief The section headers of an opened ELF file, converted to the 64 bit layout.
+ */
+typedef struct {
+    int fd; /**< The file descriptor of the ELF file. */
+    bool is64; /**< ELFCLASS64 file. */
+    int count; /**< The number of sections. */
+    Elf64_Shdr *sections; /**< The section headers. */
+    char *names; /**< The section names (.shstrtab). */
+    size_t names_size; /**< The size of the section names. */
+} elf_file;
+
+bool elf_read_at(const int fd, void *buffer, const size_t size, const off_t offset) {
+    return pread(fd, buffer, size, offset) == (ssize_t)size;
+}
+
+char* elf_read_section(const elf_file *ef, const Elf64_Shdr *sh) {
+    //Only sections stored in the file and of a sane size are read
+    if (sh->sh_type == SHT_NOBITS || sh->sh_size > 64 * 1024 * 1024) {
+        return nullptr;
+    }
+    char *data = (char*)malloc(sh->sh_size + 1);
+    if (data == nullptr || !elf_read_at(ef->fd, data, sh->sh_size, (off_t)sh->sh_offset)) {
+        free(data);
+        return nullptr;
+    }
+    data[sh->sh_size] = '\0';
+    return data;
+}
+
+void elf_close(elf_file *ef) {
+    free(ef->sections);
+    free(ef->names);
+    close(ef->fd);
+}
+
+bool elf_open(elf_file *ef, const char *path) {
+    memset(ef, 0, sizeof(*ef));
+    ef->fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (ef->fd == -1) {
+        return false;
+    }
+    //Only the section headers and the section names are read, not the whole file
+    unsigned char ident[EI_NIDENT];
+    Elf64_Off shoff = 0;
+    int shstrndx = 0;
+    if (!elf_read_at(ef->fd, ident, sizeof(ident), 0) || memcmp(ident, ELFMAG, SELFMAG) != 0) {
+        close(ef->fd);
+        return false;
+    }
+    ef->is64 = ident[EI_CLASS] == ELFCLASS64;
+    if (ef->is64) {
+        Elf64_Ehdr eh;
+        if (elf_read_at(ef->fd, &eh, sizeof(eh), 0) && eh.e_shentsize == sizeof(Elf64_Shdr)) {
+            shoff = eh.e_shoff;
+            ef->count = eh.e_shnum;
+            shstrndx = eh.e_shstrndx;
+        }
+    } else {
+        Elf32_Ehdr eh;
+        if (elf_read_at(ef->fd, &eh, sizeof(eh), 0) && eh.e_shentsize == sizeof(Elf32_Shdr)) {
+            shoff = eh.e_shoff;
+            ef->count = eh.e_shnum;
+            shstrndx = eh.e_shstrndx;
+        }
+    }
+    if (ef->count == 0 || shstrndx == SHN_UNDEF || shstrndx >= ef->count) {
+        close(ef->fd);
+        return false;
+    }
+    ef->sections = (Elf64_Shdr*)calloc(ef->count, sizeof(Elf64_Shdr));
+    bool ok = ef->sections != nullptr;
+    for (int i = 0; ok && i < ef->count; i++) {
+        if (ef->is64) {
+            ok = elf_read_at(ef->fd, &ef->sections[i], sizeof(Elf64_Shdr), (off_t)(shoff + i * sizeof(Elf64_Shdr)));
+        } else {
+            Elf32_Shdr sh;
+            ok = elf_read_at(ef->fd, &sh, sizeof(sh), (off_t)(shoff + i * sizeof(Elf32_Shdr)));
+            ef->sections[i] = (Elf64_Shdr){
+                .sh_name = sh.sh_name, .sh_type = sh.sh_type, .sh_flags = sh.sh_flags, .sh_addr = sh.sh_addr,
+                .sh_offset = sh.sh_offset, .sh_size = sh.sh_size, .sh_link = sh.sh_link, .sh_info = sh.sh_info,
+                .sh_addralign = sh.sh_addralign, .sh_entsize = sh.sh_entsize
+            };
+        }
+    }
+    if (ok) {
+        ef->names = elf_read_section(ef, &ef->sections[shstrndx]);
+        ef->names_size = ef->sections[shstrndx].sh_size;
+        ok = ef->names != nullptr;
+    }
+    if (!ok) {
+        elf_close(ef);
+    }
+    return ok;
+}
+
+const char* elf_section_name(const elf_file *ef, const Elf64_Shdr *sh) {
+    return sh->sh_name < ef->names_size ? ef->names + sh->sh_name : "";
+}
+
+bool elf_has_debug_info(const char *path) {
+    elf_file ef;
+    if (!elf_open(&ef, path)) {
+        return false;
+    }
+    bool found = false;
+    for (int i = 0; i < ef.count && !found; i++) {
+        const char *name = elf_section_name(&ef, &ef.sections[i]);
+        found = (strncmp(name, ".debug_", 7) == 0 && name[7] != '\0')
+                || (strncmp(name, ".zdebug_", 8) == 0 && name[8] != '\0');
+    }
+    elf_close(&ef);
+    return found;
+}
+
+void elf_append(char *list, const size_t size, const char *item) {
+    const size_t len = strlen(list);
+    snprintf(list + len, size - len, "%s%s", len > 0 ? " " : "", item);
+}
+
+bool elf_dependencies(const char *path, char *interp, const size_t interp_size, char *needed, const size_t needed_size,
+                      char *runpath, const size_t runpath_size) {
+    elf_file ef;
+    interp[0] = '\0';
+    needed[0] = '\0';
+    runpath[0] = '\0';
+    if (!elf_open(&ef, path)) {
+        return false;
+    }
+    for (int i = 0; i < ef.count; i++) {
+        const Elf64_Shdr *sh = &ef.sections[i];
+        if (sh->sh_type == SHT_PROGBITS && strcmp(elf_section_name(&ef, sh), ".interp") == 0) {
+            char *data = elf_read_section(&ef, sh);
+            if (data != nullptr) {
+                snprintf(interp, interp_size, "%s", data);
+            }
+            free(data);
+        }
+        //The entries of the dynamic section refer to the string table in its linked section
+        if (sh->sh_type != SHT_DYNAMIC || sh->sh_link >= (Elf64_Word)ef.count) {
+            continue;
+        }
+        const Elf64_Shdr *strtab = &ef.sections[sh->sh_link];
+        char *dynamic = elf_read_section(&ef, sh);
+        char *strings = elf_read_section(&ef, strtab);
+        const size_t entry_size = ef.is64 ? sizeof(Elf64_Dyn) : sizeof(Elf32_Dyn);
+        for (size_t offset = 0; dynamic != nullptr && strings != nullptr && offset + entry_size <= sh->sh_size;
+             offset += entry_size) {
+            int64_t tag;
+            uint64_t value;
+            if (ef.is64) {
+                const Elf64_Dyn *dyn = (const Elf64_Dyn*)(dynamic + offset);
+                tag = dyn->d_tag;
+                value = dyn->d_un.d_val;
+            } else {
+                const Elf32_Dyn *dyn = (const Elf32_Dyn*)(dynamic + offset);
+                tag = dyn->d_tag;
+                value = dyn->d_un.d_val;
+            }
+            if (tag == DT_NULL) {
+                break;
+            }
+            if (value >= strtab->sh_size) {
+                continue;
+            }
+            if (tag == DT_NEEDED) {
+                elf_append(needed, needed_size, strings + value);
+            } else if (tag == DT_RUNPATH || tag == DT_RPATH) {
+                const size_t len = strlen(runpath);
+                snprintf(runpath + len, runpath_size - len, "%s%s", len > 0 ? ":" : "", strings + value);
+            }
+        }
+        free(dynamic);
+        free(strings);
+    }
+    elf_close(&ef);
+    return true;
+}
+
+bool elf_split_debug(const char *path) {
+    if (!elf_has_debug_info(path)) {
+        return false;
+    }
+    char debug_path[PATH_MAX + 8];
+    char tmp_path[PATH_MAX + 16];
+    char cmd[4 * PATH_MAX + 128];
+    snprintf(debug_path, sizeof(debug_path), "%s.debug", path);
+    snprintf(tmp_path, sizeof(tmp_path), "%s.%d", path, getpid());
+    //The stripped executable replaces the original one at once, runs in between see either of them
+    snprintf(cmd, sizeof(cmd), "objcopy --only-keep-debug '%s' '%s' && objcopy --strip-debug "
+             "--add-gnu-debuglink='%s' '%s' '%s'", path, debug_path, debug_path, path, tmp_path);
+#if DEBUG == 1
+    printf("DBG: elf_split_debug: %s\n", cmd);
+#endif
+    if (system(cmd) != 0 || rename(tmp_path, path) != 0) {
+        unlink(tmp_path);
+        unlink(debug_path);
+        return false;
+    }
+    return true;
+}
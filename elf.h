@@ -0,0 +1,51 @@
+/**
+ * @file elf.h
+ * @author Stefan Kleinschmiodt
+ * @date 13. Nov 2024
+ * @brief Contains the ELF related functions for cscript.
+ *
+ * Provides functions to inspect and to post-process the compiled executables.
+ */
+#pragma once
+
+#include <stddef.h>
+
+/**
+ * @brief Checks if an executable contains debug information
+ *
+ * Reads the section headers of the ELF file @p path and looks for DWARF
+ * sections (.debug_* or .zdebug_*).
+ *
+ * @param path The path of the executable
+ * @return true if the executable contains debug information
+ */
+bool elf_has_debug_info(const char *path);
+
+/**
+ * @brief Reads the dependencies of an executable or shared library from its dynamic section
+ *
+ * @param path The path of the executable or library
+ * @param interp Receives the program interpreter (dynamic loader), empty for libraries
+ * @param interp_size The size of @p interp
+ * @param needed Receives the names of the needed libraries (DT_NEEDED), separated by spaces
+ * @param needed_size The size of @p needed
+ * @param runpath Receives the library search path (DT_RUNPATH and DT_RPATH), separated by colons
+ * @param runpath_size The size of @p runpath
+ * @return false if @p path is no readable ELF file
+ */
+bool elf_dependencies(const char *path, char *interp, size_t interp_size, char *needed, size_t needed_size,
+                      char *runpath, size_t runpath_size);
+
+/**
+ * @brief Moves the debug information into a separate file
+ *
+ * If the executable @p path contains debug information, it is copied to
+ * {path}.debug and removed from the executable, which gets a .gnu_debuglink
+ * section pointing to the debug file. So the executable stays small, while
+ * debuggers and profilers still find the debug information next to it.
+ * Nothing is changed if objcopy fails.
+ *
+ * @param path The path of the executable
+ * @return true if the debug information has been split off
+ */
+bool elf_split_debug(const char *path);
@@ -0,0 +1,111 @@
+/**
+ * @file embed.c
+ * @author Stefan Kleinschmiodt
+ * @date 13. Nov 2024
+ * @brief Contains the implementations of the embed related functions for cscript.
+ *
+ * Provides the fingerprints of the files embedded into scripts.
+ */
+#include "embed.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <linux/limits.h>
+#include <sys/stat.h>
+
+#include "cache.h"
+#include "sha256.h"
+#include "tools.h"
+
+const char* embed_file_id(const char *path, const struct stat *st) {
+    static char id[SHA256_HASH_LENGTH * 2 + 1];
+    char signature[128];
+    char memo[PATH_MAX];
+    snprintf(signature, sizeof(signature), "%lld:%lld.%09ld:%llu:%llu", (long long)st->st_size,
+             (long long)st->st_mtim.tv_sec, st->st_mtim.tv_nsec, (unsigned long long)st->st_ino,
+             (unsigned long long)st->st_dev);
+    memo[0] = '\0';
+    if (cache_writes_enabled()) {
+        snprintf(memo, sizeof(memo), "%s/embed/%s", cache_get_dir(), sha256_string(path));
+        char value[sizeof(signature)];
+        if (kv_read(memo, "stat", value, sizeof(value)) && strcmp(value, signature) == 0
+            && kv_read(memo, "sha", id, sizeof(id))) {
+            cache_mark_used(memo);
+            return id;
+        }
+    }
+    const char *hash = sha256_file(path);
+    if (hash == nullptr) {
+        fprintf(stderr, "cscript: could not read embedded file %s\n", path);
+        exit(EXIT_FAILURE);
+    }
+    snprintf(id, sizeof(id), "%s", hash);
+#if DEBUG == 1
+    printf("DBG: embed_file_id: hashed %s: %s\n", path, id);
+#endif
+    if (memo[0] != '\0') {
+        char dir[PATH_MAX];
+        snprintf(dir, sizeof(dir), "%s/embed", cache_get_dir());
+        mkdir_p(dir, cache_dir_mode());
+        if (kv_write(memo, "sha", id) != 0 || kv_write(memo, "stat", signature) != 0) {
+            fprintf(stderr, "cscript: could not write %s\n", memo);
+        }
+    }
+    return id;
+}
+
+bool embed_deps(const char *source, const size_t size, const char *base_dir, char *deps, const size_t deps_size) {
+    bool used = false;
+    const char *end = source + size;
+    for (const char *line = source; line < end; ) {
+        const char *next = memchr(line, '\n', end - line);
+        next = next != nullptr ? next + 1 : end;
+        //# embed "file" or <file>, optionally followed by parameters like limit(n)
+        const char *p = line;
+        while (p < next && (*p == ' ' || *p == '\t')) {
+            p++;
+        }
+        if (p < next && *p == '#') {
+            p++;
+            while (p < next && (*p == ' ' || *p == '\t')) {
+                p++;
+            }
+            if (next - p > 5 && strncmp(p, "embed", 5) == 0 && (p[5] == ' ' || p[5] == '\t' || p[5] == '"'
+                                                                 || p[5] == '<')) {
+                p += 5;
+                while (p < next && (*p == ' ' || *p == '\t')) {
+                    p++;
+                }
+                const char close = *p == '"' ? '"' : *p == '<' ? '>' : '\0';
+                const char *name_end = close != '\0' ? memchr(p + 1, close, next - p - 1) : nullptr;
+                if (name_end != nullptr) {
+                    char path[PATH_MAX];
+                    char dep[PATH_MAX + 16];
+                    struct stat st;
+                    const int len = (int)(name_end - p - 1);
+                    if (p[1] == '/') {
+                        snprintf(path, sizeof(path), "%.*s", len, p + 1);
+                    } else {
+                        snprintf(path, sizeof(path), "%s/%.*s", base_dir, len, p + 1);
+                    }
+                    //The line may be in a disabled branch, e.g. behind __has_embed, so the compiler reports
+                    //missing files it needs. The key changes once the file appears.
+                    if (stat(path, &st) != 0) {
+                        snprintf(dep, sizeof(dep), "embed:missing:%s", path);
+                    } else {
+                        snprintf(dep, sizeof(dep), "embed:%s", embed_file_id(path, &st));
+                    }
+                    if (strlen(deps) + strlen(dep) + 2 > deps_size) {
+                        fprintf(stderr, "cscript: too many embedded files\n");
+                        exit(EXIT_FAILURE);
+                    }
+                    snprintf(deps + strlen(deps), deps_size - strlen(deps), "%s%s", deps[0] != '\0' ? " " : "", dep);
+                    used = true;
+                }
+            }
+        }
+        line = next;
+    }
+    return used;
+}
@@ -0,0 +1,32 @@
+/**
+ * @file embed.h
+ * @author Stefan Kleinschmiodt
+ * @date 13. Nov 2024
+ * @brief Contains the embed related functions for cscript.
+ *
+ * Provides the dependency tracking of data files that a script includes
+ * into its executable with the C23 @#embed directive.
+ */
+#pragma once
+
+#include <stddef.h>
+
+/**
+ * @brief Adds the identities of the embedded files
+ *
+ * Finds the files named in @#embed lines of @p source, relative to
+ * @p base_dir unless they are absolute, and appends an identity of their
+ * content ("embed:{hash}") to @p deps for each of them. The hashes are kept
+ * in the cache directory together with the size, the modification time and
+ * the inode of the file, so a file is only read again when it has changed.
+ * A missing file is recorded as "embed:missing:{path}", the line may be in a
+ * disabled branch; if not, the compiler reports it.
+ *
+ * @param source The source of the script
+ * @param size The size of the source
+ * @param base_dir The directory of the script
+ * @param deps The dependencies of the script
+ * @param deps_size The size of @p deps
+ * @return true if the script uses @#embed
+ */
+bool embed_deps(const char *source, size_t size, const char *base_dir, char *deps, size_t deps_size);
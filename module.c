@@ -0,0 +1,102 @@
+/**
+ * @file module.c
+ * @author Stefan Kleinschmiodt
+ * @date 13. Nov 2024
+ * @brief Contains the implementations of the module related functions for cscript.
+ *
+ * Provides the lookup and the cached compilation of the modules named in @#use lines.
+ */
+#include "module.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <linux/limits.h>
+
+#include "cache.h"
+#include "cpu.h"
+#include "runtime.h"
+#include "sha256.h"
+#include "toolchain.h"
+#include "tools.h"
+
+bool module_find(const char *name, char *path, const size_t size) {
+    if (strspn(name, "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789_-/.") != strlen(name)
+        || strstr(name, "..") != nullptr || name[0] == '/') {
+        return false;
+    }
+    const char *module_path = getenv("CSCRIPT_MODULE_PATH");
+    const char *p = module_path != nullptr && strlen(module_path) > 0 ? module_path : MODULE_DEFAULT_PATH;
+    while (*p != '\0') {
+        const size_t len = strcspn(p, ":");
+        if (len > 0) {
+            //~ stands for the home directory
+            if (p[0] == '~') {
+                snprintf(path, size, "%s%.*s/%s.c", getenv("HOME"), (int)len - 1, p + 1, name);
+            } else {
+                snprintf(path, size, "%.*s/%s.c", (int)len, p, name);
+            }
+            if (file_exists(path)) {
+                return true;
+            }
+        }
+        p += len;
+        if (*p == ':') {
+            p++;
+        }
+    }
+    return false;
+}
+
+const char* module_id(const char *path, const char *cc, const char *gcc_args) {
+    static char id[SHA256_HASH_LENGTH * 2 + 1];
+    char header[PATH_MAX];
+    char args[16384];
+    snprintf(header, sizeof(header), "%.*s.h", (int)strlen(path) - 2, path);
+    toolchain_compile_args(gcc_args, args, sizeof(args));
+    //The hashes are kept in static buffers, so they are copied one by one
+    char identity[sizeof(args) + PATH_MAX + 4 * SHA256_HASH_LENGTH + 64];
+    snprintf(identity, sizeof(identity), "%s:", sha256_file(path));
+    snprintf(identity + strlen(identity), sizeof(identity) - strlen(identity), "%s:",
+             file_exists(header) ? sha256_file(header) : "");
+    snprintf(identity + strlen(identity), sizeof(identity) - strlen(identity), "%s:%s",
+             toolchain_id(cc), args);
+    //Objects tuned for the cpu are only valid on the same kind of cpu
+    if (cpu_native_args(args)) {
+        snprintf(identity + strlen(identity), sizeof(identity) - strlen(identity), ":%s", cpu_fingerprint());
+    }
+    snprintf(id, sizeof(id), "%s", sha256_string(identity));
+    return id;
+}
+
+const char* module_object(const char *path, const char *cc, const char *gcc_args) {
+    static char object[PATH_MAX];
+    char dir[PATH_MAX];
+    format_path(dir, sizeof(dir), "%s/modules", cache_get_dir());
+    format_path(object, sizeof(object), "%s/%s.%s.o", dir, get_file_name(path), module_id(path, cc, gcc_args));
+    if (file_exists(object)) {
+        cache_mark_used(object);
+        return object;
+    }
+    mkdir_p(dir, cache_dir_mode());
+    //Compile to a temporary file, concurrent compiles of the same module may race
+    char args[16384];
+    char tmp_object[PATH_MAX + 16];
+    char module_dir[PATH_MAX];
+    toolchain_compile_args(gcc_args, args, sizeof(args));
+    snprintf(tmp_object, sizeof(tmp_object), "%s.%d", object, getpid());
+    snprintf(module_dir, sizeof(module_dir), "%.*s", (int)(get_file_name(path) - path), path);
+    char gcc_line[sizeof(args) + 5 * PATH_MAX];
+    snprintf(gcc_line, sizeof(gcc_line), "%s %s -fPIC -I%s -I%s -c %s -o %s", cc, args, module_dir, runtime_dir(),
+             path, tmp_object);
+#if DEBUG == 1
+    printf("GCC: %s\n", gcc_line);
+#endif
+    if (system(gcc_line) != 0 || rename(tmp_object, object) != 0) {
+        unlink(tmp_object);
+        fprintf(stderr, "cscript: failed compiling module %s\n", path);
+        exit(EXIT_FAILURE);
+    }
+    return object;
+}
@@ -0,0 +1,65 @@
+/**
+ * @file module.h
+ * @author Stefan Kleinschmiodt
+ * @date 13. Nov 2024
+ * @brief Contains the module related functions for cscript.
+ *
+ * Scripts name shared helper modules in @#use lines. A module {name} is the
+ * source file {name}.c (with an optional header {name}.h) in one of the module
+ * directories. It is compiled once per content and flags into an object in
+ * the cache directory, which is linked into every script using it.
+ */
+#pragma once
+
+#include <stddef.h>
+
+/**
+ * @brief The module directories if CSCRIPT_MODULE_PATH is not set
+ */
+#define MODULE_DEFAULT_PATH "~/.cscript/modules"
+
+/**
+ * @brief Finds a module
+ *
+ * Searches the directories in CSCRIPT_MODULE_PATH (colon-separated, default
+ * MODULE_DEFAULT_PATH) for the source of the module.
+ *
+ * @param name The name of the module
+ * @param path Receives the path of the source file
+ * @param size The size of @p path
+ * @return true if the module has been found
+ */
+bool module_find(const char *name, char *path, size_t size);
+
+/**
+ * @brief Gets the identity of a module
+ *
+ * The identity covers the source and the header of the module, the compiler
+ * arguments used for it and the compiler, it is part of the cache key of the
+ * scripts using the module. With -march=native and friends the cpu fingerprint
+ * is part of it as well. Other headers included by the module are not tracked.
+ * The pointer to the buffer containing the identity will be overwritten
+ * on a subsequent use of this function. Not thread safe!
+ *
+ * @param path The path of the source file of the module
+ * @param cc The compiler of the script
+ * @param gcc_args The compiler arguments of the script
+ * @return The identity
+ */
+const char* module_id(const char *path, const char *cc, const char *gcc_args);
+
+/**
+ * @brief Gets the object of a module
+ *
+ * Compiles the module into a position independent object in the cache
+ * directory, if it hasn't been compiled with the same content and arguments yet.
+ * Linker arguments of the script are not used for the module.
+ * The pointer to the buffer containing the path will be overwritten
+ * on a subsequent use of this function. Not thread safe!
+ *
+ * @param path The path of the source file of the module
+ * @param cc The compiler of the script
+ * @param gcc_args The compiler arguments of the script
+ * @return The path of the object, the program exits if the module can't be compiled
+ */
+const char* module_object(const char *path, const char *cc, const char *gcc_args);
@@ -0,0 +1,226 @@
+/**
+ * @file normalize.c
+ * @author Stefan Kleinschmiodt
+ * @date 13. Nov 2024
+ * @brief Contains the implementation of the source normalization for cscript.
+ *
+ * Provides a small lexer for the normalized cache key.
+ */
+#include "normalize.h"
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * @brief The state of a normalization run
+ */
+typedef struct normalizer {
+    char *out; /**< The normalized source. */
+    size_t length; /**< The length of the normalized source. */
+    size_t capacity; /**< The allocated size of out. */
+    bool keep_lines; /**< Keep every line break of the source. */
+    bool line_sensitive; /**< The source uses line numbers. */
+    const char *const *names; /**< Identifiers to look for, nullptr terminated, may be nullptr. */
+    bool found; /**< One of the identifiers has been found. */
+} normalizer;
+
+void norm_emit(normalizer *n, const char c) {
+    if (n->length == n->capacity) {
+        n->capacity = n->capacity * 2 + 256;
+        n->out = (char*)realloc(n->out, n->capacity);
+        if (n->out == nullptr) {
+            fprintf(stderr, "normalize_source: out of memory\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    n->out[n->length++] = c;
+}
+
+bool norm_is_word(const char c) {
+    return isalnum((unsigned char)c) || c == '_' || c == '.' || c == '\\' || (unsigned char)c >= 0x80;
+}
+
+bool norm_is_operator(const char c) {
+    return c != '\0' && strchr("+-*/%&|^<>=!.:#?~", c) != nullptr;
+}
+
+bool norm_needs_space(const char last, const char next) {
+    //Whitespace is only significant where the tokens on both sides would merge
+    return (norm_is_word(last) && norm_is_word(next))
+           || (norm_is_operator(last) && norm_is_operator(next))
+           || (norm_is_word(last) && (next == '"' || next == '\''))
+           || ((last == '"' || last == '\'') && norm_is_word(next))
+           || (strchr("eEpP", last) != nullptr && (next == '+' || next == '-'));
+}
+
+char *splice_lines(const char *source, const size_t size, size_t *length) {
+    //Remove line continuations, the line breaks are moved to the end of the logical line
+    char *spliced = (char*)malloc(size + 1);
+    if (spliced == nullptr) {
+        fprintf(stderr, "normalize_source: out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+    size_t j = 0;
+    int pending = 0;
+    for (size_t i = 0; i < size; i++) {
+        if (source[i] == '\\' && i + 1 < size && source[i + 1] == '\n') {
+            pending++;
+            i++;
+        } else if (source[i] == '\\' && i + 2 < size && source[i + 1] == '\r' && source[i + 2] == '\n') {
+            pending++;
+            i += 2;
+        } else {
+            spliced[j++] = source[i];
+            if (source[i] == '\n') {
+                for (; pending > 0; pending--) {
+                    spliced[j++] = '\n';
+                }
+            }
+        }
+    }
+    spliced[j] = '\0';
+    *length = j;
+    return spliced;
+}
+
+void normalize(normalizer *n, const char *s, const size_t size) {
+    bool line_start = true;
+    bool directive = false;
+    bool space = false;
+    size_t i = 0;
+    while (i < size) {
+        const char c = s[i];
+        if (c == '\n') {
+            //The end of a directive is always significant
+            if (directive || n->keep_lines) {
+                norm_emit(n, '\n');
+                space = false;
+            } else {
+                space = true;
+            }
+            directive = false;
+            line_start = true;
+            i++;
+            continue;
+        }
+        if (c == ' ' || c == '\t' || c == '\r' || c == '\f' || c == '\v') {
+            space = true;
+            i++;
+            continue;
+        }
+        if (c == '/' && i + 1 < size && s[i + 1] == '/') {
+            while (i < size && s[i] != '\n') {
+                i++;
+            }
+            space = true;
+            continue;
+        }
+        if (c == '/' && i + 1 < size && s[i + 1] == '*') {
+            for (i += 2; i < size && !(s[i] == '*' && i + 1 < size && s[i + 1] == '/'); i++) {
+                //Line breaks in comments are marked differently, they don't end a directive
+                if (s[i] == '\n' && n->keep_lines) {
+                    norm_emit(n, '\f');
+                }
+            }
+            i = i + 2 < size ? i + 2 : size;
+            space = true;
+            continue;
+        }
+        const char last = n->length > 0 ? n->out[n->length - 1] : '\n';
+        if (line_start && c == '#') {
+            if (last != '\n') {
+                norm_emit(n, '\n');
+            }
+            directive = true;
+        } else if (space && last != '\n' && (directive || norm_needs_space(last, c))) {
+            norm_emit(n, ' ');
+        }
+        space = false;
+        line_start = false;
+        if (c == '"' || c == '\'') {
+            //Literals are copied verbatim, including escape sequences
+            norm_emit(n, s[i++]);
+            while (i < size && s[i] != c && s[i] != '\n') {
+                if (s[i] == '\\' && i + 1 < size) {
+                    norm_emit(n, s[i++]);
+                }
+                norm_emit(n, s[i++]);
+            }
+            if (i < size && s[i] == c) {
+                norm_emit(n, s[i++]);
+            }
+        } else if (isalpha((unsigned char)c) || c == '_') {
+            const size_t start = i;
+            while (i < size && (isalnum((unsigned char)s[i]) || s[i] == '_')) {
+                norm_emit(n, s[i++]);
+            }
+            const size_t len = i - start;
+            if ((len == 8 && strncmp(s + start, "__LINE__", len) == 0)
+                || (len == 6 && strncmp(s + start, "assert", len) == 0)
+                || (len == 14 && strncmp(s + start, "__builtin_LINE", len) == 0)) {
+                n->line_sensitive = true;
+            }
+            for (int k = 0; n->names != nullptr && n->names[k] != nullptr; k++) {
+                if (strlen(n->names[k]) == len && strncmp(s + start, n->names[k], len) == 0) {
+                    n->found = true;
+                }
+            }
+        } else if (isdigit((unsigned char)c) || (c == '.' && i + 1 < size && isdigit((unsigned char)s[i + 1]))) {
+            //Preprocessing number, including exponents and digit separators
+            norm_emit(n, s[i++]);
+            while (i < size) {
+                if ((s[i] == '+' || s[i] == '-') && strchr("eEpP", s[i - 1]) != nullptr) {
+                    norm_emit(n, s[i++]);
+                } else if (s[i] == '\'' && i + 1 < size && isalnum((unsigned char)s[i + 1])) {
+                    norm_emit(n, s[i++]);
+                } else if (isalnum((unsigned char)s[i]) || s[i] == '_' || s[i] == '.') {
+                    norm_emit(n, s[i++]);
+                } else {
+                    break;
+                }
+            }
+        } else {
+            norm_emit(n, s[i++]);
+        }
+    }
+}
+
+char *normalize_source(const char *source, const size_t size, size_t *length) {
+    if (source == nullptr || length == nullptr) {
+        fprintf(stderr, "normalize_source: source and length must not be null\n");
+        exit(EXIT_FAILURE);
+    }
+    size_t spliced_size;
+    char *spliced = splice_lines(source, size, &spliced_size);
+    normalizer n = { nullptr, 0, 0, false, false, nullptr, false };
+    normalize(&n, spliced, spliced_size);
+    if (n.line_sensitive) {
+        //Line numbers end up in the executable, so the line structure has to be kept
+        n.length = 0;
+        n.keep_lines = true;
+        normalize(&n, spliced, spliced_size);
+    }
+    free(spliced);
+    norm_emit(&n, '\0');
+    *length = n.length - 1;
+#if DEBUG == 1
+    printf("DBG: normalize_source: %zu -> %zu bytes%s\n", size, *length, n.keep_lines ? ", lines kept" : "");
+#endif
+    return n.out;
+}
+
+bool normalize_has_identifier(const char *source, const size_t size, const char *const *names) {
+    if (source == nullptr || names == nullptr) {
+        fprintf(stderr, "normalize_has_identifier: source and names must not be null\n");
+        exit(EXIT_FAILURE);
+    }
+    size_t spliced_size;
+    char *spliced = splice_lines(source, size, &spliced_size);
+    normalizer n = { nullptr, 0, 0, false, false, names, false };
+    normalize(&n, spliced, spliced_size);
+    free(spliced);
+    free(n.out);
+    return n.found;
+}
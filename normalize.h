@@ -0,0 +1,43 @@
+/**
+ * @file normalize.h
+ * @author Stefan Kleinschmiodt
+ * @date 13. Nov 2024
+ * @brief Contains the source normalization for cscript.
+ *
+ * Provides a cheap lexer that reduces a c source to a token stream without
+ * comments and formatting. Hashing this stream instead of the raw source makes
+ * the cache key insensitive to comment and formatting-only changes.
+ */
+#pragma once
+
+#include <stddef.h>
+
+/**
+ * @brief Normalizes a c source
+ *
+ * Reduces the source to its token stream: line continuations and comments are
+ * removed and whitespace is dropped unless it separates tokens that would
+ * otherwise merge. String and character literals are kept verbatim, as is the
+ * line structure of preprocessor directives and the spacing inside them.
+ * If the source uses the line number (__LINE__ or assert), all line breaks
+ * are kept as well, so moving code to another line still changes the result.
+ *
+ * @param source The c source
+ * @param size The size of the source
+ * @param length Receives the length of the result
+ * @return The normalized source, has to be freed by the caller
+ */
+char *normalize_source(const char *source, size_t size, size_t *length);
+
+/**
+ * @brief Looks for identifiers in a c source
+ *
+ * Uses the lexer of normalize_source(), so names in comments, string and
+ * character literals or as part of longer identifiers are not found.
+ *
+ * @param source The c source
+ * @param size The size of the source
+ * @param names The identifiers, terminated by nullptr
+ * @return true if one of the identifiers is used in the source
+ */
+bool normalize_has_identifier(const char *source, size_t size, const char *const *names);
@@ -0,0 +1,304 @@
+/**
+ * @file pack.c
+ * @author Stefan Kleinschmiodt
+ * @date 13. Nov 2024
+ * @brief Contains the implementations of the cache pack related functions for cscript.
+ *
+ * Provides the export and import of cache packs.
+ */
+#include "pack.h"
+
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <linux/limits.h>
+#include <sys/stat.h>
+
+#include "cache.h"
+#include "script_file.h"
+#include "script_file_type.h"
+#include "sha256.h"
+#include "toolchain.h"
+#include "tools.h"
+
+#define PACK_MAGIC "CSCRIPT-PACK 1\n"
+
+void pack_write_file(FILE *fpPack, const char *dir, const char *name) {
+    char path[PATH_MAX];
+    struct stat st;
+    snprintf(path, sizeof(path), "%s/%s", dir, name);
+    FILE *fp = fopen(path, "r");
+    if (fp == nullptr || fstat(fileno(fp), &st) != 0) {
+        fprintf(stderr, "pack_export: could not read %s\n", path);
+        exit(EXIT_FAILURE);
+    }
+    fprintf(fpPack, "FILE %s %o %lld\n", name, st.st_mode & 0777, (long long)st.st_size);
+    char buffer[65536];
+    size_t n;
+    long long remaining = st.st_size;
+    while (remaining > 0 && (n = fread(buffer, 1, sizeof(buffer), fp)) > 0) {
+        n = (long long)n > remaining ? (size_t)remaining : n;
+        fwrite(buffer, 1, n, fpPack);
+        remaining -= (long long)n;
+    }
+    fclose(fp);
+    if (remaining != 0) {
+        fprintf(stderr, "pack_export: %s changed while exporting\n", path);
+        exit(EXIT_FAILURE);
+    }
+}
+
+bool pack_write_entry(FILE *fpPack, const char *key) {
+    char dir[PATH_MAX];
+    char meta_file[PATH_MAX];
+    char meta_key[256];
+    snprintf(dir, sizeof(dir), "%s", cache_get_entry_path(key));
+    format_path(meta_file, sizeof(meta_file), "%s/meta", dir);
+    //Only complete entries are exported
+    if (!kv_read(meta_file, "key", meta_key, sizeof(meta_key)) || strcmp(meta_key, key) != 0) {
+        return false;
+    }
+    DIR *d = opendir(dir);
+    if (d == nullptr) {
+        return false;
+    }
+    fprintf(fpPack, "ENTRY %s\n", key);
+    //The meta file always comes first, so the importer can check the toolchain early
+    pack_write_file(fpPack, dir, "meta");
+    const struct dirent *de;
+    while ((de = readdir(d)) != nullptr) {
+        char path[PATH_MAX];
+        struct stat st;
+        format_path(path, sizeof(path), "%s/%s", dir, de->d_name);
+        if (strcmp(de->d_name, "meta") == 0 || stat(path, &st) != 0 || !S_ISREG(st.st_mode)) {
+            continue;
+        }
+        pack_write_file(fpPack, dir, de->d_name);
+    }
+    closedir(d);
+    fputs("ENTRY-END\n", fpPack);
+#if DEBUG == 1
+    printf("DBG: pack_write_entry: exported %s\n", key);
+#endif
+    return true;
+}
+
+bool pack_write(FILE *fpPack, const char *key) {
+    fputs(PACK_MAGIC, fpPack);
+    if (!pack_write_entry(fpPack, key)) {
+        return false;
+    }
+    fputs("PACK-END\n", fpPack);
+    return fflush(fpPack) == 0;
+}
+
+void pack_export(const char *pack_path, const int count, char **scripts) {
+    if (pack_path == nullptr) {
+        fprintf(stderr, "pack_export: pack_path must not be null\n");
+        exit(EXIT_FAILURE);
+    }
+    const bool to_stdout = strcmp(pack_path, "-") == 0;
+    FILE *fpPack = to_stdout ? stdout : fopen(pack_path, "w");
+    if (fpPack == nullptr) {
+        fprintf(stderr, "pack_export: could not open %s\n", pack_path);
+        exit(EXIT_FAILURE);
+    }
+    fputs(PACK_MAGIC, fpPack);
+    int exported = 0;
+    if (count > 0) {
+        for (int i = 0; i < count; i++) {
+            sf_handle sf = script_file_open(scripts[i]);
+            //Compile now, so the pack contains all given scripts
+            if (!cache_check(sf)) {
+                script_file_compile(sf);
+                cache_update(sf);
+            }
+            if (pack_write_entry(fpPack, ((const script_file*)sf)->key)) {
+                exported++;
+            }
+            script_file_close(sf);
+        }
+    } else {
+        DIR *d = opendir(cache_get_dir());
+        if (d != nullptr) {
+            const struct dirent *de;
+            while ((de = readdir(d)) != nullptr) {
+                if (cache_is_key(de->d_name) && pack_write_entry(fpPack, de->d_name)) {
+                    exported++;
+                }
+            }
+            closedir(d);
+        }
+    }
+    fputs("PACK-END\n", fpPack);
+    if ((to_stdout ? fflush(fpPack) : fclose(fpPack)) != 0) {
+        fprintf(stderr, "pack_export: could not write %s\n", pack_path);
+        exit(EXIT_FAILURE);
+    }
+    fprintf(stderr, "cscript: exported %d cache entries\n", exported);
+}
+
+void remove_entry_dir(const char *dir) {
+    DIR *d = opendir(dir);
+    if (d != nullptr) {
+        const struct dirent *de;
+        while ((de = readdir(d)) != nullptr) {
+            char path[PATH_MAX];
+            snprintf(path, sizeof(path), "%s/%s", dir, de->d_name);
+            unlink(path);
+        }
+        closedir(d);
+    }
+    rmdir(dir);
+}
+
+bool pack_read_file(FILE *fpPack, const char *dir, const char *name, const unsigned mode, long long size) {
+    FILE *fp = nullptr;
+    char path[PATH_MAX];
+    if (dir != nullptr) {
+        snprintf(path, sizeof(path), "%s/%s", dir, name);
+        fp = fopen(path, "w");
+        if (fp == nullptr) {
+            fprintf(stderr, "pack_import: could not write %s\n", path);
+            exit(EXIT_FAILURE);
+        }
+    }
+    //Without a directory the content is skipped
+    char buffer[65536];
+    while (size > 0) {
+        const size_t n = fread(buffer, 1, size < (long long)sizeof(buffer) ? (size_t)size : sizeof(buffer), fpPack);
+        if (n == 0) {
+            break;
+        }
+        if (fp != nullptr) {
+            fwrite(buffer, 1, n, fp);
+        }
+        size -= (long long)n;
+    }
+    if (fp != nullptr) {
+        fchmod(fileno(fp), cache_file_mode(mode));
+        fclose(fp);
+    }
+    return size == 0;
+}
+
+bool pack_read(FILE *fpPack, const char *pack_path, int *imported, int *mismatched, int *present) {
+    char *line = nullptr;
+    size_t len = 0;
+    if (getline(&line, &len, fpPack) == -1 || strcmp(line, PACK_MAGIC) != 0) {
+        fprintf(stderr, "pack_import: %s is not a cscript pack\n", pack_path);
+        free(line);
+        return false;
+    }
+    char key[256] = "";
+    char tmp_dir[PATH_MAX] = "";
+    //An entry is skipped when tmp_dir is empty
+    bool in_entry = false;
+    bool complete = false;
+    while (getline(&line, &len, fpPack) != -1) {
+        line[strcspn(line, "\n")] = '\0';
+        char name[NAME_MAX + 1];
+        unsigned mode;
+        long long size;
+        if (!in_entry && strncmp(line, "ENTRY ", 6) == 0) {
+            snprintf(key, sizeof(key), "%s", line + 6);
+            if (!cache_is_key(key)) {
+                fprintf(stderr, "pack_import: invalid entry key %s\n", key);
+                break;
+            }
+            in_entry = true;
+            tmp_dir[0] = '\0';
+            const char *entry_path = cache_get_entry_path(key);
+            char meta_file[PATH_MAX];
+            char meta_key[256];
+            snprintf(meta_file, sizeof(meta_file), "%s/meta", entry_path);
+            if (kv_read(meta_file, "key", meta_key, sizeof(meta_key))) {
+                (*present)++;
+                continue;
+            }
+            snprintf(tmp_dir, sizeof(tmp_dir), "%s/.import.%s.%d", cache_get_dir(), key, getpid());
+            mkdir_p(tmp_dir, cache_dir_mode());
+        } else if (in_entry && sscanf(line, "FILE %255s %o %lld", name, &mode, &size) == 3) {
+            if (strchr(name, '/') != nullptr || name[0] == '.' || size < 0) {
+                fprintf(stderr, "pack_import: invalid file %s in entry %s\n", name, key);
+                break;
+            }
+            if (!pack_read_file(fpPack, tmp_dir[0] != '\0' ? tmp_dir : nullptr, name, mode, size)) {
+                break;
+            }
+            //Check the toolchain as soon as the meta file is there
+            if (tmp_dir[0] != '\0' && strcmp(name, "meta") == 0) {
+                //The entry names its compiler and linker, they must be the same here
+                char meta_file[PATH_MAX];
+                char toolchain[2 * PATH_MAX + 160];
+                char cc[PATH_MAX] = TOOLCHAIN_DEFAULT_CC;
+                char ld[64] = "";
+                format_path(meta_file, sizeof(meta_file), "%s/meta", tmp_dir);
+                kv_read(meta_file, "cc", cc, sizeof(cc));
+                kv_read(meta_file, "ld", ld, sizeof(ld));
+                if (!kv_read(meta_file, "toolchain", toolchain, sizeof(toolchain))
+                    || strcmp(toolchain, toolchain_identity(cc, ld)) != 0) {
+#if DEBUG == 1
+                    printf("DBG: pack_import: toolchain mismatch for %s: %s\n", key, toolchain);
+#endif
+                    (*mismatched)++;
+                    remove_entry_dir(tmp_dir);
+                    tmp_dir[0] = '\0';
+                }
+            }
+        } else if (in_entry && strcmp(line, "ENTRY-END") == 0) {
+            in_entry = false;
+            if (tmp_dir[0] == '\0') {
+                continue;
+            }
+            //Move the complete entry into place, a concurrent import or compile may have won the race
+            char entry_path[PATH_MAX];
+            snprintf(entry_path, sizeof(entry_path), "%s", cache_get_entry_path(key));
+            rmdir(entry_path);
+            if (rename(tmp_dir, entry_path) == 0) {
+                (*imported)++;
+            } else {
+                remove_entry_dir(tmp_dir);
+                (*present)++;
+            }
+        } else if (!in_entry && strcmp(line, "PACK-END") == 0) {
+            complete = true;
+            break;
+        } else {
+            break;
+        }
+    }
+    if (in_entry && tmp_dir[0] != '\0') {
+        remove_entry_dir(tmp_dir);
+    }
+    free(line);
+    if (!complete) {
+        fprintf(stderr, "pack_import: %s is truncated or corrupt\n", pack_path);
+    }
+    return complete;
+}
+
+void pack_import(const char *pack_path) {
+    if (pack_path == nullptr) {
+        fprintf(stderr, "pack_import: pack_path must not be null\n");
+        exit(EXIT_FAILURE);
+    }
+    const bool from_stdin = strcmp(pack_path, "-") == 0;
+    FILE *fpPack = from_stdin ? stdin : fopen(pack_path, "r");
+    if (fpPack == nullptr) {
+        fprintf(stderr, "pack_import: could not open %s\n", pack_path);
+        exit(EXIT_FAILURE);
+    }
+    int imported = 0, mismatched = 0, present = 0;
+    const bool complete = pack_read(fpPack, pack_path, &imported, &mismatched, &present);
+    if (!from_stdin) {
+        fclose(fpPack);
+    }
+    fprintf(stderr, "cscript: imported %d cache entries, skipped %d (toolchain mismatch), %d already present\n",
+            imported, mismatched, present);
+    if (!complete) {
+        exit(EXIT_FAILURE);
+    }
+}
@@ -0,0 +1,74 @@
+/**
+ * @file pack.h
+ * @author Stefan Kleinschmiodt
+ * @date 13. Nov 2024
+ * @brief Contains the cache pack related functions for cscript.
+ *
+ * A cache pack is a single, streamable file containing a set of cache entries
+ * (executables, hashes and toolchain identity). Packs are used to pre-seed the
+ * cache of containers and hosts, so scripts don't have to be compiled on first use.
+ *
+ * Format (all header lines are terminated by a line break):
+ * @code
+ * CSCRIPT-PACK 1
+ * ENTRY {key}
+ * FILE {name} {octal mode} {size}
+ * {size bytes of content}
+ * ...
+ * ENTRY-END
+ * ...
+ * PACK-END
+ * @endcode
+ * The first file of every entry is its meta file.
+ */
+#pragma once
+
+#include <stdio.h>
+
+/**
+ * @brief Exports cache entries into a pack
+ *
+ * Writes the cache entries of the given script files into the pack file
+ * @p pack_path. Script files that are not cached yet are compiled first.
+ * If no script files are given, all entries of the cache are exported.
+ *
+ * @param pack_path The path of the pack file, "-" for stdout
+ * @param count The number of script files
+ * @param scripts The paths of the script files
+ */
+void pack_export(const char *pack_path, int count, char **scripts);
+
+/**
+ * @brief Imports cache entries from a pack
+ *
+ * Reads the cache entries from the pack file @p pack_path and stores them in
+ * the cache. Entries that have been built with a different toolchain and entries
+ * that already exist are skipped.
+ *
+ * @param pack_path The path of the pack file, "-" for stdin
+ */
+void pack_import(const char *pack_path);
+
+/**
+ * @brief Writes a pack containing a single cache entry
+ *
+ * @param fpPack The stream to write the pack to
+ * @param key The key of the cache entry
+ * @return false if there is no complete entry for @p key or the pack could not be written
+ */
+bool pack_write(FILE *fpPack, const char *key);
+
+/**
+ * @brief Reads the cache entries of a pack into the cache
+ *
+ * Like pack_import(), but reads from a stream and reports a malformed pack
+ * instead of terminating cscript.
+ *
+ * @param fpPack The stream to read the pack from
+ * @param pack_path The name of the pack for messages
+ * @param imported Incremented for every imported entry
+ * @param mismatched Incremented for every entry skipped for a different toolchain
+ * @param present Incremented for every entry that already exists
+ * @return true if the complete pack has been read
+ */
+bool pack_read(FILE *fpPack, const char *pack_path, int *imported, int *mismatched, int *present);
@@ -0,0 +1,264 @@
+/**
+ * @file pkg.c
+ * @author Stefan Kleinschmiodt
+ * @date 13. Nov 2024
+ * @brief Contains the implementations of the package related functions for cscript.
+ *
+ * Provides the cached pkg-config resolution for @#pkg lines.
+ */
+#include "pkg.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <linux/limits.h>
+#include <sys/stat.h>
+
+#include "cache.h"
+#include "sha256.h"
+#include "toolchain.h"
+#include "tools.h"
+
+#define PKG_MAX_FILES 64
+#define PKG_FLAGS_SIZE 8192
+
+/**
+ * @brief The .pc files involved in a resolution
+ */
+typedef struct pkg_files {
+    char paths[PKG_MAX_FILES][PATH_MAX];
+    int count;
+} pkg_files;
+
+const char* pkg_config() {
+    const char *cmd = getenv("PKG_CONFIG");
+    return cmd != nullptr && strlen(cmd) > 0 ? cmd : "pkg-config";
+}
+
+bool valid_names(const char *names) {
+    //The names end up on a command line
+    return strspn(names, "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789._+- ") == strlen(names);
+}
+
+bool run_pkg_config(const char *args, char *output, const size_t size) {
+    char cmd[PATH_MAX + 2048];
+    snprintf(cmd, sizeof(cmd), "%s %s", pkg_config(), args);
+#if DEBUG == 1
+    printf("PKG: %s\n", cmd);
+#endif
+    FILE *fp = popen(cmd, "r");
+    if (fp == nullptr) {
+        return false;
+    }
+    const size_t n = fread(output, 1, size - 1, fp);
+    output[n] = '\0';
+    output[strcspn(output, "\n")] = '\0';
+    return pclose(fp) == 0;
+}
+
+void fingerprint(const char *path, char *target, const size_t size) {
+    struct stat st;
+    if (stat(path, &st) != 0) {
+        snprintf(target, size, "missing:%s", path);
+        return;
+    }
+    snprintf(target, size, "%lld:%lld.%09ld:%s", (long long)st.st_size, (long long)st.st_mtim.tv_sec,
+             st.st_mtim.tv_nsec, path);
+}
+
+bool find_pc(const char *search_path, const char *name, char *target, const size_t size) {
+    const char *p = search_path;
+    while (*p != '\0') {
+        const size_t len = strcspn(p, ":");
+        if (len > 0) {
+            snprintf(target, size, "%.*s/%s.pc", (int)len, p, name);
+            if (file_exists(target)) {
+                return true;
+            }
+        }
+        p += len;
+        if (*p == ':') {
+            p++;
+        }
+    }
+    return false;
+}
+
+void add_requires(pkg_files *files, const char *search_path, const char *pc_file);
+
+void add_package(pkg_files *files, const char *search_path, const char *name) {
+    char path[PATH_MAX];
+    if (!find_pc(search_path, name, path, sizeof(path))) {
+        return;
+    }
+    for (int i = 0; i < files->count; i++) {
+        if (strcmp(files->paths[i], path) == 0) {
+            return;
+        }
+    }
+    if (files->count == PKG_MAX_FILES) {
+        return;
+    }
+    strcpy(files->paths[files->count++], path);
+    add_requires(files, search_path, path);
+}
+
+void add_requires(pkg_files *files, const char *search_path, const char *pc_file) {
+    //The flags of required packages are part of the result, so their .pc files are tracked as well
+    FILE *fp = fopen(pc_file, "r");
+    if (fp == nullptr) {
+        return;
+    }
+    char *line = nullptr;
+    size_t len = 0;
+    while (getline(&line, &len, fp) != -1) {
+        char *value;
+        if (strncmp(line, "Requires:", 9) == 0) {
+            value = line + 9;
+        } else if (strncmp(line, "Requires.private:", 17) == 0) {
+            value = line + 17;
+        } else {
+            continue;
+        }
+        //Entries are separated by commas or whitespace and may carry a version constraint
+        bool skip_version = false;
+        char *save = nullptr;
+        for (char *token = strtok_r(value, " ,\t\r\n", &save); token != nullptr;
+             token = strtok_r(nullptr, " ,\t\r\n", &save)) {
+            if (skip_version) {
+                skip_version = false;
+            } else if (strchr("<>=!", token[0]) != nullptr) {
+                skip_version = strspn(token, "<>=!") == strlen(token);
+            } else {
+                token[strcspn(token, "<>=!")] = '\0';
+                add_package(files, search_path, token);
+            }
+        }
+    }
+    free(line);
+    fclose(fp);
+}
+
+void join_fingerprints(const pkg_files *files, char *target, const size_t size) {
+    target[0] = '\0';
+    for (int i = 0; i < files->count; i++) {
+        char fp[PATH_MAX + 64];
+        fingerprint(files->paths[i], fp, sizeof(fp));
+        snprintf(target + strlen(target), size - strlen(target), "%s%s", i > 0 ? " " : "", fp);
+    }
+}
+
+bool entry_valid(const char *entry, const char *names, char *flags, char *fingerprints, const size_t size) {
+    char search_path[8192];
+    if (!kv_read(entry, "search_path", search_path, sizeof(search_path))
+        || !kv_read(entry, "files", fingerprints, size)
+        || !kv_read(entry, "flags", flags, PKG_FLAGS_SIZE)) {
+        return false;
+    }
+    //Every tracked .pc file must be unchanged
+    char current[PATH_MAX + 64];
+    char *copy = strdup(fingerprints);
+    char *save = nullptr;
+    bool valid = true;
+    for (char *fp = strtok_r(copy, " ", &save); fp != nullptr && valid; fp = strtok_r(nullptr, " ", &save)) {
+        const char *path = strchr(fp, ':');
+        path = path != nullptr ? strchr(path + 1, ':') : nullptr;
+        if (path == nullptr) {
+            valid = false;
+            break;
+        }
+        fingerprint(path + 1, current, sizeof(current));
+        valid = strcmp(current, fp) == 0;
+    }
+    free(copy);
+    //A package may have been installed to a directory searched earlier
+    copy = strdup(names);
+    save = nullptr;
+    for (char *name = strtok_r(copy, " ", &save); name != nullptr && valid; name = strtok_r(nullptr, " ", &save)) {
+        char path[PATH_MAX];
+        valid = find_pc(search_path, name, path, sizeof(path));
+        if (valid) {
+            const size_t len = strlen(path);
+            const char *p = fingerprints;
+            valid = false;
+            while ((p = strstr(p, path)) != nullptr && !valid) {
+                valid = p > fingerprints && p[-1] == ':' && (p[len] == ' ' || p[len] == '\0');
+                p += len;
+            }
+        }
+    }
+    free(copy);
+    return valid;
+}
+
+const char* pkg_resolve(const char *names, char *identity, const size_t size) {
+    static char flags[PKG_FLAGS_SIZE];
+    if (names == nullptr || identity == nullptr) {
+        fprintf(stderr, "pkg_resolve: names and identity must not be null\n");
+        exit(EXIT_FAILURE);
+    }
+    if (!valid_names(names)) {
+        fprintf(stderr, "cscript: invalid package name in #pkg %s\n", names);
+        exit(EXIT_FAILURE);
+    }
+    //The result depends on the packages, pkg-config and its environment
+    char request[PATH_MAX * 4 + 1024];
+    snprintf(request, sizeof(request), "%s|%s|%s|%s|%s", names, toolchain_id(pkg_config()),
+             getenv("PKG_CONFIG_PATH") != nullptr ? getenv("PKG_CONFIG_PATH") : "",
+             getenv("PKG_CONFIG_LIBDIR") != nullptr ? getenv("PKG_CONFIG_LIBDIR") : "",
+             getenv("PKG_CONFIG_SYSROOT_DIR") != nullptr ? getenv("PKG_CONFIG_SYSROOT_DIR") : "");
+    char entry[PATH_MAX] = "";
+    char fingerprints[PKG_MAX_FILES * (PATH_MAX + 64) / 8];
+    if (cache_writes_enabled()) {
+        snprintf(entry, sizeof(entry), "%s/pkg/%s", cache_get_dir(), sha256_string(request));
+    }
+    if (entry[0] != '\0' && entry_valid(entry, names, flags, fingerprints, sizeof(fingerprints))) {
+        cache_mark_used(entry);
+#if DEBUG == 1
+        printf("DBG: pkg_resolve: cached %s: %s\n", names, flags);
+#endif
+    } else {
+        char args[2048];
+        snprintf(args, sizeof(args), "--cflags --libs %s", names);
+        if (!run_pkg_config(args, flags, sizeof(flags))) {
+            fprintf(stderr, "cscript: could not resolve #pkg %s with %s\n", names, pkg_config());
+            exit(EXIT_FAILURE);
+        }
+        //The search path of pkg-config is needed to find the .pc files
+        char search_path[8192] = "";
+        char pc_path[4096] = "";
+        const char *libdir = getenv("PKG_CONFIG_LIBDIR");
+        if (libdir == nullptr) {
+            run_pkg_config("--variable pc_path pkg-config", pc_path, sizeof(pc_path));
+        }
+        snprintf(search_path, sizeof(search_path), "%s:%s",
+                 getenv("PKG_CONFIG_PATH") != nullptr ? getenv("PKG_CONFIG_PATH") : "",
+                 libdir != nullptr ? libdir : pc_path);
+        pkg_files *files = (pkg_files*)calloc(1, sizeof(pkg_files));
+        char *copy = strdup(names);
+        char *save = nullptr;
+        for (char *name = strtok_r(copy, " ", &save); name != nullptr; name = strtok_r(nullptr, " ", &save)) {
+            add_package(files, search_path, name);
+        }
+        free(copy);
+        join_fingerprints(files, fingerprints, sizeof(fingerprints));
+        free(files);
+        if (entry[0] != '\0') {
+            char dir[PATH_MAX];
+            snprintf(dir, sizeof(dir), "%s/pkg", cache_get_dir());
+            mkdir_p(dir, cache_dir_mode());
+            if (kv_write(entry, "search_path", search_path) != 0 || kv_write(entry, "files", fingerprints) != 0
+                || kv_write(entry, "flags", flags) != 0) {
+                fprintf(stderr, "cscript: could not write %s\n", entry);
+            }
+        }
+#if DEBUG == 1
+        printf("DBG: pkg_resolve: resolved %s: %s (%s)\n", names, flags, fingerprints);
+#endif
+    }
+    char *id_source = (char*)malloc(strlen(flags) + strlen(fingerprints) + 2);
+    sprintf(id_source, "%s\n%s", flags, fingerprints);
+    snprintf(identity, size, "%s", sha256_string(id_source));
+    free(id_source);
+    return flags;
+}
@@ -0,0 +1,30 @@
+/**
+ * @file pkg.h
+ * @author Stefan Kleinschmiodt
+ * @date 13. Nov 2024
+ * @brief Contains the package related functions for cscript.
+ *
+ * Resolves the packages named in @#pkg lines through pkg-config. The result is
+ * kept in the cache directory together with the fingerprints of the involved
+ * .pc files, so pkg-config is only run again when a package changes.
+ */
+#pragma once
+
+#include <stddef.h>
+
+/**
+ * @brief Resolves packages to compiler and linker flags
+ *
+ * Returns the output of pkg-config --cflags --libs for the packages. A cached
+ * result is used as long as the .pc files of the packages and of the packages
+ * they require are unchanged. The identity covers the flags and the .pc files,
+ * it is part of the cache key of the script.
+ * The pointer to the buffer containing the flags will be overwritten
+ * on a subsequent use of this function. Not thread safe!
+ *
+ * @param names The names of the packages, separated by whitespace
+ * @param identity Receives the identity of the resolved packages
+ * @param size The size of @p identity
+ * @return The flags, the program exits if a package can't be resolved
+ */
+const char* pkg_resolve(const char *names, char *identity, size_t size);
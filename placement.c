@@ -0,0 +1,311 @@
+/**
+ * @file placement.c
+ * @author Stefan Kleinschmiodt
+ * @date 13. Nov 2024
+ * @brief Contains the implementations of the placement related functions for cscript.
+ *
+ * Provides the parsing and the application of the placement directives.
+ */
+#define _GNU_SOURCE
+#include "placement.h"
+
+#include <errno.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <linux/limits.h>
+#include <linux/mempolicy.h>
+#include <sys/mman.h>
+#include <sys/prctl.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+
+#include "cache.h"
+#include "sha256.h"
+#include "toolchain.h"
+#include "tools.h"
+
+#define BITS_PER_LONG (8 * sizeof(unsigned long))
+#define PLACEMENT_THP_TUNABLE "glibc.malloc.hugetlb=1"
+#define PLACEMENT_MLOCKALL_SOURCE "#include <stdio.h>\n#include <sys/mman.h>\n" \
+    "__attribute__((constructor)) static void cscript_placement_mlockall(void) {\n" \
+    "    if (mlockall(MCL_CURRENT | MCL_FUTURE) != 0) {\n" \
+    "        perror(\"cscript: mlockall\");\n" \
+    "    }\n" \
+    "}\n"
+
+/**
+ * @brief The names of the resource limits
+ */
+static const struct {
+    const char *name;
+    int resource;
+} rlimit_names[] = {
+    { "as", RLIMIT_AS }, { "core", RLIMIT_CORE }, { "cpu", RLIMIT_CPU }, { "data", RLIMIT_DATA },
+    { "fsize", RLIMIT_FSIZE }, { "locks", RLIMIT_LOCKS }, { "memlock", RLIMIT_MEMLOCK },
+    { "msgqueue", RLIMIT_MSGQUEUE }, { "nice", RLIMIT_NICE }, { "nofile", RLIMIT_NOFILE }, { "nproc", RLIMIT_NPROC },
+    { "rss", RLIMIT_RSS }, { "rtprio", RLIMIT_RTPRIO }, { "rttime", RLIMIT_RTTIME },
+    { "sigpending", RLIMIT_SIGPENDING }, { "stack", RLIMIT_STACK }, { nullptr, 0 }
+};
+
+void placement_init(placement *pl) {
+    memset(pl, 0, sizeof(placement));
+    pl->numa_mode = -1;
+    pl->thp = -1;
+}
+
+bool parse_id_list(const char *list, unsigned long *mask) {
+    //A list of ids and ranges, e.g. 0-3,6,8-11
+    memset(mask, 0, PLACEMENT_MAX_IDS / 8);
+    const char *p = list;
+    while (*p != '\0') {
+        char *end;
+        const long first = strtol(p, &end, 10);
+        long last = first;
+        if (end == p || first < 0) {
+            return false;
+        }
+        p = end;
+        if (*p == '-') {
+            last = strtol(++p, &end, 10);
+            if (end == p || last < first) {
+                return false;
+            }
+            p = end;
+        }
+        if (last >= PLACEMENT_MAX_IDS) {
+            return false;
+        }
+        for (long id = first; id <= last; id++) {
+            mask[id / BITS_PER_LONG] |= 1UL << (id % BITS_PER_LONG);
+        }
+        if (*p == ',') {
+            p++;
+        } else if (*p != '\0') {
+            return false;
+        }
+    }
+    return list[0] != '\0';
+}
+
+bool parse_nodes(const char *nodes, unsigned long *mask) {
+    if (strcmp(nodes, "all") != 0) {
+        return parse_id_list(nodes, mask);
+    }
+    char online[256] = "0";
+    FILE *fp = fopen("/sys/devices/system/node/online", "r");
+    if (fp != nullptr) {
+        if (fgets(online, sizeof(online), fp) == nullptr) {
+            strcpy(online, "0");
+        }
+        fclose(fp);
+    }
+    online[strcspn(online, "\n")] = '\0';
+    return parse_id_list(online, mask);
+}
+
+bool parse_limit(const char *value, unsigned long long *limit) {
+    if (strcmp(value, "unlimited") == 0 || strcmp(value, "infinity") == 0) {
+        *limit = RLIM_INFINITY;
+        return true;
+    }
+    char *end;
+    *limit = strtoull(value, &end, 10);
+    if (end == value) {
+        return false;
+    }
+    //Sizes may be given with a suffix
+    switch (*end) {
+        case 'k': case 'K': *limit <<= 10; end++; break;
+        case 'm': case 'M': *limit <<= 20; end++; break;
+        case 'g': case 'G': *limit <<= 30; end++; break;
+        default: break;
+    }
+    return *end == '\0' || *end == ':';
+}
+
+void invalid_directive(const char *name, const char *value) {
+    fprintf(stderr, "cscript: invalid directive %s=%s\n", name, value != nullptr ? value : "");
+    exit(EXIT_FAILURE);
+}
+
+bool placement_directive(placement *pl, const char *name, const char *value) {
+    if (strcmp(name, "cpus") == 0) {
+        if (value == nullptr || !parse_id_list(value, pl->cpu_mask)) {
+            invalid_directive(name, value);
+        }
+        pl->cpus = true;
+    } else if (strcmp(name, "numa") == 0) {
+        //local, preferred:{node}, bind:{nodes} or interleave:{nodes}
+        const char *nodes = value != nullptr ? strchr(value, ':') : nullptr;
+        const size_t len = nodes != nullptr ? (size_t)(nodes - value) : value != nullptr ? strlen(value) : 0;
+        if (value != nullptr && strncmp(value, "local", len) == 0 && len == 5 && nodes == nullptr) {
+            pl->numa_mode = MPOL_LOCAL;
+        } else if (value != nullptr && strncmp(value, "preferred", len) == 0 && len == 9 && nodes != nullptr) {
+            pl->numa_mode = MPOL_PREFERRED;
+        } else if (value != nullptr && strncmp(value, "bind", len) == 0 && len == 4 && nodes != nullptr) {
+            pl->numa_mode = MPOL_BIND;
+        } else if (value != nullptr && strncmp(value, "interleave", len) == 0 && len == 10 && nodes != nullptr) {
+            pl->numa_mode = MPOL_INTERLEAVE;
+        } else {
+            invalid_directive(name, value);
+        }
+        if (nodes != nullptr && !parse_nodes(nodes + 1, pl->node_mask)) {
+            invalid_directive(name, value);
+        }
+    } else if (strcmp(name, "thp") == 0) {
+        if (value == nullptr || (strcmp(value, "always") != 0 && strcmp(value, "never") != 0)) {
+            invalid_directive(name, value);
+        }
+        pl->thp = strcmp(value, "always") == 0 ? 1 : 0;
+    } else if (strcmp(name, "mlockall") == 0) {
+        pl->mlockall = true;
+    } else if (strcmp(name, "nice") == 0) {
+        char *end = nullptr;
+        pl->nice = value != nullptr ? (int)strtol(value, &end, 10) : 0;
+        if (value == nullptr || end == value || *end != '\0' || pl->nice < -20 || pl->nice > 19) {
+            invalid_directive(name, value);
+        }
+        pl->nice_set = true;
+    } else if (strncmp(name, "rlimit-", 7) == 0) {
+        //rlimit-{name}={soft} or rlimit-{name}={soft}:{hard}
+        int i = 0;
+        while (rlimit_names[i].name != nullptr && strcmp(rlimit_names[i].name, name + 7) != 0) {
+            i++;
+        }
+        if (rlimit_names[i].name == nullptr || value == nullptr || pl->rlimit_count == PLACEMENT_MAX_RLIMITS) {
+            invalid_directive(name, value);
+        }
+        placement_rlimit *limit = &pl->rlimits[pl->rlimit_count++];
+        limit->resource = rlimit_names[i].resource;
+        const char *hard = strchr(value, ':');
+        limit->has_hard = hard != nullptr;
+        if (!parse_limit(value, &limit->soft) || (hard != nullptr && !parse_limit(hard + 1, &limit->hard))
+            || (limit->has_hard && limit->soft > limit->hard)) {
+            invalid_directive(name, value);
+        }
+    } else {
+        return false;
+    }
+    return true;
+}
+
+bool compile_mlockall(const char *cc, const char *output) {
+    //The constructor is compiled on its own, so the script's code stays untouched
+    char cmd[2 * PATH_MAX + 64];
+    snprintf(cmd, sizeof(cmd), toolchain_is_tcc(cc) ? "%s -c - -o %s" : "%s -O2 -x c -c - -o %s", cc, output);
+#if DEBUG == 1
+    printf("GCC: %s\n", cmd);
+#endif
+    FILE *fp = popen(cmd, "w");
+    if (fp == nullptr) {
+        return false;
+    }
+    fputs(PLACEMENT_MLOCKALL_SOURCE, fp);
+    return pclose(fp) == 0;
+}
+
+const char* placement_object(const placement *pl, const char *cc, const bool in_memory) {
+    static char object[PATH_MAX];
+    if (!pl->mlockall) {
+        return nullptr;
+    }
+    if (in_memory) {
+        //Without a cache directory the object is kept in a memfd, which gcc and ld inherit
+        const int fd = memfd_create("cscript-mlockall", 0);
+        snprintf(object, sizeof(object), "/proc/self/fd/%d", fd);
+        if (fd == -1 || !compile_mlockall(cc, object)) {
+            fprintf(stderr, "cscript: could not compile the mlockall constructor\n");
+            exit(EXIT_FAILURE);
+        }
+        return object;
+    }
+    char identity[PATH_MAX + sizeof(PLACEMENT_MLOCKALL_SOURCE)];
+    char dir[PATH_MAX];
+    snprintf(identity, sizeof(identity), "%s:%s", toolchain_id(cc), PLACEMENT_MLOCKALL_SOURCE);
+    format_path(dir, sizeof(dir), "%s/placement", cache_get_dir());
+    format_path(object, sizeof(object), "%s/mlockall.%s.o", dir, sha256_string(identity));
+    if (file_exists(object)) {
+        cache_mark_used(object);
+        return object;
+    }
+    //Compile to a temporary file, concurrent compiles may race
+    char tmp_object[PATH_MAX + 16];
+    snprintf(tmp_object, sizeof(tmp_object), "%s.%d", object, getpid());
+    mkdir_p(dir, cache_dir_mode());
+    if (!compile_mlockall(cc, tmp_object) || rename(tmp_object, object) != 0) {
+        unlink(tmp_object);
+        fprintf(stderr, "cscript: could not compile the mlockall constructor\n");
+        exit(EXIT_FAILURE);
+    }
+    return object;
+}
+
+void placement_apply(const placement *pl) {
+    if (pl->cpus) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        for (int cpu = 0; cpu < PLACEMENT_MAX_IDS && cpu < CPU_SETSIZE; cpu++) {
+            if (pl->cpu_mask[cpu / BITS_PER_LONG] & (1UL << (cpu % BITS_PER_LONG))) {
+                CPU_SET(cpu, &set);
+            }
+        }
+        if (sched_setaffinity(0, sizeof(set), &set) != 0) {
+            fprintf(stderr, "cscript: could not set the cpu affinity: %s\n", strerror(errno));
+        }
+    }
+    if (pl->numa_mode >= 0) {
+        //The policy is kept across the exec, so the script allocates all its memory with it
+        const bool nodes = pl->numa_mode != MPOL_LOCAL;
+        if (syscall(SYS_set_mempolicy, pl->numa_mode, nodes ? pl->node_mask : nullptr,
+                    nodes ? PLACEMENT_MAX_IDS : 0) != 0) {
+            fprintf(stderr, "cscript: could not set the numa policy: %s\n", strerror(errno));
+        }
+    }
+    if (pl->thp >= 0) {
+        //Huge pages can only be disabled per process, always clears an inherited disable.
+        //The system policy can't be overridden, it may restrict huge pages to advised memory.
+        if (prctl(PR_SET_THP_DISABLE, pl->thp == 0 ? 1 : 0, 0, 0, 0) != 0) {
+            fprintf(stderr, "cscript: could not set the huge page mode: %s\n", strerror(errno));
+        }
+        FILE *fp = pl->thp == 1 ? fopen("/sys/kernel/mm/transparent_hugepage/enabled", "r") : nullptr;
+        if (fp != nullptr) {
+            char mode[128] = "";
+            if (fgets(mode, sizeof(mode), fp) != nullptr && strstr(mode, "[never]") != nullptr) {
+                fprintf(stderr, "cscript: transparent huge pages are disabled on this system\n");
+            } else if (strstr(mode, "[madvise]") != nullptr) {
+                //Only advised memory gets huge pages, so glibc's malloc is told to advise its heap
+                const char *tunables = getenv("GLIBC_TUNABLES");
+                char value[4096];
+                snprintf(value, sizeof(value), "%s%s" PLACEMENT_THP_TUNABLE,
+                         tunables != nullptr ? tunables : "", tunables != nullptr && *tunables != '\0' ? ":" : "");
+                if (tunables == nullptr || strstr(tunables, "glibc.malloc.hugetlb=") == nullptr) {
+                    setenv("GLIBC_TUNABLES", value, 1);
+                }
+            }
+            fclose(fp);
+        }
+    }
+    if (pl->nice_set && setpriority(PRIO_PROCESS, 0, pl->nice) != 0) {
+        fprintf(stderr, "cscript: could not set nice %d: %s\n", pl->nice, strerror(errno));
+    }
+    for (int i = 0; i < pl->rlimit_count; i++) {
+        const placement_rlimit *limit = &pl->rlimits[i];
+        struct rlimit rl;
+        getrlimit(limit->resource, &rl);
+        rl.rlim_cur = limit->soft;
+        if (limit->has_hard) {
+            rl.rlim_max = limit->hard;
+        } else if (rl.rlim_cur > rl.rlim_max) {
+            rl.rlim_max = rl.rlim_cur;
+        }
+        if (setrlimit(limit->resource, &rl) != 0) {
+            int j = 0;
+            while (rlimit_names[j].name != nullptr && rlimit_names[j].resource != limit->resource) {
+                j++;
+            }
+            fprintf(stderr, "cscript: could not set rlimit-%s: %s\n", rlimit_names[j].name, strerror(errno));
+        }
+    }
+}
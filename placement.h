@@ -0,0 +1,98 @@
+/**
+ * @file placement.h
+ * @author Stefan Kleinschmiodt
+ * @date 13. Nov 2024
+ * @brief Contains the placement related functions for cscript.
+ *
+ * Provides the @#cscript directives that define where and how a script runs:
+ * cpu affinity, numa memory policy, transparent huge pages, memory locking,
+ * scheduling priority and resource limits. They are applied by cscript right
+ * before the exec, so no wrapper like taskset or numactl is needed.
+ */
+#pragma once
+
+#include <stdio.h>
+
+/**
+ * @brief The maximum number of cpus and numa nodes in a list
+ */
+#define PLACEMENT_MAX_IDS 1024
+
+/**
+ * @brief The maximum number of resource limits
+ */
+#define PLACEMENT_MAX_RLIMITS 16
+
+/**
+ * @brief Defines a resource limit
+ */
+typedef struct placement_rlimit {
+    int resource; /**< The resource, e.g. RLIMIT_NOFILE. */
+    unsigned long long soft; /**< The soft limit. */
+    unsigned long long hard; /**< The hard limit. */
+    bool has_hard; /**< true if the hard limit is given, otherwise it is kept. */
+} placement_rlimit;
+
+/**
+ * @brief Defines the placement of a script
+ */
+typedef struct placement {
+    bool cpus; /**< Set the cpu affinity, @#cscript cpus=0-3,6. */
+    unsigned long cpu_mask[PLACEMENT_MAX_IDS / (8 * sizeof(unsigned long))]; /**< The cpus to run on. */
+    int numa_mode; /**< The memory policy (MPOL_...), -1 to keep it, @#cscript numa=bind:0. */
+    unsigned long node_mask[PLACEMENT_MAX_IDS / (8 * sizeof(unsigned long))]; /**< The nodes of the policy. */
+    int thp; /**< 1 for @#cscript thp=always, 0 for thp=never, -1 to keep the setting. */
+    bool mlockall; /**< Lock all memory of the script, @#cscript mlockall. */
+    bool nice_set; /**< Set the scheduling priority, @#cscript nice=-5. */
+    int nice; /**< The nice value. */
+    placement_rlimit rlimits[PLACEMENT_MAX_RLIMITS]; /**< The resource limits, @#cscript rlimit-nofile=65536. */
+    int rlimit_count; /**< The number of resource limits. */
+} placement;
+
+/**
+ * @brief Initializes a placement without any settings
+ * @param pl The placement
+ */
+void placement_init(placement *pl);
+
+/**
+ * @brief Applies a directive to a placement
+ *
+ * Handles the directives cpus=, numa=, thp=, mlockall, nice= and rlimit-{name}=.
+ * An invalid value terminates cscript.
+ *
+ * @param pl The placement
+ * @param name The name of the directive
+ * @param value The value of the directive, may be nullptr
+ * @return true if the directive is a placement directive
+ */
+bool placement_directive(placement *pl, const char *name, const char *value);
+
+/**
+ * @brief Gets the object needed inside the script
+ *
+ * Memory locks don't survive an exec, so for mlockall a constructor locking
+ * the memory is linked into the script. It is compiled separately with the
+ * compiler of the script and kept in the cache, the script's own code is not
+ * changed. The pointer to the buffer containing the path will be overwritten
+ * on a subsequent use of this function. Not thread safe!
+ *
+ * @param pl The placement
+ * @param cc The compiler of the script
+ * @param in_memory true to compile into a memfd instead of the cache, for diskless runs
+ * @return The path of the object to link, nullptr if none is needed
+ */
+const char* placement_object(const placement *pl, const char *cc, bool in_memory);
+
+/**
+ * @brief Applies a placement to the current process
+ *
+ * Sets the cpu affinity, the memory policy, the huge page mode, the priority
+ * and the resource limits, which are all kept across an exec. Settings that
+ * can't be applied are reported on stderr. With thp=always on a system that
+ * only gives huge pages to advised memory, glibc's malloc is told to advise its
+ * heap through GLIBC_TUNABLES.
+ *
+ * @param pl The placement
+ */
+void placement_apply(const placement *pl);
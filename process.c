@@ -0,0 +1,234 @@
+/**
+ * @file process.c
+ * @author Stefan Kleinschmiodt
+ * @date 13. Nov 2024
+ * @brief Contains the implementations of the process related functions for cscript.
+ *
+ * Provides functions to run and measure child processes.
+ */
+#define _GNU_SOURCE
+#include "process.h"
+
+#include <errno.h>
+#include <sched.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+
+#define PROCESS_COUNTERS 5
+
+/**
+ * @brief The counters opened on the child, in the order of the process_stats fields
+ */
+static const struct {
+    uint32_t type;
+    uint64_t config;
+} perf_counters[PROCESS_COUNTERS] = {
+    { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+    { PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+    { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES },
+    { PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+    { PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK },
+};
+
+int open_counter(const pid_t pid, const uint32_t type, const uint64_t config) {
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = type;
+    attr.config = config;
+    //Counting starts with the exec of the child and covers its threads and children
+    attr.disabled = 1;
+    attr.enable_on_exec = 1;
+    attr.inherit = 1;
+    //User space only, so the counters also work with perf_event_paranoid = 2
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    return (int)syscall(SYS_perf_event_open, &attr, pid, -1, -1, PERF_FLAG_FD_CLOEXEC);
+}
+
+uint64_t read_counter(const int fd) {
+    uint64_t values[3];
+    if (fd == -1 || read(fd, values, sizeof(values)) != sizeof(values) || values[2] == 0) {
+        return PROCESS_COUNTER_UNAVAILABLE;
+    }
+    //Scale the value if the counter had to be multiplexed
+    if (values[2] < values[1]) {
+        return (uint64_t)((double)values[0] * (double)values[1] / (double)values[2]);
+    }
+    return values[0];
+}
+
+double elapsed_ms(const struct timespec *start, const struct timespec *end) {
+    return (double)(end->tv_sec - start->tv_sec) * 1000.0 + (double)(end->tv_nsec - start->tv_nsec) / 1000000.0;
+}
+
+void process_run(const char *path, char **argv, const process_options *options, process_stats *stats) {
+    if (path == nullptr || argv == nullptr || stats == nullptr) {
+        fprintf(stderr, "process_run: path, argv and stats must not be null\n");
+        exit(EXIT_FAILURE);
+    }
+    memset(stats, 0, sizeof(process_stats));
+    stats->cycles = stats->instructions = stats->cache_misses = stats->branch_misses = PROCESS_COUNTER_UNAVAILABLE;
+    const bool perf = options != nullptr && options->perf;
+
+    //The child waits on the pipe until the counters are attached to it
+    int sync[2];
+    if (pipe2(sync, O_CLOEXEC) != 0) {
+        fprintf(stderr, "process_run: could not create pipe: %s\n", strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    fflush(stdout);
+    fflush(stderr);
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    const pid_t pid = fork();
+    if (pid == -1) {
+        fprintf(stderr, "process_run: fork failed: %s\n", strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    if (pid == 0) {
+        char go;
+        close(sync[1]);
+        while (read(sync[0], &go, 1) == -1 && errno == EINTR) {
+        }
+        if (options != nullptr && options->quiet) {
+            const int null_fd = open("/dev/null", O_WRONLY);
+            dup2(null_fd, STDOUT_FILENO);
+            close(null_fd);
+        }
+        if (options != nullptr && options->cpu >= 0) {
+            cpu_set_t set;
+            CPU_ZERO(&set);
+            CPU_SET(options->cpu, &set);
+            if (sched_setaffinity(0, sizeof(set), &set) != 0) {
+                fprintf(stderr, "cscript: could not pin to cpu %d: %s\n", options->cpu, strerror(errno));
+            }
+        }
+        execv(path, argv);
+        fprintf(stderr, "cscript: failed executing %s: %s\n", path, strerror(errno));
+        _exit(127);
+    }
+    close(sync[0]);
+    int fds[PROCESS_COUNTERS];
+    for (int i = 0; i < PROCESS_COUNTERS; i++) {
+        fds[i] = perf ? open_counter(pid, perf_counters[i].type, perf_counters[i].config) : -1;
+        stats->perf |= fds[i] != -1;
+    }
+#if DEBUG == 1
+    if (perf && !stats->perf) {
+        printf("DBG: process_run: perf_event_open failed: %s\n", strerror(errno));
+    }
+#endif
+    //Let the child go
+    close(sync[1]);
+    while (wait4(pid, &stats->status, 0, &stats->usage) == -1) {
+        if (errno != EINTR) {
+            fprintf(stderr, "process_run: wait failed: %s\n", strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    stats->wall_ms = elapsed_ms(&start, &end);
+
+    uint64_t values[PROCESS_COUNTERS];
+    for (int i = 0; i < PROCESS_COUNTERS; i++) {
+        values[i] = read_counter(fds[i]);
+        if (fds[i] != -1) {
+            close(fds[i]);
+        }
+    }
+    stats->cycles = values[0];
+    stats->instructions = values[1];
+    stats->cache_misses = values[2];
+    stats->branch_misses = values[3];
+    //Without perf the cpu time of the child is taken from the resource usage
+    if (values[4] != PROCESS_COUNTER_UNAVAILABLE) {
+        stats->task_clock_ms = (double)values[4] / 1000000.0;
+    } else {
+        stats->task_clock_ms = (double)(stats->usage.ru_utime.tv_sec + stats->usage.ru_stime.tv_sec) * 1000.0
+                               + (double)(stats->usage.ru_utime.tv_usec + stats->usage.ru_stime.tv_usec) / 1000.0;
+    }
+}
+
+int process_exit_code(const process_stats *stats) {
+    if (WIFEXITED(stats->status)) {
+        return WEXITSTATUS(stats->status);
+    }
+    if (WIFSIGNALED(stats->status)) {
+        return 128 + WTERMSIG(stats->status);
+    }
+    return EXIT_FAILURE;
+}
+
+void print_counter(FILE *fp, const char *name, const uint64_t value) {
+    if (value != PROCESS_COUNTER_UNAVAILABLE) {
+        fprintf(fp, ", %s %llu", name, (unsigned long long)value);
+    }
+}
+
+void process_report(FILE *fp, const char *name, const process_stats *stats) {
+    fprintf(fp, "cscript: %s: exit %d, wall %.3f ms, task-clock %.3f ms", name, process_exit_code(stats),
+            stats->wall_ms, stats->task_clock_ms);
+    print_counter(fp, "cycles", stats->cycles);
+    print_counter(fp, "instructions", stats->instructions);
+    if (stats->cycles != PROCESS_COUNTER_UNAVAILABLE && stats->instructions != PROCESS_COUNTER_UNAVAILABLE
+        && stats->cycles > 0) {
+        fprintf(fp, " (IPC %.2f)", (double)stats->instructions / (double)stats->cycles);
+    }
+    print_counter(fp, "cache-misses", stats->cache_misses);
+    print_counter(fp, "branch-misses", stats->branch_misses);
+    fprintf(fp, ", max-rss %ld kB, faults %ld/%ld, ctx-switches %ld/%ld%s\n", stats->usage.ru_maxrss,
+            stats->usage.ru_minflt, stats->usage.ru_majflt, stats->usage.ru_nvcsw, stats->usage.ru_nivcsw,
+            stats->perf ? "" : " (perf unavailable, rusage only)");
+}
+
+void print_json_string(FILE *fp, const char *value) {
+    fputc('"', fp);
+    for (const char *p = value; *p != '\0'; p++) {
+        if (*p == '"' || *p == '\\') {
+            fputc('\\', fp);
+        }
+        if ((unsigned char)*p < 0x20) {
+            fprintf(fp, "\\u%04x", *p);
+        } else {
+            fputc(*p, fp);
+        }
+    }
+    fputc('"', fp);
+}
+
+void print_json_counter(FILE *fp, const char *name, const uint64_t value) {
+    if (value != PROCESS_COUNTER_UNAVAILABLE) {
+        fprintf(fp, ",\"%s\":%llu", name, (unsigned long long)value);
+    } else {
+        fprintf(fp, ",\"%s\":null", name);
+    }
+}
+
+void process_log_json(const char *log_path, const char *name, const char *key, const process_stats *stats) {
+    FILE *fp = fopen(log_path, "a");
+    if (fp == nullptr) {
+        fprintf(stderr, "process_log_json: could not open %s\n", log_path);
+        return;
+    }
+    fprintf(fp, "{\"time\":%lld,\"script\":", (long long)time(nullptr));
+    print_json_string(fp, name);
+    fputs(",\"key\":", fp);
+    print_json_string(fp, key);
+    fprintf(fp, ",\"source\":\"%s\",\"exit\":%d,\"wall_ms\":%.3f,\"task_clock_ms\":%.3f",
+            stats->perf ? "perf" : "rusage", process_exit_code(stats), stats->wall_ms, stats->task_clock_ms);
+    print_json_counter(fp, "cycles", stats->cycles);
+    print_json_counter(fp, "instructions", stats->instructions);
+    print_json_counter(fp, "cache_misses", stats->cache_misses);
+    print_json_counter(fp, "branch_misses", stats->branch_misses);
+    fprintf(fp, ",\"max_rss_kb\":%ld,\"minor_faults\":%ld,\"major_faults\":%ld}\n",
+            stats->usage.ru_maxrss, stats->usage.ru_minflt, stats->usage.ru_majflt);
+    fclose(fp);
+}
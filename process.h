@@ -0,0 +1,94 @@
+/**
+ * @file process.h
+ * @author Stefan Kleinschmiodt
+ * @date 13. Nov 2024
+ * @brief Contains the process related functions for cscript.
+ *
+ * Provides functions to run an executable as child process and to
+ * measure it with hardware performance counters (perf_event_open) or,
+ * if those are not available, with the resource usage of the child.
+ */
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/resource.h>
+
+/**
+ * @brief Marks a counter that could not be measured
+ */
+#define PROCESS_COUNTER_UNAVAILABLE UINT64_MAX
+
+/**
+ * @brief Defines how a child process is run
+ */
+typedef struct process_options {
+    bool perf; /**< Measure the child with hardware performance counters. */
+    bool quiet; /**< Redirect the stdout of the child to /dev/null. */
+    int cpu; /**< Pin the child to this cpu, -1 for no pinning. */
+} process_options;
+
+/**
+ * @brief Defines the results of a child process run
+ */
+typedef struct process_stats {
+    int status; /**< The wait status of the child. */
+    bool perf; /**< true if the performance counters could be opened. */
+    uint64_t cycles; /**< The number of cpu cycles. */
+    uint64_t instructions; /**< The number of instructions. */
+    uint64_t cache_misses; /**< The number of cache misses. */
+    uint64_t branch_misses; /**< The number of branch misses. */
+    double task_clock_ms; /**< The cpu time in ms, from perf or from the resource usage. */
+    double wall_ms; /**< The wall clock time in ms. */
+    struct rusage usage; /**< The resource usage of the child. */
+} process_stats;
+
+/**
+ * @brief Runs an executable as child process
+ *
+ * Forks a child process that executes @p path with the arguments @p argv and
+ * waits for it to finish. If requested in @p options, the performance counters
+ * are opened on the child before it executes the program, so they only cover
+ * the program itself. Counters that are not supported are set to
+ * PROCESS_COUNTER_UNAVAILABLE.
+ *
+ * @param path The path to the executable
+ * @param argv The arguments, terminated by nullptr
+ * @param options The options for the run, may be nullptr
+ * @param stats Receives the results of the run
+ */
+void process_run(const char *path, char **argv, const process_options *options, process_stats *stats);
+
+/**
+ * @brief Gets the exit code of a child process
+ *
+ * Returns the exit code of the child, or 128 + the signal number if the
+ * child has been terminated by a signal, like a shell does.
+ *
+ * @param stats The results of the run
+ * @return The exit code
+ */
+int process_exit_code(const process_stats *stats);
+
+/**
+ * @brief Reports the results of a run
+ *
+ * Prints the measured values to @p fp in a human readable form.
+ *
+ * @param fp The stream to print to
+ * @param name The name of the script
+ * @param stats The results of the run
+ */
+void process_report(FILE *fp, const char *name, const process_stats *stats);
+
+/**
+ * @brief Appends the results of a run to a log
+ *
+ * Appends the measured values as a single JSON line to the file @p log_path.
+ *
+ * @param log_path The path of the log file
+ * @param name The name of the script
+ * @param key The cache key of the script
+ * @param stats The results of the run
+ */
+void process_log_json(const char *log_path, const char *name, const char *key, const process_stats *stats);
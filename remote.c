@@ -0,0 +1,578 @@
+/**
+ * @file remote.c
+ * @author Stefan Kleinschmiodt
+ * @date 13. Nov 2024
+ * @brief Contains the implementations of the remote cache related functions for cscript.
+ *
+ * Provides the socket and the directory backends, the fetch and the upload of
+ * cache entries and the reference cache server.
+ */
+#define _GNU_SOURCE
+#include "remote.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+
+#include "cache.h"
+#include "pack.h"
+#include "script_file_type.h"
+#include "tools.h"
+
+#define REMOTE_TIMEOUT_MS 2000
+#define REMOTE_SERVER_TIMEOUT_MS 30000
+#define REMOTE_MAX_SIZE (1LL << 30)
+
+bool remote_wait(const int fd, const short events, const double deadline) {
+    //Every operation has a deadline, slow peers can't stretch it by sending little at a time
+    struct pollfd pfd = {fd, events, 0};
+    for (;;) {
+        const double left = deadline - now_ms();
+        const int n = left > 0 ? poll(&pfd, 1, (int)left + 1) : 0;
+        if (n == -1 && errno == EINTR) {
+            continue;
+        }
+        if (n == 0) {
+            errno = ETIMEDOUT;
+        }
+        return n == 1;
+    }
+}
+
+bool remote_is_socket(const int fd) {
+    struct stat st;
+    return fstat(fd, &st) == 0 && S_ISSOCK(st.st_mode);
+}
+
+bool remote_send(const int fd, const char *data, size_t size, const double deadline) {
+    //Sockets don't raise SIGPIPE, a closed connection is just a failed write
+    while (size > 0) {
+        if (!remote_wait(fd, POLLOUT, deadline)) {
+            return false;
+        }
+        const ssize_t n = send(fd, data, size, MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (n == -1 && (errno == EINTR || errno == EAGAIN)) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        data += n;
+        size -= (size_t)n;
+    }
+    return true;
+}
+
+ssize_t remote_recv(const int fd, char *buffer, const size_t size, const double deadline) {
+    for (;;) {
+        if (!remote_wait(fd, POLLIN, deadline)) {
+            return -1;
+        }
+        const ssize_t n = recv(fd, buffer, size, MSG_DONTWAIT);
+        if (n == -1 && (errno == EINTR || errno == EAGAIN)) {
+            continue;
+        }
+        if (n == 0) {
+            //The connection ended before the announced content
+            errno = EPROTO;
+            return -1;
+        }
+        return n;
+    }
+}
+
+bool remote_write_file(const int fd, const char *data, size_t size) {
+    while (size > 0) {
+        const ssize_t n = write(fd, data, size);
+        if (n == -1 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            if (n == 0) {
+                errno = EIO;
+            }
+            return false;
+        }
+        data += n;
+        size -= (size_t)n;
+    }
+    return true;
+}
+
+ssize_t remote_read_file(const int fd, char *buffer, const size_t size) {
+    for (;;) {
+        const ssize_t n = read(fd, buffer, size);
+        if (n == -1 && errno == EINTR) {
+            continue;
+        }
+        if (n == 0) {
+            //The file is shorter than expected, e.g. truncated concurrently
+            errno = EIO;
+            return -1;
+        }
+        return n;
+    }
+}
+
+bool remote_copy(const int in, const int out, long long size, const double deadline) {
+    //Sockets are waited for with the remaining time, files are read and written directly
+    const bool in_socket = remote_is_socket(in);
+    const bool out_socket = remote_is_socket(out);
+    char buffer[65536];
+    while (size > 0) {
+        const size_t chunk = size < (long long)sizeof(buffer) ? (size_t)size : sizeof(buffer);
+        const ssize_t n = in_socket ? remote_recv(in, buffer, chunk, deadline) : remote_read_file(in, buffer, chunk);
+        if (n < 0 || !(out_socket ? remote_send(out, buffer, (size_t)n, deadline)
+                                  : remote_write_file(out, buffer, (size_t)n))) {
+            return false;
+        }
+        size -= n;
+    }
+    return true;
+}
+
+bool remote_read_line(const int fd, char *line, const size_t size, const double deadline) {
+    //Lines are short, reading them byte by byte leaves the following content in the socket
+    size_t len = 0;
+    while (len + 1 < size) {
+        if (remote_recv(fd, line + len, 1, deadline) != 1) {
+            return false;
+        }
+        if (line[len] == '\n') {
+            line[len] = '\0';
+            return true;
+        }
+        len++;
+    }
+    errno = EPROTO;
+    return false;
+}
+
+bool remote_split_address(const char *address, char *host, const size_t host_size, char *port,
+                          const size_t port_size) {
+    //host:port, [v6 host]:port or just the port
+    const char *colon = strrchr(address, ':');
+    if (colon == nullptr) {
+        snprintf(host, host_size, "127.0.0.1");
+        snprintf(port, port_size, "%s", address);
+    } else if (address[0] == '[' && colon > address && colon[-1] == ']') {
+        snprintf(host, host_size, "%.*s", (int)(colon - address - 2), address + 1);
+        snprintf(port, port_size, "%s", colon + 1);
+    } else {
+        snprintf(host, host_size, "%.*s", (int)(colon - address), address);
+        snprintf(port, port_size, "%s", colon + 1);
+    }
+    return host[0] != '\0' && port[0] != '\0';
+}
+
+int remote_connect_addr(const int family, const struct sockaddr *addr, const socklen_t addr_len,
+                        const double deadline) {
+    //The socket stays non-blocking, every transfer waits with poll() until the deadline
+    const int fd = socket(family, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+    if (fd == -1) {
+        return -1;
+    }
+    if (connect(fd, addr, addr_len) != 0) {
+        int error = errno;
+        socklen_t error_len = sizeof(error);
+        if (error == EINPROGRESS) {
+            if (!remote_wait(fd, POLLOUT, deadline)) {
+                error = errno;
+            } else if (getsockopt(fd, SOL_SOCKET, SO_ERROR, &error, &error_len) != 0) {
+                error = errno;
+            }
+        }
+        if (error != 0) {
+            close(fd);
+            errno = error;
+            return -1;
+        }
+    }
+    return fd;
+}
+
+int remote_connect(const remote_cache *rc, const double deadline) {
+    if (strcmp(rc->scheme, "unix") == 0) {
+        struct sockaddr_un addr = {.sun_family = AF_UNIX};
+        const int len = snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", rc->location);
+        if (len < 0 || (size_t)len >= sizeof(addr.sun_path)) {
+            errno = ENAMETOOLONG;
+            return -1;
+        }
+        return remote_connect_addr(AF_UNIX, (const struct sockaddr*)&addr, sizeof(addr), deadline);
+    }
+    char host[256];
+    char port[32];
+    struct addrinfo hints = {.ai_family = AF_UNSPEC, .ai_socktype = SOCK_STREAM};
+    struct addrinfo *result;
+    if (!remote_split_address(rc->location, host, sizeof(host), port, sizeof(port))
+        || getaddrinfo(host, port, &hints, &result) != 0) {
+        errno = EHOSTUNREACH;
+        return -1;
+    }
+    int fd = -1;
+    for (const struct addrinfo *ai = result; ai != nullptr && fd == -1; ai = ai->ai_next) {
+        fd = remote_connect_addr(ai->ai_family, ai->ai_addr, ai->ai_addrlen, deadline);
+    }
+    freeaddrinfo(result);
+    return fd;
+}
+
+int remote_request(const remote_cache *rc, const char *request, char *response, const size_t size,
+                   const double deadline) {
+    const int fd = remote_connect(rc, deadline);
+    if (fd == -1) {
+        return -1;
+    }
+    if (!remote_send(fd, request, strlen(request), deadline) || !remote_read_line(fd, response, size, deadline)) {
+        const int error = errno;
+        close(fd);
+        errno = error;
+        return -1;
+    }
+    return fd;
+}
+
+bool socket_exists(const remote_cache *rc, const char *key) {
+    char request[320];
+    char response[256];
+    snprintf(request, sizeof(request), "EXISTS %s\n", key);
+    const int fd = remote_request(rc, request, response, sizeof(response), now_ms() + rc->timeout_ms);
+    if (fd == -1) {
+        return false;
+    }
+    close(fd);
+    return strcmp(response, "OK") == 0;
+}
+
+remote_result socket_get(const remote_cache *rc, const char *key, const int out) {
+    const double deadline = now_ms() + rc->timeout_ms;
+    char request[320];
+    char response[256];
+    long long size;
+    snprintf(request, sizeof(request), "GET %s\n", key);
+    const int fd = remote_request(rc, request, response, sizeof(response), deadline);
+    if (fd == -1) {
+        return REMOTE_FAILED;
+    }
+    remote_result result = REMOTE_FAILED;
+    if (strcmp(response, "MISSING") == 0) {
+        result = REMOTE_MISSING;
+    } else if (sscanf(response, "OK %lld", &size) == 1 && size >= 0 && size <= REMOTE_MAX_SIZE) {
+        result = remote_copy(fd, out, size, deadline) ? REMOTE_FOUND : REMOTE_FAILED;
+    } else {
+        errno = EPROTO;
+    }
+    const int error = errno;
+    close(fd);
+    errno = error;
+    return result;
+}
+
+bool socket_put(const remote_cache *rc, const char *key, const int in, const long long size) {
+    const double deadline = now_ms() + rc->timeout_ms;
+    const int fd = remote_connect(rc, deadline);
+    if (fd == -1) {
+        return false;
+    }
+    char request[320];
+    char response[256];
+    snprintf(request, sizeof(request), "PUT %s %lld\n", key, size);
+    bool stored = remote_send(fd, request, strlen(request), deadline) && remote_copy(in, fd, size, deadline)
+                  && remote_read_line(fd, response, sizeof(response), deadline);
+    if (stored && strcmp(response, "OK") != 0) {
+        errno = EPROTO;
+        stored = false;
+    }
+    const int error = errno;
+    close(fd);
+    errno = error;
+    return stored;
+}
+
+void dir_entry_path(const remote_cache *rc, const char *key, char *path, const size_t size) {
+    format_path(path, size, "%s/%s.pack", rc->location, key);
+}
+
+bool dir_exists_entry(const remote_cache *rc, const char *key) {
+    char path[PATH_MAX];
+    dir_entry_path(rc, key, path, sizeof(path));
+    return file_exists(path);
+}
+
+remote_result dir_get(const remote_cache *rc, const char *key, const int out) {
+    char path[PATH_MAX];
+    struct stat st;
+    dir_entry_path(rc, key, path, sizeof(path));
+    const int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        return errno == ENOENT ? REMOTE_MISSING : REMOTE_FAILED;
+    }
+    const bool found = fstat(fd, &st) == 0 && remote_copy(fd, out, st.st_size, now_ms() + rc->timeout_ms);
+    const int error = errno;
+    close(fd);
+    errno = error;
+    return found ? REMOTE_FOUND : REMOTE_FAILED;
+}
+
+bool dir_put(const remote_cache *rc, const char *key, const int in, const long long size) {
+    //Entries are write-once: the link is atomic and fails for an existing entry, which is kept
+    char path[PATH_MAX];
+    char tmp_path[PATH_MAX + 32];
+    dir_entry_path(rc, key, path, sizeof(path));
+    snprintf(tmp_path, sizeof(tmp_path), "%s/.%s.%d", rc->location, key, getpid());
+    mkdir_p(rc->location, 0755);
+    const int fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd == -1) {
+        return false;
+    }
+    const bool stored = remote_copy(in, fd, size, now_ms() + rc->timeout_ms) && close(fd) == 0
+                        && (link(tmp_path, path) == 0 || errno == EEXIST);
+    unlink(tmp_path);
+    return stored;
+}
+
+/**
+ * @brief The available backends, selected by the scheme of CSCRIPT_REMOTE_CACHE.
+ */
+static const remote_cache remote_backends[] = {
+    {"unix", socket_exists, socket_get, socket_put, "", 0},
+    {"tcp", socket_exists, socket_get, socket_put, "", 0},
+    {"dir", dir_exists_entry, dir_get, dir_put, "", 0},
+};
+
+bool remote_open(remote_cache *rc, const char *spec, const int timeout_ms) {
+    const char *colon = strchr(spec, ':');
+    for (size_t i = 0; colon != nullptr && i < sizeof(remote_backends) / sizeof(remote_backends[0]); i++) {
+        if (strlen(remote_backends[i].scheme) == (size_t)(colon - spec)
+            && strncmp(spec, remote_backends[i].scheme, colon - spec) == 0 && colon[1] != '\0') {
+            *rc = remote_backends[i];
+            snprintf(rc->location, sizeof(rc->location), "%s", colon + 1);
+            rc->timeout_ms = timeout_ms;
+            return true;
+        }
+    }
+    return false;
+}
+
+const remote_cache* remote_cache_get() {
+    static remote_cache rc;
+    static int state = 0;
+    if (state == 0) {
+        const char *spec = getenv("CSCRIPT_REMOTE_CACHE");
+        const char *timeout = getenv("CSCRIPT_REMOTE_TIMEOUT");
+        state = spec != nullptr && spec[0] != '\0' ? 1 : -1;
+        if (state == 1 && (!remote_open(&rc, spec, timeout != nullptr ? atoi(timeout) : REMOTE_TIMEOUT_MS)
+                           || rc.timeout_ms <= 0)) {
+            fprintf(stderr, "cscript: invalid CSCRIPT_REMOTE_CACHE=%s or CSCRIPT_REMOTE_TIMEOUT, "
+                    "use unix:{path}, tcp:{host}:{port} or dir:{path} and a timeout in ms\n", spec);
+            exit(EXIT_FAILURE);
+        }
+    }
+    return state == 1 ? &rc : nullptr;
+}
+
+bool remote_fetch(sf_handle handle) {
+    const auto sf = (script_file*)handle;
+    const remote_cache *rc = remote_cache_get();
+    if (rc == nullptr || sf == nullptr) {
+        return false;
+    }
+    FILE *fp = tmpfile();
+    if (fp == nullptr) {
+        return false;
+    }
+    const double start_ms = now_ms();
+    const remote_result result = rc->get(rc, sf->key, fileno(fp));
+    int imported = 0, mismatched = 0, present = 0;
+    if (result == REMOTE_FAILED) {
+        fprintf(stderr, "cscript: remote cache %s:%s not available: %s\n", rc->scheme, rc->location, strerror(errno));
+    } else if (result == REMOTE_FOUND) {
+        rewind(fp);
+        pack_read(fp, rc->location, &imported, &mismatched, &present);
+    }
+    fclose(fp);
+#if DEBUG == 1
+    printf("DBG: remote_fetch: %s %s in %.1f ms\n", sf->key, imported > 0 ? "fetched" : "not fetched",
+           now_ms() - start_ms);
+#else
+    (void)start_ms;
+#endif
+    return imported > 0 || present > 0;
+}
+
+void remote_upload(const remote_cache *rc, const char *key) {
+    if (rc->exists(rc, key)) {
+        return;
+    }
+    FILE *fp = tmpfile();
+    if (fp == nullptr || !pack_write(fp, key)) {
+        fprintf(stderr, "cscript: could not pack cache entry %s for the remote cache\n", key);
+        if (fp != nullptr) {
+            fclose(fp);
+        }
+        return;
+    }
+    const long long size = ftell(fp);
+    rewind(fp);
+    if (!rc->put(rc, key, fileno(fp), size)) {
+        fprintf(stderr, "cscript: could not upload cache entry %s to %s:%s\n", key, rc->scheme, rc->location);
+    }
+    fclose(fp);
+}
+
+void remote_store(sf_handle handle) {
+    const auto sf = (script_file*)handle;
+    const remote_cache *rc = remote_cache_get();
+    if (rc == nullptr || sf == nullptr) {
+        return;
+    }
+    //The script runs while its entry is uploaded, the uploader is reparented so nobody has to wait for it
+    fflush(stdout);
+    fflush(stderr);
+    const pid_t pid = fork();
+    if (pid == -1) {
+        remote_upload(rc, sf->key);
+        return;
+    }
+    if (pid == 0) {
+        setsid();
+        if (fork() == 0) {
+            const int null_fd = open("/dev/null", O_RDWR);
+            dup2(null_fd, STDIN_FILENO);
+            dup2(null_fd, STDOUT_FILENO);
+            close(null_fd);
+            remote_upload(rc, sf->key);
+        }
+        _exit(EXIT_SUCCESS);
+    }
+    waitpid(pid, nullptr, 0);
+}
+
+void remote_serve_request(const remote_cache *store, const int fd) {
+    char line[512];
+    char key[256];
+    long long size;
+    const char *response = "ERROR invalid request\n";
+    const double deadline = now_ms() + REMOTE_SERVER_TIMEOUT_MS;
+    if (!remote_read_line(fd, line, sizeof(line), deadline)) {
+        return;
+    }
+    if (sscanf(line, "EXISTS %255s", key) == 1 && cache_is_key(key)) {
+        response = store->exists(store, key) ? "OK\n" : "MISSING\n";
+    } else if (sscanf(line, "GET %255s", key) == 1 && cache_is_key(key)) {
+        char path[PATH_MAX];
+        struct stat st;
+        dir_entry_path(store, key, path, sizeof(path));
+        const int file_fd = open(path, O_RDONLY | O_CLOEXEC);
+        response = "MISSING\n";
+        if (file_fd != -1 && fstat(file_fd, &st) == 0) {
+            char header[64];
+            snprintf(header, sizeof(header), "OK %lld\n", (long long)st.st_size);
+            if (remote_send(fd, header, strlen(header), deadline)) {
+                remote_copy(file_fd, fd, st.st_size, deadline);
+            }
+            response = nullptr;
+        }
+        if (file_fd != -1) {
+            close(file_fd);
+        }
+    } else if (sscanf(line, "PUT %255s %lld", key, &size) == 2 && cache_is_key(key)) {
+        if (size < 0 || size > REMOTE_MAX_SIZE) {
+            response = "ERROR invalid size\n";
+        } else {
+            response = dir_put(store, key, fd, size) ? "OK\n" : "ERROR could not store the entry\n";
+        }
+    }
+#if DEBUG == 1
+    printf("DBG: remote_serve_request: %s -> %s", line, response != nullptr ? response : "content\n");
+#endif
+    if (response != nullptr) {
+        remote_send(fd, response, strlen(response), deadline);
+    }
+}
+
+void remote_serve(const char *address, const char *dir) {
+    remote_cache store;
+    char store_spec[PATH_MAX + 8];
+    if (dir != nullptr) {
+        snprintf(store_spec, sizeof(store_spec), "dir:%s", dir);
+    } else {
+        snprintf(store_spec, sizeof(store_spec), "dir:%s/remote", cache_get_dir());
+    }
+    remote_open(&store, store_spec, REMOTE_SERVER_TIMEOUT_MS);
+    mkdir_p(store.location, 0755);
+
+    remote_cache listen_on;
+    int fd = -1;
+    if (!remote_open(&listen_on, address, REMOTE_SERVER_TIMEOUT_MS) || strcmp(listen_on.scheme, "dir") == 0) {
+        fprintf(stderr, "remote_serve: invalid address %s, use unix:{path}, tcp:{port} or tcp:{host}:{port}\n",
+                address);
+        exit(EXIT_FAILURE);
+    }
+    if (strcmp(listen_on.scheme, "unix") == 0) {
+        struct sockaddr_un addr = {.sun_family = AF_UNIX};
+        const int len = snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", listen_on.location);
+        if (len < 0 || (size_t)len >= sizeof(addr.sun_path)) {
+            fprintf(stderr, "remote_serve: socket path too long: %s\n", listen_on.location);
+            exit(EXIT_FAILURE);
+        }
+        unlink(addr.sun_path);
+        fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (fd != -1 && bind(fd, (const struct sockaddr*)&addr, sizeof(addr)) != 0) {
+            close(fd);
+            fd = -1;
+        }
+    } else {
+        char host[256];
+        char port[32];
+        struct addrinfo hints = {.ai_family = AF_UNSPEC, .ai_socktype = SOCK_STREAM, .ai_flags = AI_PASSIVE};
+        struct addrinfo *result;
+        if (remote_split_address(listen_on.location, host, sizeof(host), port, sizeof(port))
+            && getaddrinfo(host, port, &hints, &result) == 0) {
+            for (const struct addrinfo *ai = result; ai != nullptr && fd == -1; ai = ai->ai_next) {
+                const int one = 1;
+                fd = socket(ai->ai_family, SOCK_STREAM | SOCK_CLOEXEC, 0);
+                if (fd != -1 && (setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one)) != 0
+                                 || bind(fd, ai->ai_addr, ai->ai_addrlen) != 0)) {
+                    close(fd);
+                    fd = -1;
+                }
+            }
+            freeaddrinfo(result);
+        }
+    }
+    if (fd == -1 || listen(fd, 64) != 0) {
+        fprintf(stderr, "remote_serve: could not listen on %s: %s\n", address, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    printf("cscript: serving the cache entries in %s on %s\n", store.location, address);
+    fflush(stdout);
+    //Every connection gets its own process, a slow client doesn't block the others
+    signal(SIGCHLD, SIG_IGN);
+    signal(SIGPIPE, SIG_IGN);
+    for (;;) {
+        const int client = accept4(fd, nullptr, nullptr, SOCK_CLOEXEC);
+        if (client == -1) {
+            continue;
+        }
+        const pid_t pid = fork();
+        if (pid == 0) {
+            close(fd);
+            remote_serve_request(&store, client);
+            close(client);
+            _exit(EXIT_SUCCESS);
+        }
+        close(client);
+    }
+}
@@ -0,0 +1,105 @@
+/**
+ * @file remote.h
+ * @author Stefan Kleinschmiodt
+ * @date 13. Nov 2024
+ * @brief Contains the remote cache related functions for cscript.
+ *
+ * A remote cache shares the cache entries of several hosts, e.g. of the
+ * ephemeral runners of a CI fleet, by their keys. It is selected by
+ * CSCRIPT_REMOTE_CACHE:
+ * - unix:{path}: a cache server listening on a unix socket,
+ * - tcp:{host}:{port}: a cache server listening on a tcp port,
+ * - dir:{path}: a directory shared by the hosts, e.g. on a network file system.
+ *
+ * The local cache is always searched first. On a miss, the entry is fetched
+ * from the remote cache; an entry compiled locally is uploaded in the
+ * background. Every operation as a whole, from the connect to the last byte,
+ * is bounded by CSCRIPT_REMOTE_TIMEOUT (milliseconds, default 2000).
+ * Entries are transferred as cache packs containing a single entry (see
+ * pack.h), so the toolchain check of the pack import applies to them.
+ *
+ * Trust model: cached executables are run as they are, so everybody who can
+ * write to the remote cache can make every host run code of their choice for
+ * a key that isn't stored yet. Entries are write-once, a PUT for an existing
+ * key is answered with OK and the entry is kept, so stored entries can't be
+ * replaced. Only give trusted hosts access to a remote cache, e.g. by the
+ * permissions of the unix socket or directory or a private network.
+ *
+ * Protocol of a cache server, one request per connection, all lines are
+ * terminated by a line break:
+ * @code
+ * EXISTS {key}       -> OK | MISSING
+ * GET {key}          -> OK {size} followed by {size} bytes | MISSING
+ * PUT {key} {size}   followed by {size} bytes -> OK (also if the key exists) | ERROR {message}
+ * @endcode
+ */
+#pragma once
+
+#include <linux/limits.h>
+
+#include "script_file.h"
+
+/**
+ * @brief The result of fetching an entry from a remote cache.
+ */
+typedef enum {
+    REMOTE_FOUND, /**< The entry has been fetched. */
+    REMOTE_MISSING, /**< The remote cache doesn't have the entry. */
+    REMOTE_FAILED /**< The remote cache failed, errno tells why. */
+} remote_result;
+
+/**
+ * @brief A remote cache: a backend and its location.
+ */
+typedef struct remote_cache {
+    const char *scheme; /**< The scheme of the backend (unix, tcp or dir). */
+    bool (*exists)(const struct remote_cache *rc, const char *key); /**< Checks if an entry exists. */
+    /** Writes the pack of an entry to fd. */
+    remote_result (*get)(const struct remote_cache *rc, const char *key, int fd);
+    /** Stores a pack read from fd. */
+    bool (*put)(const struct remote_cache *rc, const char *key, int fd, long long size);
+    char location[PATH_MAX]; /**< The location of the cache, without the scheme. */
+    int timeout_ms; /**< The time limit of every operation as a whole. */
+} remote_cache;
+
+/**
+ * @brief Returns the remote cache configured by CSCRIPT_REMOTE_CACHE
+ *
+ * An invalid configuration terminates cscript.
+ *
+ * @return The remote cache, nullptr if none is configured
+ */
+const remote_cache* remote_cache_get();
+
+/**
+ * @brief Fetches the cache entry of a script file from the remote cache
+ *
+ * A failing remote cache is reported as a warning, the script is compiled
+ * locally then.
+ *
+ * @param handle The handle of the script file, checked with cache_check() before
+ * @return true if the entry is in the local cache now
+ */
+bool remote_fetch(sf_handle handle);
+
+/**
+ * @brief Uploads the cache entry of a script file to the remote cache
+ *
+ * The upload is done by a detached process, so the script doesn't wait for it.
+ * Entries the remote cache already has are not uploaded again.
+ *
+ * @param handle The handle of the script file, updated with cache_update() before
+ */
+void remote_store(sf_handle handle);
+
+/**
+ * @brief Runs a cache server
+ *
+ * A reference implementation of the protocol, e.g. for tests and for small
+ * fleets. The entries are stored as {key}.pack files in @p dir. Every
+ * connection is served by its own process. Doesn't return.
+ *
+ * @param address unix:{path}, tcp:{port} (on the loopback interface) or tcp:{host}:{port}
+ * @param dir The directory of the entries, nullptr for {cache dir}/remote
+ */
+void remote_serve(const char *address, const char *dir);
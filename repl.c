@@ -0,0 +1,435 @@
+/**
+ * @file repl.c
+ * @author Stefan Kleinschmiodt
+ * @date 13. Nov 2024
+ * @brief Contains the implementations of the interactive session related functions for cscript.
+ *
+ * Provides the read-eval-print loop of cscript --cscript-repl.
+ */
+#include "repl.h"
+
+#include <ctype.h>
+#include <dlfcn.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <linux/limits.h>
+
+#include "cache.h"
+#include "pkg.h"
+#include "sha256.h"
+#include "toolchain.h"
+#include "tools.h"
+
+#define REPL_ARGS_SIZE 8192
+#define REPL_FUNCTION "cscript_repl_run"
+#define REPL_PRELUDE "#include <stdio.h>\n#include <stdlib.h>\n#include <string.h>\n"
+
+/**
+ * @brief The state of an interactive session
+ */
+typedef struct repl_session {
+    char cc[PATH_MAX];
+    char gcc_args[REPL_ARGS_SIZE];
+    char dir[PATH_MAX];
+    char errors[PATH_MAX + 32];
+    char *prelude;
+} repl_session;
+
+bool repl_ident_char(const char c) {
+    return isalnum((unsigned char)c) || c == '_';
+}
+
+char* repl_concat(char *buffer, const char *text, const size_t length) {
+    const size_t old_length = buffer != nullptr ? strlen(buffer) : 0;
+    char *result = (char*)realloc(buffer, old_length + length + 1);
+    if (result == nullptr) {
+        fprintf(stderr, "cscript: out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+    memcpy(result + old_length, text, length);
+    result[old_length + length] = '\0';
+    return result;
+}
+
+size_t repl_literal(const char *p) {
+    //Length of a string or character literal or a comment at p
+    if (*p == '"' || *p == '\'') {
+        const char *q = p + 1;
+        while (*q != '\0' && *q != *p && *q != '\n') {
+            q += q[0] == '\\' && q[1] != '\0' ? 2 : 1;
+        }
+        return q - p + (*q == *p ? 1 : 0);
+    }
+    if (p[0] == '/' && p[1] == '/') {
+        return strcspn(p, "\n");
+    }
+    if (p[0] == '/' && p[1] == '*') {
+        const char *end = strstr(p + 2, "*/");
+        return end != nullptr ? (size_t)(end + 2 - p) : strlen(p);
+    }
+    return 0;
+}
+
+bool repl_word(const char *p, const char *word) {
+    const size_t len = strlen(word);
+    return strncmp(p, word, len) == 0 && !repl_ident_char(p[len]);
+}
+
+bool repl_complete(const char *snippet) {
+    //A snippet is complete when all brackets are closed and it ends like a declaration or statement
+    int depth = 0;
+    const char *last = nullptr;
+    for (const char *p = snippet; *p != '\0'; p++) {
+        const size_t len = repl_literal(p);
+        if (len > 0) {
+            if (p[0] == '/' && p[1] == '*' && strstr(p + 2, "*/") == nullptr) {
+                return false;
+            }
+            if (p[0] != '/') {
+                last = p + len - 1;
+            }
+            p += len - 1;
+            continue;
+        }
+        if (strchr("([{", *p) != nullptr) {
+            depth++;
+        } else if (strchr(")]}", *p) != nullptr) {
+            depth--;
+        }
+        if (!isspace((unsigned char)*p)) {
+            last = p;
+        }
+    }
+    if (depth > 0 || last == nullptr) {
+        return false;
+    }
+    const char *start = snippet + strspn(snippet, " \t\r\n");
+    if (*start == '#') {
+        return *last != '\\';
+    }
+    if (*last == '}') {
+        //Type definitions still need their semicolon
+        return !repl_word(start, "struct") && !repl_word(start, "union") && !repl_word(start, "enum")
+               && !repl_word(start, "typedef");
+    }
+    return *last == ';';
+}
+
+bool repl_is_statement(const char *snippet) {
+    static const char *statements[] = {
+        "if", "for", "while", "do", "switch", "return", "break", "continue", "goto", "case", "default", nullptr
+    };
+    static const char *declarations[] = {
+        "void", "char", "short", "int", "long", "float", "double", "signed", "unsigned", "_Bool", "bool", "const",
+        "volatile", "static", "extern", "register", "typedef", "struct", "union", "enum", "inline", "auto",
+        "restrict", "_Atomic", "_Thread_local", "thread_local", "_Noreturn", "_Alignas", "alignas", "__attribute__",
+        "_Static_assert", "static_assert", "__extension__", nullptr
+    };
+    const char *p = snippet;
+    if (*p == '#') {
+        return false;
+    }
+    for (int i = 0; statements[i] != nullptr; i++) {
+        if (repl_word(p, statements[i])) {
+            return true;
+        }
+    }
+    for (int i = 0; declarations[i] != nullptr; i++) {
+        if (repl_word(p, declarations[i])) {
+            return false;
+        }
+    }
+    if (!repl_ident_char(*p) || (*p >= '0' && *p <= '9')) {
+        return true;
+    }
+    //A type name followed by a name or a pointer declarator, e.g. "FILE *fp = ..."
+    while (repl_ident_char(*p)) {
+        p++;
+    }
+    while (isspace((unsigned char)*p)) {
+        p++;
+    }
+    return !repl_ident_char(*p) && *p != '*';
+}
+
+bool repl_is_assignment(const char *p, const char *start) {
+    return *p == '=' && p[1] != '=' && (p == start || strchr("=!<>+-*/%&|^", p[-1]) == nullptr);
+}
+
+char* repl_declaration(char *prelude, const char *snippet) {
+    //Adds the declaration of the entities defined by the snippet to the prelude
+    if (*snippet == '#' || repl_word(snippet, "typedef") || repl_word(snippet, "_Static_assert")
+        || repl_word(snippet, "static_assert")) {
+        prelude = repl_concat(prelude, snippet, strlen(snippet));
+        return repl_concat(prelude, "\n", 1);
+    }
+    const char *brace = nullptr;
+    const char *paren = nullptr;
+    const char *tail = snippet;
+    const char *assignment = nullptr;
+    int depth = 0;
+    for (const char *p = snippet; *p != '\0'; p++) {
+        const size_t len = repl_literal(p);
+        if (len > 0) {
+            p += len - 1;
+        } else if (strchr("([{", *p) != nullptr) {
+            if (depth == 0 && *p == '(' && paren == nullptr) {
+                paren = p;
+            }
+            if (depth == 0 && *p == '{' && brace == nullptr) {
+                brace = p;
+            }
+            depth++;
+        } else if (strchr(")]}", *p) != nullptr) {
+            if (--depth == 0 && *p == '}' && tail == snippet) {
+                tail = p + 1;
+            }
+        } else if (depth == 0 && assignment == nullptr && repl_is_assignment(p, snippet)) {
+            assignment = p;
+        }
+    }
+    if (repl_word(snippet, "struct") || repl_word(snippet, "union") || repl_word(snippet, "enum")) {
+        //A type definition without a variable, or a forward declaration
+        if (brace == nullptr) {
+            tail = snippet + strcspn(snippet, " \t\r\n");
+            tail += strspn(tail, " \t\r\n");
+            while (repl_ident_char(*tail)) {
+                tail++;
+            }
+        }
+        if ((assignment == nullptr || (brace != nullptr && brace < assignment))
+            && strspn(tail, " \t\r\n;") == strlen(tail)) {
+            prelude = repl_concat(prelude, snippet, strlen(snippet));
+            return repl_concat(prelude, "\n", 1);
+        }
+    } else if (brace != nullptr && paren != nullptr && paren < brace) {
+        //A function definition, its prototype is enough
+        size_t len = brace - snippet;
+        while (len > 0 && isspace((unsigned char)snippet[len - 1])) {
+            len--;
+        }
+        prelude = repl_concat(prelude, snippet, len);
+        return repl_concat(prelude, ";\n", 2);
+    }
+    //Variables become extern declarations without their initializers
+    prelude = repl_concat(prelude, "extern ", 7);
+    depth = 0;
+    const char *p = snippet;
+    const char *copied = snippet;
+    while (*p != '\0') {
+        const size_t len = repl_literal(p);
+        if (len > 0) {
+            p += len;
+            continue;
+        }
+        if (depth == 0 && repl_is_assignment(p, snippet)) {
+            prelude = repl_concat(prelude, copied, p - copied);
+            while (*p != '\0' && !(depth == 0 && (*p == ',' || *p == ';'))) {
+                const size_t skip = repl_literal(p);
+                if (skip > 0) {
+                    p += skip;
+                    continue;
+                }
+                depth += strchr("([{", *p) != nullptr ? 1 : strchr(")]}", *p) != nullptr ? -1 : 0;
+                p++;
+            }
+            copied = p;
+            continue;
+        }
+        depth += strchr("([{", *p) != nullptr ? 1 : strchr(")]}", *p) != nullptr ? -1 : 0;
+        p++;
+    }
+    prelude = repl_concat(prelude, copied, p - copied);
+    return repl_concat(prelude, "\n", 1);
+}
+
+char* repl_source(const repl_session *session, const char *snippet, const bool statement) {
+    char *source = repl_concat(nullptr, session->prelude, strlen(session->prelude));
+    if (statement) {
+        const char header[] = "void " REPL_FUNCTION "(void) {\n";
+        source = repl_concat(source, header, sizeof(header) - 1);
+    }
+    source = repl_concat(source, "#line 1 \"repl\"\n", 15);
+    source = repl_concat(source, snippet, strlen(snippet));
+    return statement ? repl_concat(source, "\n}\n", 3) : repl_concat(source, "\n", 1);
+}
+
+void repl_library_path(const repl_session *session, const char *source, char *path, const size_t size) {
+    //The shared object depends on the code, the arguments and the compiler
+    char *id_source = (char*)malloc(strlen(source) + strlen(session->gcc_args) + 512);
+    sprintf(id_source, "%s\n%s\n%s", toolchain_id(session->cc), session->gcc_args, source);
+    snprintf(path, size, "%s/%s.so", session->dir, sha256_string(id_source));
+    free(id_source);
+}
+
+bool repl_compile(const repl_session *session, const char *source, const char *library) {
+    char source_path[PATH_MAX + 32];
+    char tmp_library[PATH_MAX + 32];
+    snprintf(source_path, sizeof(source_path), "%s.%d.c", library, getpid());
+    snprintf(tmp_library, sizeof(tmp_library), "%s.%d", library, getpid());
+    FILE *fp = fopen(source_path, "w");
+    if (fp == nullptr) {
+        fprintf(stderr, "cscript: could not write %s\n", source_path);
+        return false;
+    }
+    fputs(source, fp);
+    fclose(fp);
+    //Implicit declarations would silently turn statements into declarations
+    char gcc_line[REPL_ARGS_SIZE + 5 * PATH_MAX + 128];
+    snprintf(gcc_line, sizeof(gcc_line), "%s -fPIC -shared -Werror=implicit-int -Werror=implicit-function-declaration "
+             "-o %s %s %s 2> %s", session->cc, tmp_library, source_path, session->gcc_args, session->errors);
+#if DEBUG == 1
+    printf("GCC: %s\n", gcc_line);
+#endif
+    const bool result = system(gcc_line) == 0 && rename(tmp_library, library) == 0;
+    unlink(source_path);
+    unlink(tmp_library);
+    return result;
+}
+
+void repl_print_errors(const char *path) {
+    FILE *fp = fopen(path, "r");
+    if (fp == nullptr) {
+        return;
+    }
+    char *errors = read_stream(fp, nullptr);
+    fclose(fp);
+    if (errors != nullptr) {
+        fputs(errors, stderr);
+        free(errors);
+    }
+}
+
+void repl_eval(repl_session *session, char *snippet) {
+    //Dropping static makes definitions visible to the following snippets
+    while (repl_word(snippet, "static") || repl_word(snippet, "inline")) {
+        snippet += strcspn(snippet, " \t\r\n");
+        snippet += strspn(snippet, " \t\r\n");
+    }
+    //The guessed kind comes first, the other one is tried if it doesn't compile
+    const bool guess = repl_is_statement(snippet);
+    const bool kinds[2] = { guess, !guess };
+    char *sources[2];
+    char libraries[2][PATH_MAX + 80];
+    int found = -1;
+    for (int i = 0; i < 2; i++) {
+        sources[i] = repl_source(session, snippet, kinds[i]);
+        repl_library_path(session, sources[i], libraries[i], sizeof(libraries[i]));
+        if (found < 0 && file_exists(libraries[i])) {
+            cache_mark_used(libraries[i]);
+            found = i;
+        }
+    }
+    char first_errors[sizeof(session->errors) + 8];
+    snprintf(first_errors, sizeof(first_errors), "%s.first", session->errors);
+    for (int i = 0; found < 0 && i < 2; i++) {
+        if (repl_compile(session, sources[i], libraries[i])) {
+            found = i;
+        } else if (i == 0) {
+            rename(session->errors, first_errors);
+        }
+    }
+    free(sources[0]);
+    free(sources[1]);
+    if (found < 0) {
+        repl_print_errors(first_errors);
+        unlink(first_errors);
+        return;
+    }
+    unlink(first_errors);
+    void *handle = dlopen(libraries[found], RTLD_NOW | (kinds[found] ? RTLD_LOCAL : RTLD_GLOBAL));
+    if (handle == nullptr) {
+        fprintf(stderr, "cscript: %s\n", dlerror());
+        return;
+    }
+    if (kinds[found]) {
+        void (*run)(void) = (void (*)(void))dlsym(handle, REPL_FUNCTION);
+        if (run != nullptr) {
+            run();
+        }
+        fflush(stdout);
+    } else {
+        session->prelude = repl_declaration(session->prelude, snippet);
+    }
+}
+
+bool repl_command(repl_session *session, char *line) {
+    //Handles the lines that are no c code, returns false to end the session
+    line[strcspn(line, "\r\n")] = '\0';
+    if (strncmp(line, "#gcc", 4) == 0 && isspace((unsigned char)line[4])) {
+        snprintf(session->gcc_args + strlen(session->gcc_args), sizeof(session->gcc_args) - strlen(session->gcc_args),
+                 " %s", line + 5);
+    } else if (strncmp(line, "#pkg", 4) == 0 && isspace((unsigned char)line[4])) {
+        char identity[SHA256_HASH_LENGTH * 2 + 1];
+        const char *flags = pkg_resolve(line + 5 + strspn(line + 5, " \t"), identity, sizeof(identity));
+        snprintf(session->gcc_args + strlen(session->gcc_args), sizeof(session->gcc_args) - strlen(session->gcc_args),
+                 " %s", flags);
+    } else if (strcmp(line, ":prelude") == 0) {
+        fputs(session->prelude, stdout);
+        printf("#gcc%s\n", session->gcc_args);
+    } else if (strcmp(line, ":quit") == 0 || strcmp(line, ":q") == 0) {
+        return false;
+    } else {
+        printf(":prelude shows the declarations so far, :quit ends the session,\n"
+               "#gcc <args> and #pkg <names> add compiler arguments.\n");
+    }
+    return true;
+}
+
+void repl_run(const int argc, char **argv) {
+    repl_session *session = (repl_session*)calloc(1, sizeof(repl_session));
+    for (int i = 0; i < argc; i++) {
+        snprintf(session->gcc_args + strlen(session->gcc_args), sizeof(session->gcc_args) - strlen(session->gcc_args),
+                 " %s", argv[i]);
+    }
+    //Snippets are compiled quickly, so the compiler is selected for a quick build unless optimizations are requested
+    snprintf(session->cc, sizeof(session->cc), "%s",
+             toolchain_select_cc(nullptr, toolchain_is_release(session->gcc_args)));
+    snprintf(session->dir, sizeof(session->dir), "%s/repl", cache_get_dir());
+    mkdir_p(session->dir, 0700);
+    snprintf(session->errors, sizeof(session->errors), "%s/errors.%d", session->dir, getpid());
+    session->prelude = repl_concat(nullptr, REPL_PRELUDE, strlen(REPL_PRELUDE));
+    const bool interactive = isatty(STDIN_FILENO);
+    char *snippet = nullptr;
+    char *line = nullptr;
+    size_t size = 0;
+    bool running = true;
+    while (running) {
+        if (interactive) {
+            fputs(snippet == nullptr ? "c> " : "..> ", stderr);
+        }
+        if (getline(&line, &size, stdin) == -1) {
+            break;
+        }
+        const char *start = line + strspn(line, " \t");
+        if (snippet == nullptr && (*start == ':' || strncmp(start, "#gcc", 4) == 0 || strncmp(start, "#pkg", 4) == 0)) {
+            running = repl_command(session, line + (start - line));
+            continue;
+        }
+        if (snippet == nullptr && *start == '\n') {
+            continue;
+        }
+        snippet = repl_concat(snippet, line, strlen(line));
+        //An empty line ends an incomplete snippet as well
+        if (repl_complete(snippet) || *start == '\n') {
+            char *code = snippet + strspn(snippet, " \t\r\n");
+            size_t len = strlen(code);
+            while (len > 0 && isspace((unsigned char)code[len - 1])) {
+                code[--len] = '\0';
+            }
+            repl_eval(session, code);
+            free(snippet);
+            snippet = nullptr;
+        }
+    }
+    if (snippet != nullptr) {
+        repl_eval(session, snippet + strspn(snippet, " \t\r\n"));
+        free(snippet);
+    }
+    unlink(session->errors);
+    free(line);
+    free(session->prelude);
+    free(session);
+}
@@ -0,0 +1,27 @@
+/**
+ * @file repl.h
+ * @author Stefan Kleinschmiodt
+ * @date 13. Nov 2024
+ * @brief Contains the interactive session related functions for cscript.
+ *
+ * Provides a read-eval-print loop for c code. Each snippet is compiled into a
+ * small shared object that is loaded into the session, so no whole program has
+ * to be compiled and run for every change.
+ */
+#pragma once
+
+/**
+ * @brief Runs an interactive session
+ *
+ * Reads c snippets from stdin. Declarations (functions, variables, types,
+ * preprocessor lines) are compiled into a shared object that is loaded with
+ * RTLD_GLOBAL, so the following snippets can use them. Statements are compiled
+ * into a function that is called right away. The compiled snippets are kept in
+ * the cache directory, keyed by their code, the preceding declarations, the gcc
+ * arguments and the compiler, so replaying a session doesn't compile anything.
+ * @#gcc and @#pkg lines add compiler arguments like in a script file.
+ *
+ * @param argc The number of gcc arguments
+ * @param argv The gcc arguments for all snippets
+ */
+void repl_run(int argc, char **argv);
@@ -0,0 +1,135 @@
+/**
+ * @file runtime.c
+ * @author Stefan Kleinschmiodt
+ * @date 13. Nov 2024
+ * @brief Contains the implementations of the runtime library related functions for cscript.
+ *
+ * Provides the detection and the cached build of the runtime library.
+ */
+#include "runtime.h"
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <linux/limits.h>
+
+#include "cache.h"
+#include "sha256.h"
+#include "toolchain.h"
+#include "tools.h"
+
+#define RUNTIME_HEADER "cscript/rt.h"
+#define RUNTIME_LIBRARY "libcscript_rt.a"
+
+bool runtime_used(const char *source, const size_t size) {
+    //Look for #include <cscript/rt.h> or #include "cscript/rt.h" at the start of a line
+    const char *end = source + size;
+    for (const char *p = source; p < end; p++) {
+        const char *line = p;
+        p = memchr(p, '\n', end - p);
+        if (p == nullptr) {
+            p = end;
+        }
+        while (line < p && isblank((unsigned char)*line)) {
+            line++;
+        }
+        if (line == p || *line != '#') {
+            continue;
+        }
+        line++;
+        while (line < p && isblank((unsigned char)*line)) {
+            line++;
+        }
+        if (p - line < 9 || strncmp(line, "include", 7) != 0) {
+            continue;
+        }
+        line += 7;
+        while (line < p && isblank((unsigned char)*line)) {
+            line++;
+        }
+        const size_t len = strlen(RUNTIME_HEADER);
+        if (p - line > (long)len + 1 && (*line == '<' || *line == '"')
+            && strncmp(line + 1, RUNTIME_HEADER, len) == 0 && (line[len + 1] == '>' || line[len + 1] == '"')) {
+            return true;
+        }
+    }
+    return false;
+}
+
+const char* runtime_dir() {
+    const char *dir = getenv("CSCRIPT_RUNTIME_DIR");
+    return dir != nullptr && strlen(dir) > 0 ? dir : CSCRIPT_RUNTIME_DIR;
+}
+
+const char* runtime_source() {
+    static char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/rt.c", runtime_dir());
+    return path;
+}
+
+const char* runtime_id(const char *cc) {
+    //The identity of the last compiler is kept, a script is built by a single compiler
+    static char id[SHA256_HASH_LENGTH * 2 + 1] = "";
+    static char id_cc[PATH_MAX] = "";
+    if (id[0] != '\0' && strcmp(id_cc, cc) == 0) {
+        return id;
+    }
+    snprintf(id_cc, sizeof(id_cc), "%s", cc);
+    char header[PATH_MAX];
+    snprintf(header, sizeof(header), "%s/%s", runtime_dir(), RUNTIME_HEADER);
+    if (!file_exists(header) || !file_exists(runtime_source())) {
+        snprintf(id, sizeof(id), "missing");
+        return id;
+    }
+    char identity[3 * (SHA256_HASH_LENGTH * 2 + 1) + PATH_MAX + 64];
+    snprintf(identity, sizeof(identity), "%s", sha256_file(header));
+    snprintf(identity + strlen(identity), sizeof(identity) - strlen(identity), ":%s:%s",
+             sha256_file(runtime_source()), toolchain_id(cc));
+    snprintf(id, sizeof(id), "%s", sha256_string(identity));
+#if DEBUG == 1
+    printf("DBG: runtime_id: %s: %s\n", cc, id);
+#endif
+    return id;
+}
+
+const char* runtime_library(const char *cc) {
+    static char library[PATH_MAX];
+    char dir[PATH_MAX];
+    format_path(dir, sizeof(dir), "%s/runtime/%s", cache_get_dir(), runtime_id(cc));
+    format_path(library, sizeof(library), "%s/%s", dir, RUNTIME_LIBRARY);
+    if (file_exists(library)) {
+        cache_mark_used(dir);
+        return library;
+    }
+    if (strcmp(runtime_id(cc), "missing") == 0) {
+        fprintf(stderr, "cscript: runtime library not found in %s, set CSCRIPT_RUNTIME_DIR\n", runtime_dir());
+        exit(EXIT_FAILURE);
+    }
+    //Build in a private directory and move it into place, concurrent builds may race
+    char tmp_dir[PATH_MAX + 16];
+    snprintf(tmp_dir, sizeof(tmp_dir), "%s.%d", dir, getpid());
+    mkdir_p(tmp_dir, cache_dir_mode());
+    //The library is built by the compiler of the script, so it links with the script's objects
+    char cmd[5 * PATH_MAX + 128];
+    snprintf(cmd, sizeof(cmd), "%s -O2 -pthread -I%s -c %s -o %s/rt.o && ar rcs %s/%s %s/rt.o",
+             cc, runtime_dir(), runtime_source(), tmp_dir, tmp_dir, RUNTIME_LIBRARY, tmp_dir);
+#if DEBUG == 1
+    printf("GCC: %s\n", cmd);
+#endif
+    const bool built = system(cmd) == 0;
+    char tmp_file[PATH_MAX + 32];
+    snprintf(tmp_file, sizeof(tmp_file), "%s/rt.o", tmp_dir);
+    unlink(tmp_file);
+    if (!built || rename(tmp_dir, dir) != 0) {
+        snprintf(tmp_file, sizeof(tmp_file), "%s/%s", tmp_dir, RUNTIME_LIBRARY);
+        unlink(tmp_file);
+        rmdir(tmp_dir);
+    }
+    if (!file_exists(library)) {
+        fprintf(stderr, "cscript: could not build the runtime library from %s\n", runtime_source());
+        exit(EXIT_FAILURE);
+    }
+    return library;
+}
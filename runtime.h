@@ -0,0 +1,68 @@
+/**
+ * @file runtime.h
+ * @author Stefan Kleinschmiodt
+ * @date 13. Nov 2024
+ * @brief Contains the runtime library related functions for cscript.
+ *
+ * Scripts including <cscript/rt.h> are linked with the cscript runtime library
+ * (runtime/cscript/rt.h, runtime/rt.c). The library is built once per compiler
+ * and kept as static library in the cache directory.
+ */
+#pragma once
+
+#include <stddef.h>
+
+/**
+ * @brief The directory of the runtime sources if not defined by the build
+ */
+#ifndef CSCRIPT_RUNTIME_DIR
+#define CSCRIPT_RUNTIME_DIR "/usr/local/share/cscript/runtime"
+#endif
+
+/**
+ * @brief Checks if a source includes the runtime library
+ *
+ * @param source The source of the script
+ * @param size The size of the source
+ * @return true if the source includes <cscript/rt.h>
+ */
+bool runtime_used(const char *source, size_t size);
+
+/**
+ * @brief Gets the directory of the runtime sources
+ *
+ * @return CSCRIPT_RUNTIME_DIR from the environment or from the build
+ */
+const char* runtime_dir();
+
+/**
+ * @brief Gets the identity of the runtime library
+ *
+ * The identity covers the runtime sources and the compiler, it is part of the
+ * cache key of scripts using the runtime, so they are rebuilt when the runtime
+ * changes.
+ *
+ * @param cc The compiler of the script
+ * @return The identity, "missing" if the runtime sources can't be found
+ */
+const char* runtime_id(const char *cc);
+
+/**
+ * @brief Gets the runtime library
+ *
+ * Builds the static library into the cache directory, if it hasn't been built
+ * with the current sources and compiler @p cc yet.
+ *
+ * @param cc The compiler of the script
+ * @return The path of the static library
+ */
+const char* runtime_library(const char *cc);
+
+/**
+ * @brief Gets the source of the runtime library
+ *
+ * Used instead of the library where nothing may be written to the cache.
+ *
+ * @return The path of the source file
+ */
+const char* runtime_source();
@@ -0,0 +1,265 @@
+/**
+ * @file rt.h
+ * @author Stefan Kleinschmiodt
+ * @date 13. Nov 2024
+ * @brief The cscript runtime library.
+ *
+ * Scripts including <cscript/rt.h> are linked with the runtime library
+ * automatically. cscript builds the library once per compiler and keeps it
+ * in the cache. It provides:
+ * - an arena allocator for many small allocations freed at once,
+ * - a line and field reader, using mmap for regular files,
+ * - buffered output to stdout,
+ * - a thread pool and a parallel_for.
+ */
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief A string slice, not terminated by '\0'
+ */
+typedef struct rt_str {
+    const char *ptr; /**< The first character. */
+    size_t len; /**< The number of characters. */
+} rt_str;
+
+/**
+ * @brief Creates a slice from a '\0' terminated string
+ */
+rt_str rt_cstr(const char *s);
+
+/**
+ * @brief Compares a slice with a '\0' terminated string
+ */
+bool rt_str_eq(rt_str s, const char *other);
+
+/**
+ * @brief Converts a slice to an integer, 0 if it doesn't start with a number
+ */
+long long rt_str_to_ll(rt_str s);
+
+/**
+ * @brief Converts a slice to a double, 0.0 if it doesn't start with a number
+ */
+double rt_str_to_double(rt_str s);
+
+/**
+ * @brief Splits a slice into fields
+ *
+ * The fields point into @p s. If there are more than @p max fields, the last
+ * field holds the rest of @p s.
+ *
+ * @param s The slice to split, e.g. a line
+ * @param delim The field delimiter
+ * @param fields Receives the fields
+ * @param max The maximum number of fields
+ * @return The number of fields
+ */
+size_t rt_split(rt_str s, char delim, rt_str *fields, size_t max);
+
+/**
+ * @brief Takes the next line from a slice
+ *
+ * Removes the first line from @p data and returns it without its line break
+ * (\n or \r\n). Used to walk the lines of a chunk, see rt_chunks().
+ *
+ * @param data The remaining data, advanced behind the line
+ * @param line Receives the line
+ * @return false if @p data is empty
+ */
+bool rt_next_line(rt_str *data, rt_str *line);
+
+/**
+ * @brief Splits data into chunks of whole lines
+ *
+ * Splits @p data into at most @p count chunks of about the same size, each
+ * ending at a line break, so the chunks can be processed in parallel.
+ *
+ * @param data The data, e.g. from rt_reader_data()
+ * @param count The maximum number of chunks
+ * @param chunks Receives the chunks
+ * @return The number of chunks
+ */
+size_t rt_chunks(rt_str data, size_t count, rt_str *chunks);
+
+/**
+ * @brief An arena, all allocations are freed at once
+ */
+typedef struct rt_arena rt_arena;
+
+/**
+ * @brief Creates an arena
+ *
+ * @param block_size The size of the memory blocks, 0 for 1 MiB
+ * @return The arena, the program exits if there is no memory
+ */
+rt_arena *rt_arena_new(size_t block_size);
+
+/**
+ * @brief Allocates memory in an arena, aligned to 16 bytes
+ *
+ * @return The memory, the program exits if there is no memory
+ */
+void *rt_arena_alloc(rt_arena *arena, size_t size);
+
+/**
+ * @brief Copies a slice into an arena as '\0' terminated string
+ */
+char *rt_arena_strdup(rt_arena *arena, rt_str s);
+
+/**
+ * @brief Frees all allocations of an arena, the arena can be used again
+ */
+void rt_arena_reset(rt_arena *arena);
+
+/**
+ * @brief Frees an arena with all its allocations
+ */
+void rt_arena_free(rt_arena *arena);
+
+/**
+ * @brief A line reader
+ */
+typedef struct rt_reader rt_reader;
+
+/**
+ * @brief Opens a file for reading lines
+ *
+ * Regular files are mapped into memory, pipes and terminals are read through
+ * a large buffer.
+ *
+ * @param path The path of the file, "-" or NULL for stdin
+ * @return The reader, NULL if the file can't be opened (errno is set)
+ */
+rt_reader *rt_reader_open(const char *path);
+
+/**
+ * @brief Reads the next line
+ *
+ * The line is returned without its line break (\n or \r\n). It stays valid
+ * until the next call for buffered input and until rt_reader_close() for
+ * mapped files.
+ *
+ * @param reader The reader
+ * @param line Receives the line
+ * @return false at the end of the input
+ */
+bool rt_reader_line(rt_reader *reader, rt_str *line);
+
+/**
+ * @brief Gets the complete content of a mapped file
+ *
+ * @param reader The reader
+ * @param data Receives the content, valid until rt_reader_close()
+ * @return false if the input is not a mapped file
+ */
+bool rt_reader_data(rt_reader *reader, rt_str *data);
+
+/**
+ * @brief Closes a reader
+ */
+void rt_reader_close(rt_reader *reader);
+
+/**
+ * @brief Writes to the output buffer of stdout
+ *
+ * The rt_print functions collect the output in a large buffer, which is
+ * written when it is full, on rt_flush() and when the program exits.
+ * They must not be mixed with stdio output to stdout without rt_flush() and
+ * must only be used by one thread at a time.
+ */
+void rt_write(const char *data, size_t len);
+
+/**
+ * @brief Prints a slice
+ */
+void rt_print_str(rt_str s);
+
+/**
+ * @brief Prints a '\0' terminated string
+ */
+void rt_print(const char *s);
+
+/**
+ * @brief Prints a character
+ */
+void rt_print_char(char c);
+
+/**
+ * @brief Prints an integer
+ */
+void rt_print_ll(long long value);
+
+/**
+ * @brief Prints a double with a fixed number of decimals
+ */
+void rt_print_double(double value, int decimals);
+
+/**
+ * @brief Prints formatted output, like printf
+ */
+void rt_printf(const char *format, ...) __attribute__((format(printf, 1, 2)));
+
+/**
+ * @brief Writes the output buffer to stdout
+ */
+void rt_flush(void);
+
+/**
+ * @brief Gets the number of threads to use
+ *
+ * @return CSCRIPT_THREADS if set, otherwise the number of online cpus
+ */
+int rt_threads(void);
+
+/**
+ * @brief A thread pool
+ */
+typedef struct rt_pool rt_pool;
+
+/**
+ * @brief Creates a thread pool
+ *
+ * @param threads The number of threads, 0 for rt_threads()
+ * @return The pool, the program exits if the threads can't be started
+ */
+rt_pool *rt_pool_new(int threads);
+
+/**
+ * @brief Runs a task on a thread of the pool
+ */
+void rt_pool_submit(rt_pool *pool, void (*task)(void *arg), void *arg);
+
+/**
+ * @brief Waits until all submitted tasks are finished
+ */
+void rt_pool_wait(rt_pool *pool);
+
+/**
+ * @brief Waits for all tasks and stops the threads of a pool
+ */
+void rt_pool_free(rt_pool *pool);
+
+/**
+ * @brief Runs a loop in parallel
+ *
+ * Calls @p body for consecutive ranges [begin, end) covering [0, count), on
+ * rt_threads() threads including the calling one. Returns when all ranges are
+ * done. Can be nested.
+ *
+ * @param count The number of iterations
+ * @param grain The number of iterations per range, 0 to choose automatically
+ * @param body The loop body
+ * @param arg The argument passed to @p body
+ */
+void rt_parallel_for(size_t count, size_t grain, void (*body)(size_t begin, size_t end, void *arg), void *arg);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,635 @@
+/**
+ * @file rt.c
+ * @author Stefan Kleinschmiodt
+ * @date 13. Nov 2024
+ * @brief Contains the implementation of the cscript runtime library.
+ *
+ * Built by cscript with the compiler of the scripts, so it sticks to plain C11.
+ */
+#define _GNU_SOURCE
+#include "cscript/rt.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define RT_ARENA_BLOCK (1024 * 1024)
+#define RT_READ_BUFFER (1024 * 1024)
+#define RT_OUT_BUFFER (64 * 1024)
+
+void rt_fail(const char *what) {
+    fprintf(stderr, "cscript runtime: %s: %s\n", what, strerror(errno));
+    exit(EXIT_FAILURE);
+}
+
+rt_str rt_cstr(const char *s) {
+    rt_str result = { s, strlen(s) };
+    return result;
+}
+
+bool rt_str_eq(const rt_str s, const char *other) {
+    return strlen(other) == s.len && memcmp(s.ptr, other, s.len) == 0;
+}
+
+long long rt_str_to_ll(const rt_str s) {
+    size_t i = 0;
+    while (i < s.len && (s.ptr[i] == ' ' || s.ptr[i] == '\t')) {
+        i++;
+    }
+    const bool negative = i < s.len && s.ptr[i] == '-';
+    if (i < s.len && (s.ptr[i] == '-' || s.ptr[i] == '+')) {
+        i++;
+    }
+    unsigned long long value = 0;
+    for (; i < s.len && s.ptr[i] >= '0' && s.ptr[i] <= '9'; i++) {
+        value = value * 10 + (unsigned long long)(s.ptr[i] - '0');
+    }
+    return negative ? -(long long)value : (long long)value;
+}
+
+double rt_str_to_double(const rt_str s) {
+    //strtod needs a terminated string, numbers are short
+    char buffer[128];
+    const size_t len = s.len < sizeof(buffer) - 1 ? s.len : sizeof(buffer) - 1;
+    memcpy(buffer, s.ptr, len);
+    buffer[len] = '\0';
+    return strtod(buffer, NULL);
+}
+
+size_t rt_split(const rt_str s, const char delim, rt_str *fields, const size_t max) {
+    size_t count = 0;
+    const char *p = s.ptr;
+    const char *end = s.ptr + s.len;
+    while (count < max) {
+        const char *next = count + 1 < max ? memchr(p, delim, (size_t)(end - p)) : NULL;
+        if (next == NULL) {
+            fields[count].ptr = p;
+            fields[count++].len = (size_t)(end - p);
+            break;
+        }
+        fields[count].ptr = p;
+        fields[count++].len = (size_t)(next - p);
+        p = next + 1;
+    }
+    return count;
+}
+
+bool rt_next_line(rt_str *data, rt_str *line) {
+    if (data->len == 0) {
+        return false;
+    }
+    const char *nl = memchr(data->ptr, '\n', data->len);
+    const size_t len = nl != NULL ? (size_t)(nl - data->ptr) : data->len;
+    line->ptr = data->ptr;
+    line->len = len > 0 && data->ptr[len - 1] == '\r' ? len - 1 : len;
+    const size_t consumed = nl != NULL ? len + 1 : len;
+    data->ptr += consumed;
+    data->len -= consumed;
+    return true;
+}
+
+size_t rt_chunks(const rt_str data, const size_t count, rt_str *chunks) {
+    size_t n = 0;
+    size_t start = 0;
+    const size_t size = count > 0 ? data.len / count + 1 : data.len;
+    while (start < data.len && n < count) {
+        size_t end = n + 1 == count || start + size >= data.len ? data.len : start + size;
+        //Move the end behind the next line break
+        const char *nl = end < data.len ? memchr(data.ptr + end, '\n', data.len - end) : NULL;
+        if (end < data.len) {
+            end = nl != NULL ? (size_t)(nl - data.ptr) + 1 : data.len;
+        }
+        chunks[n].ptr = data.ptr + start;
+        chunks[n++].len = end - start;
+        start = end;
+    }
+    return n;
+}
+
+/**
+ * @brief A memory block of an arena
+ */
+typedef struct rt_block {
+    struct rt_block *next;
+    size_t size;
+    size_t used;
+    _Alignas(16) unsigned char data[];
+} rt_block;
+
+struct rt_arena {
+    rt_block *head;
+    size_t block_size;
+};
+
+rt_block *rt_block_new(const size_t size) {
+    rt_block *block = malloc(sizeof(rt_block) + size);
+    if (block == NULL) {
+        rt_fail("arena");
+    }
+    block->next = NULL;
+    block->size = size;
+    block->used = 0;
+    return block;
+}
+
+rt_arena *rt_arena_new(const size_t block_size) {
+    rt_arena *arena = malloc(sizeof(rt_arena));
+    if (arena == NULL) {
+        rt_fail("arena");
+    }
+    arena->block_size = block_size > 0 ? block_size : RT_ARENA_BLOCK;
+    arena->head = rt_block_new(arena->block_size);
+    return arena;
+}
+
+void *rt_arena_alloc(rt_arena *arena, const size_t size) {
+    const size_t aligned = (size + 15) & ~(size_t)15;
+    rt_block *block = arena->head;
+    if (block->size - block->used < aligned) {
+        //Large allocations get a block of their own behind the current one
+        if (aligned > arena->block_size / 4) {
+            rt_block *large = rt_block_new(aligned);
+            large->used = aligned;
+            large->next = block->next;
+            block->next = large;
+            return large->data;
+        }
+        block = rt_block_new(arena->block_size);
+        block->next = arena->head;
+        arena->head = block;
+    }
+    void *p = block->data + block->used;
+    block->used += aligned;
+    return p;
+}
+
+char *rt_arena_strdup(rt_arena *arena, const rt_str s) {
+    char *p = rt_arena_alloc(arena, s.len + 1);
+    memcpy(p, s.ptr, s.len);
+    p[s.len] = '\0';
+    return p;
+}
+
+void rt_arena_reset(rt_arena *arena) {
+    //Keep one block of the regular size for the next allocations
+    rt_block *keep = NULL;
+    rt_block *block = arena->head;
+    while (block != NULL) {
+        rt_block *next = block->next;
+        if (keep == NULL && block->size == arena->block_size) {
+            keep = block;
+        } else {
+            free(block);
+        }
+        block = next;
+    }
+    if (keep == NULL) {
+        keep = rt_block_new(arena->block_size);
+    }
+    keep->next = NULL;
+    keep->used = 0;
+    arena->head = keep;
+}
+
+void rt_arena_free(rt_arena *arena) {
+    rt_block *block = arena->head;
+    while (block != NULL) {
+        rt_block *next = block->next;
+        free(block);
+        block = next;
+    }
+    free(arena);
+}
+
+struct rt_reader {
+    int fd;
+    bool mapped;
+    char *data; /**< The mapping or the buffer. */
+    size_t size; /**< The size of the mapping or the capacity of the buffer. */
+    size_t pos; /**< The start of the next line. */
+    size_t end; /**< The end of the valid data in the buffer. */
+    bool eof;
+};
+
+rt_reader *rt_reader_open(const char *path) {
+    const bool std_in = path == NULL || strcmp(path, "-") == 0;
+    const int fd = std_in ? STDIN_FILENO : open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        return NULL;
+    }
+    rt_reader *reader = calloc(1, sizeof(rt_reader));
+    if (reader == NULL) {
+        rt_fail("reader");
+    }
+    reader->fd = fd;
+    struct stat st;
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+        void *p = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (p != MAP_FAILED) {
+            madvise(p, (size_t)st.st_size, MADV_SEQUENTIAL);
+            madvise(p, (size_t)st.st_size, MADV_WILLNEED);
+            reader->mapped = true;
+            reader->data = p;
+            reader->size = reader->end = (size_t)st.st_size;
+            return reader;
+        }
+    }
+    reader->size = RT_READ_BUFFER;
+    reader->data = malloc(reader->size);
+    if (reader->data == NULL) {
+        rt_fail("reader");
+    }
+    return reader;
+}
+
+bool rt_reader_fill(rt_reader *reader) {
+    //Move the incomplete line to the front and read more, the buffer grows for long lines
+    if (reader->pos > 0) {
+        memmove(reader->data, reader->data + reader->pos, reader->end - reader->pos);
+        reader->end -= reader->pos;
+        reader->pos = 0;
+    }
+    if (reader->end == reader->size) {
+        reader->size *= 2;
+        reader->data = realloc(reader->data, reader->size);
+        if (reader->data == NULL) {
+            rt_fail("reader");
+        }
+    }
+    ssize_t n;
+    while ((n = read(reader->fd, reader->data + reader->end, reader->size - reader->end)) == -1 && errno == EINTR) {
+    }
+    if (n <= 0) {
+        reader->eof = true;
+        return false;
+    }
+    reader->end += (size_t)n;
+    return true;
+}
+
+bool rt_reader_line(rt_reader *reader, rt_str *line) {
+    for (;;) {
+        const char *start = reader->data + reader->pos;
+        const char *nl = memchr(start, '\n', reader->end - reader->pos);
+        if (nl != NULL || (reader->eof || reader->mapped)) {
+            rt_str rest = { start, reader->end - reader->pos };
+            if (!rt_next_line(&rest, line)) {
+                return false;
+            }
+            reader->pos = reader->end - rest.len;
+            return true;
+        }
+        rt_reader_fill(reader);
+    }
+}
+
+bool rt_reader_data(rt_reader *reader, rt_str *data) {
+    if (!reader->mapped) {
+        return false;
+    }
+    data->ptr = reader->data;
+    data->len = reader->size;
+    return true;
+}
+
+void rt_reader_close(rt_reader *reader) {
+    if (reader->mapped) {
+        munmap(reader->data, reader->size);
+    } else {
+        free(reader->data);
+    }
+    if (reader->fd != STDIN_FILENO) {
+        close(reader->fd);
+    }
+    free(reader);
+}
+
+static char rt_out[RT_OUT_BUFFER];
+static size_t rt_out_len = 0;
+static bool rt_out_registered = false;
+
+void rt_write_all(const char *data, const size_t len) {
+    size_t done = 0;
+    while (done < len) {
+        const ssize_t n = write(STDOUT_FILENO, data + done, len - done);
+        if (n == -1 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            break;
+        }
+        done += (size_t)n;
+    }
+}
+
+void rt_flush(void) {
+    rt_write_all(rt_out, rt_out_len);
+    rt_out_len = 0;
+}
+
+void rt_write(const char *data, const size_t len) {
+    if (!rt_out_registered) {
+        rt_out_registered = true;
+        fflush(stdout);
+        atexit(rt_flush);
+    }
+    if (rt_out_len + len > sizeof(rt_out)) {
+        rt_flush();
+        //Large blocks are not copied
+        if (len > sizeof(rt_out)) {
+            rt_write_all(data, len);
+            return;
+        }
+    }
+    memcpy(rt_out + rt_out_len, data, len);
+    rt_out_len += len;
+}
+
+void rt_print_str(const rt_str s) {
+    rt_write(s.ptr, s.len);
+}
+
+void rt_print(const char *s) {
+    rt_write(s, strlen(s));
+}
+
+void rt_print_char(const char c) {
+    rt_write(&c, 1);
+}
+
+void rt_print_ll(const long long value) {
+    char buffer[24];
+    char *p = buffer + sizeof(buffer);
+    unsigned long long v = value < 0 ? 0ULL - (unsigned long long)value : (unsigned long long)value;
+    do {
+        *--p = (char)('0' + v % 10);
+        v /= 10;
+    } while (v > 0);
+    if (value < 0) {
+        *--p = '-';
+    }
+    rt_write(p, (size_t)(buffer + sizeof(buffer) - p));
+}
+
+void rt_print_double(const double value, const int decimals) {
+    char buffer[64];
+    const int n = snprintf(buffer, sizeof(buffer), "%.*f", decimals, value);
+    if (n > 0 && (size_t)n < sizeof(buffer)) {
+        rt_write(buffer, (size_t)n);
+    } else {
+        rt_printf("%.*f", decimals, value);
+    }
+}
+
+void rt_printf(const char *format, ...) {
+    char buffer[1024];
+    va_list args;
+    va_start(args, format);
+    const int n = vsnprintf(buffer, sizeof(buffer), format, args);
+    va_end(args);
+    if (n < 0) {
+        return;
+    }
+    if ((size_t)n < sizeof(buffer)) {
+        rt_write(buffer, (size_t)n);
+        return;
+    }
+    char *large = malloc((size_t)n + 1);
+    if (large == NULL) {
+        rt_fail("printf");
+    }
+    va_start(args, format);
+    vsnprintf(large, (size_t)n + 1, format, args);
+    va_end(args);
+    rt_write(large, (size_t)n);
+    free(large);
+}
+
+int rt_threads(void) {
+    const char *env = getenv("CSCRIPT_THREADS");
+    if (env != NULL && atoi(env) > 0) {
+        return atoi(env);
+    }
+    const long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    return cpus > 0 ? (int)cpus : 1;
+}
+
+/**
+ * @brief A queued task of a thread pool
+ */
+typedef struct rt_task {
+    struct rt_task *next;
+    void (*run)(void *arg);
+    void *arg;
+} rt_task;
+
+struct rt_pool {
+    pthread_mutex_t lock;
+    pthread_cond_t work; /**< Signalled when a task is queued or the pool stops. */
+    pthread_cond_t idle; /**< Signalled when the last task is finished. */
+    rt_task *head;
+    rt_task *tail;
+    size_t pending; /**< Queued and running tasks. */
+    bool stop;
+    int count;
+    pthread_t threads[];
+};
+
+void *rt_pool_worker(void *arg) {
+    rt_pool *pool = arg;
+    pthread_mutex_lock(&pool->lock);
+    for (;;) {
+        while (pool->head == NULL && !pool->stop) {
+            pthread_cond_wait(&pool->work, &pool->lock);
+        }
+        if (pool->head == NULL) {
+            break;
+        }
+        rt_task *task = pool->head;
+        pool->head = task->next;
+        if (pool->head == NULL) {
+            pool->tail = NULL;
+        }
+        pthread_mutex_unlock(&pool->lock);
+        task->run(task->arg);
+        free(task);
+        pthread_mutex_lock(&pool->lock);
+        if (--pool->pending == 0) {
+            pthread_cond_broadcast(&pool->idle);
+        }
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return NULL;
+}
+
+rt_pool *rt_pool_new(int threads) {
+    if (threads <= 0) {
+        threads = rt_threads();
+    }
+    rt_pool *pool = calloc(1, sizeof(rt_pool) + (size_t)threads * sizeof(pthread_t));
+    if (pool == NULL) {
+        rt_fail("pool");
+    }
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->work, NULL);
+    pthread_cond_init(&pool->idle, NULL);
+    for (; pool->count < threads; pool->count++) {
+        errno = pthread_create(&pool->threads[pool->count], NULL, rt_pool_worker, pool);
+        if (errno != 0) {
+            rt_fail("pool");
+        }
+    }
+    return pool;
+}
+
+void rt_pool_submit(rt_pool *pool, void (*task)(void *arg), void *arg) {
+    rt_task *t = malloc(sizeof(rt_task));
+    if (t == NULL) {
+        rt_fail("pool");
+    }
+    t->next = NULL;
+    t->run = task;
+    t->arg = arg;
+    pthread_mutex_lock(&pool->lock);
+    if (pool->tail != NULL) {
+        pool->tail->next = t;
+    } else {
+        pool->head = t;
+    }
+    pool->tail = t;
+    pool->pending++;
+    pthread_cond_signal(&pool->work);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+void rt_pool_wait(rt_pool *pool) {
+    pthread_mutex_lock(&pool->lock);
+    while (pool->pending > 0) {
+        pthread_cond_wait(&pool->idle, &pool->lock);
+    }
+    pthread_mutex_unlock(&pool->lock);
+}
+
+void rt_pool_free(rt_pool *pool) {
+    rt_pool_wait(pool);
+    pthread_mutex_lock(&pool->lock);
+    pool->stop = true;
+    pthread_cond_broadcast(&pool->work);
+    pthread_mutex_unlock(&pool->lock);
+    for (int i = 0; i < pool->count; i++) {
+        pthread_join(pool->threads[i], NULL);
+    }
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->work);
+    pthread_cond_destroy(&pool->idle);
+    free(pool);
+}
+
+/**
+ * @brief A running parallel_for
+ *
+ * The calling thread only waits for the ranges, not for the helper tasks, so
+ * nested loops can't deadlock. The last one leaving frees the job.
+ */
+typedef struct rt_for_job {
+    atomic_size_t next;
+    atomic_size_t done;
+    atomic_int refs;
+    size_t count;
+    size_t grain;
+    void (*body)(size_t begin, size_t end, void *arg);
+    void *arg;
+    pthread_mutex_t lock;
+    pthread_cond_t finished;
+} rt_for_job;
+
+static rt_pool *rt_default_pool = NULL;
+static pthread_once_t rt_default_once = PTHREAD_ONCE_INIT;
+
+void rt_default_pool_init(void) {
+    //The calling thread takes part in every loop
+    const int threads = rt_threads() - 1;
+    if (threads > 0) {
+        rt_default_pool = rt_pool_new(threads);
+    }
+}
+
+void rt_for_release(rt_for_job *job) {
+    if (atomic_fetch_sub(&job->refs, 1) == 1) {
+        pthread_mutex_destroy(&job->lock);
+        pthread_cond_destroy(&job->finished);
+        free(job);
+    }
+}
+
+void rt_for_run(rt_for_job *job) {
+    for (;;) {
+        const size_t begin = atomic_fetch_add(&job->next, job->grain);
+        if (begin >= job->count) {
+            break;
+        }
+        const size_t end = job->count - begin < job->grain ? job->count : begin + job->grain;
+        job->body(begin, end, job->arg);
+        if (atomic_fetch_add(&job->done, end - begin) + (end - begin) == job->count) {
+            pthread_mutex_lock(&job->lock);
+            pthread_cond_broadcast(&job->finished);
+            pthread_mutex_unlock(&job->lock);
+        }
+    }
+}
+
+void rt_for_task(void *arg) {
+    rt_for_run(arg);
+    rt_for_release(arg);
+}
+
+void rt_parallel_for(const size_t count, size_t grain, void (*body)(size_t begin, size_t end, void *arg), void *arg) {
+    if (count == 0) {
+        return;
+    }
+    pthread_once(&rt_default_once, rt_default_pool_init);
+    const size_t helpers = rt_default_pool != NULL ? (size_t)rt_default_pool->count : 0;
+    if (grain == 0) {
+        //About 8 ranges per thread balance uneven ranges
+        grain = count / ((helpers + 1) * 8);
+        grain = grain > 0 ? grain : 1;
+    }
+    if (helpers == 0 || grain >= count) {
+        body(0, count, arg);
+        return;
+    }
+    rt_for_job *job = malloc(sizeof(rt_for_job));
+    if (job == NULL) {
+        rt_fail("parallel_for");
+    }
+    const size_t ranges = (count + grain - 1) / grain;
+    const size_t tasks = ranges - 1 < helpers ? ranges - 1 : helpers;
+    atomic_init(&job->next, 0);
+    atomic_init(&job->done, 0);
+    atomic_init(&job->refs, (int)tasks + 1);
+    job->count = count;
+    job->grain = grain;
+    job->body = body;
+    job->arg = arg;
+    pthread_mutex_init(&job->lock, NULL);
+    pthread_cond_init(&job->finished, NULL);
+    for (size_t i = 0; i < tasks; i++) {
+        rt_pool_submit(rt_default_pool, rt_for_task, job);
+    }
+    rt_for_run(job);
+    pthread_mutex_lock(&job->lock);
+    while (atomic_load(&job->done) < count) {
+        pthread_cond_wait(&job->finished, &job->lock);
+    }
+    pthread_mutex_unlock(&job->lock);
+    rt_for_release(job);
+}
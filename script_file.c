@@ -7,26 +7,103 @@
  * Provides a handle to an internal structure managing the information
  * around a c script as well as function to load, manage and execute.
  */
+#define _GNU_SOURCE
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h>
 #include <string.h>
+#include <unistd.h>
 #include <linux/limits.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
 
 #include "script_file.h"
 #include "script_file_type.h"
 #include "tools.h"
 #include "sha256.h"
+#include "toolchain.h"
+#include "process.h"
+#include "autotune.h"
+#include "normalize.h"
+#include "cpu.h"
+#include "cache.h"
+#include "runtime.h"
+#include "pkg.h"
+#include "module.h"
+#include "embed.h"
+#include "bundle.h"
+#include "remote.h"
 
-sf_handle script_file_open(const char* file_path) {
-    size_t len = 0;
-    char * line = nullptr;
+#define NATIVE_BUILD_LOCK_TIMEOUT 600
 
-    if (file_path == nullptr) {
-        fprintf(stderr, "script_file_open: file_path must not be null/n");
-        exit(EXIT_FAILURE);
+void get_script_dir(const script_file *sf, char *dir, const size_t size) {
+    //Scripts without a path refer to the current directory
+    if (sf->file_path[0] != '<') {
+        const char *path = get_real_path(sf->file_path);
+        const int len = (int)(get_file_name(path) - path) - 1;
+        snprintf(dir, size, "%.*s", len > 0 ? len : 1, path);
+    } else if (getcwd(dir, size) == nullptr) {
+        snprintf(dir, size, ".");
+    }
+}
+
+bool file_prefix_map(const script_file *sf, char *arg, const size_t size) {
+    //The directory of the script is mapped to ".", so __FILE__ doesn't depend on where the script is.
+    //tcc can't map paths, and directories the command line can't carry unquoted aren't mapped.
+    if (arg != nullptr && size > 0) {
+        arg[0] = '\0';
+    }
+    if (sf->file_path[0] == '<') {
+        return true;
+    }
+    char dir[PATH_MAX];
+    get_script_dir(sf, dir, sizeof(dir));
+    if (toolchain_is_tcc(sf->cc) || strcmp(dir, "/") == 0
+        || strspn(dir, "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789_-+.,@%/") != strlen(dir)) {
+        return false;
+    }
+    if (arg != nullptr) {
+        snprintf(arg, size, "-ffile-prefix-map=%s=.", dir);
+    }
+    return true;
+}
+
+void compute_key(script_file *sf) {
+    //The key covers the source, the flags and the toolchain, but not the path of the
+    //script file, so cache entries can be shared between hosts and paths.
+    const char *parts[] = { sf->hash, sf->gcc_args, sf->toolchain, sf->deps };
+    unsigned char bin_hash[SHA256_HASH_LENGTH];
+    sha256_ctx sha;
+    sha256_init(&sha);
+    //Scripts without libraries linked by cscript keep the keys they had before
+    const size_t count = sf->deps[0] != '\0' ? sizeof(parts) / sizeof(parts[0]) : 3;
+    for (size_t i = 0; i < count; i++) {
+        sha256_update(sha, (const uint8_t *) parts[i], strlen(parts[i]) + 1);
+    }
+    //__FILE__ (also used by assert) bakes the path into the executable unless the compiler maps it
+    if (!file_prefix_map(sf, nullptr, 0)) {
+        const char *path = get_real_path(sf->file_path);
+        sha256_update(sha, (const uint8_t *) path, strlen(path) + 1);
     }
+    sha256_final(sha);
+    sha256_hash(sha, bin_hash);
+    sha256_destroy(sha);
+    for (int i = 0; i < SHA256_HASH_LENGTH; i++) {
+        sprintf(sf->key + i * 2, "%02x", bin_hash[i]);
+    }
+    //Executables tuned for the cpu are kept per cpu fingerprint within the cache entry
+    sf->native = cpu_native_args(sf->gcc_args)
+                 || (sf->autotune && cpu_native_args(sf->autotune_variants[0] != '\0'
+                                                     ? sf->autotune_variants : AUTOTUNE_DEFAULT_VARIANTS));
+}
 
+script_file *new_script_file(const char *file_path, const char *file_name) {
     //Create an empty script_file structure
     const auto sf = (script_file*)malloc(sizeof(script_file));
     sf->file_path[0] = '\0';
@@ -35,79 +112,367 @@ sf_handle script_file_open(const char* file_path) {
     sf->executable_path[0] = '\0';
     sf->source_path[0] = '\0';
     sf->hash[0] = '\0';
-    sf->start_line = 1;
+    sf->key[0] = '\0';
+    sf->toolchain[0] = '\0';
+    sf->cc[0] = '\0';
+    sf->ld[0] = '\0';
+    sf->source = nullptr;
+    sf->source_size = 0;
+    sf->start_line = 0;
+    sf->perf = false;
+    sf->autotune = false;
+    sf->autotune_args[0] = '\0';
+    sf->autotune_variants[0] = '\0';
+    sf->tuned_flags[0] = '\0';
+    sf->tune_timings[0] = '\0';
+    sf->entry_path[0] = '\0';
+    sf->bundle_script[0] = '\0';
+    sf->compile_report = env_flag("CSCRIPT_COMPILE_REPORT");
+    sf->pin = false;
+    const char *key_mode = getenv("CSCRIPT_KEY");
+    sf->native = false;
+    sf->native_fallback = false;
+    sf->runtime = false;
+    sf->embed = false;
+    sf->uses[0] = '\0';
+    sf->pkgs[0] = '\0';
+    sf->pkg_flags[0] = '\0';
+    sf->deps[0] = '\0';
+    sf->link_args[0] = '\0';
+    sf->normalized_key = key_mode != nullptr && strcmp(key_mode, "normalized") == 0;
+    sf->compile_ms = 0.0;
+    placement_init(&sf->placement);
 
-    //Put the provided file path into the script_file structure
+    //Put the provided file path and file name into the script_file structure
     strcpy(sf->file_path, file_path);
-    //Extract the file name from the path and put it into the script_file structure
-    strcpy(sf->file_name, get_file_name(file_path));
-    //Create the hash for the path and put it into the script_file structure
-    sprintf(sf->hash, "%s", sha256_file(sf->file_path));
-    //Write the path where the source code will be extracted to
-    sprintf(sf->source_path, "%s/%s.c", get_temp_dir(), sf->file_name);
-
-    //Open the script file
-    FILE *fpScriptFile = fopen(file_path, "r");
-    if (fpScriptFile == nullptr) {
-        fprintf(stderr, "script_file_open: could not open %s/n", file_path);
+    strcpy(sf->file_name, file_name);
+    //Write the path where the source code will be extracted to, unique for concurrent runs
+    format_path(sf->source_path, sizeof(sf->source_path), "%s/%s.%d.c", get_temp_dir(), sf->file_name, getpid());
+    return sf;
+}
+
+void append_args(char *args, const size_t size, const char *more) {
+    if (strlen(args) + strlen(more) + 2 > size) {
+        fprintf(stderr, "script_file_open: arguments too long: %s\n", more);
+        exit(EXIT_FAILURE);
+    }
+    size_t length = strlen(args);
+    if (length > 0 && more[0] != '\0') {
+        args[length++] = ' ';
+    }
+    memcpy(args + length, more, strlen(more) + 1);
+}
+
+void apply_directive(script_file *sf, const char *name, const char *value) {
+#if DEBUG == 1
+    printf("DBG: apply_directive: %s=%s\n", name, value != nullptr ? value : "");
+#endif
+    if (strcmp(name, "autotune") == 0) {
+        sf->autotune = true;
+        snprintf(sf->autotune_args, sizeof(sf->autotune_args), "%s", value != nullptr ? value : "");
+    } else if (strcmp(name, "normalized-key") == 0) {
+        sf->normalized_key = true;
+    } else if (strcmp(name, "compile-report") == 0) {
+        sf->compile_report = true;
+    } else if (strcmp(name, "pin") == 0) {
+        sf->pin = true;
+    } else if (strcmp(name, "autotune-variants") == 0 && value != nullptr) {
+        snprintf(sf->autotune_variants, sizeof(sf->autotune_variants), "%s", value);
+    } else if (!placement_directive(&sf->placement, name, value)) {
+        fprintf(stderr, "cscript: ignoring unknown directive %s in %s\n", name, sf->file_path);
+    }
+}
+
+void parse_directives(script_file *sf, char *directives) {
+    //Directives are separated by whitespace: name, name=value or name="value with spaces"
+    char *p = directives;
+    while (*p != '\0') {
+        while (isspace((unsigned char)*p)) {
+            p++;
+        }
+        if (*p == '\0') {
+            break;
+        }
+        const char *name = p;
+        const char *value = nullptr;
+        while (*p != '\0' && !isspace((unsigned char)*p) && *p != '=') {
+            p++;
+        }
+        if (*p == '=') {
+            *p++ = '\0';
+            if (*p == '"') {
+                value = ++p;
+                while (*p != '\0' && *p != '"') {
+                    p++;
+                }
+            } else {
+                value = p;
+                while (*p != '\0' && !isspace((unsigned char)*p)) {
+                    p++;
+                }
+            }
+        }
+        if (*p != '\0') {
+            *p++ = '\0';
+        }
+        apply_directive(sf, name, value);
+    }
+}
+
+void hash_source(script_file *sf) {
+    //Create the hash for the source and put it into the script_file structure
+    if (!sf->normalized_key) {
+        sprintf(sf->hash, "%s", sha256_data(sf->source, sf->source_size));
+        return;
+    }
+    //The normalized hash is prefixed, so it never matches the hash of a raw source
+    size_t length;
+    char *normalized = normalize_source(sf->source, sf->source_size, &length);
+    sprintf(sf->hash, "n:%s", sha256_data(normalized, length));
+    free(normalized);
+}
+
+void find_module(const script_file *sf, const char *name, char *path, const size_t size) {
+    if (!module_find(name, path, size)) {
+        fprintf(stderr, "cscript: module %s used by %s not found in %s\n", name, sf->file_path,
+                getenv("CSCRIPT_MODULE_PATH") != nullptr ? getenv("CSCRIPT_MODULE_PATH") : MODULE_DEFAULT_PATH);
+        exit(EXIT_FAILURE);
+    }
+}
+
+void select_toolchain(script_file *sf) {
+    //Optimized builds may use another compiler than quick ones
+    const bool release = sf->autotune || toolchain_is_release(sf->gcc_args);
+    snprintf(sf->cc, sizeof(sf->cc), "%s", toolchain_select_cc(sf->cc, release));
+    snprintf(sf->ld, sizeof(sf->ld), "%s", toolchain_select_ld(sf->ld, sf->cc, sf->gcc_args));
+    snprintf(sf->toolchain, sizeof(sf->toolchain), "%s", toolchain_identity(sf->cc, sf->ld));
+    if (sf->compile_report && toolchain_is_tcc(sf->cc)) {
+        fprintf(stderr, "cscript: %s has no compile time report\n", sf->cc);
+        sf->compile_report = false;
+    }
+}
+
+void resolve_deps(script_file *sf) {
+    //The libraries linked by cscript are part of the key, so a changed library rebuilds the script
+    char names[sizeof(sf->uses)];
+    char *save = nullptr;
+    strcpy(names, sf->uses);
+    for (char *name = strtok_r(names, " \t", &save); name != nullptr; name = strtok_r(nullptr, " \t", &save)) {
+        char path[PATH_MAX];
+        char dep[PATH_MAX];
+        find_module(sf, name, path, sizeof(path));
+        snprintf(dep, sizeof(dep), "use:%s:%s", name, module_id(path, sf->cc, sf->gcc_args));
+        append_args(sf->deps, sizeof(sf->deps), dep);
+    }
+    if (runtime_used(sf->source, sf->source_size)) {
+        char dep[128];
+        sf->runtime = true;
+        snprintf(dep, sizeof(dep), "rt:%s", runtime_id(sf->cc));
+        append_args(sf->deps, sizeof(sf->deps), dep);
+    }
+    if (sf->pkgs[0] != '\0') {
+        char dep[128] = "pkg:";
+        snprintf(sf->pkg_flags, sizeof(sf->pkg_flags), "%s", pkg_resolve(sf->pkgs, dep + 4, sizeof(dep) - 4));
+        append_args(sf->deps, sizeof(sf->deps), dep);
+    }
+    //The source is compiled from another directory, so embedded files are looked up in the script directory
+    char dir[PATH_MAX];
+    get_script_dir(sf, dir, sizeof(dir));
+    sf->embed = embed_deps(sf->source, sf->source_size, dir, sf->deps, sizeof(sf->deps));
+}
+
+void prepare_build(script_file *sf, const bool diskless) {
+    //The arguments for the libraries follow the source on the command line
+    sf->link_args[0] = '\0';
+    //Without a cache directory nothing is written, so modules and runtime are compiled along with the script
+    const bool from_source = diskless && !cache_dir_configured();
+    char names[sizeof(sf->uses)];
+    char *save = nullptr;
+    strcpy(names, sf->uses);
+    for (char *name = strtok_r(names, " \t", &save); name != nullptr; name = strtok_r(nullptr, " \t", &save)) {
+        char path[PATH_MAX];
+        char args[2 * PATH_MAX + 32];
+        find_module(sf, name, path, sizeof(path));
+        snprintf(args, sizeof(args), "-I%.*s %s", (int)(get_file_name(path) - path), path,
+                 from_source ? path : module_object(path, sf->cc, sf->gcc_args));
+        append_args(sf->link_args, sizeof(sf->link_args), args);
+    }
+    if (sf->runtime) {
+        char args[2 * PATH_MAX + 32];
+        snprintf(args, sizeof(args), "-I%s %s -pthread", runtime_dir(),
+                 from_source ? runtime_source() : runtime_library(sf->cc));
+        append_args(sf->link_args, sizeof(sf->link_args), args);
+    }
+    char map_arg[PATH_MAX + 32];
+    if (file_prefix_map(sf, map_arg, sizeof(map_arg)) && map_arg[0] != '\0') {
+        append_args(sf->link_args, sizeof(sf->link_args), map_arg);
+    }
+    const char *placement = placement_object(&sf->placement, sf->cc, from_source);
+    if (placement != nullptr) {
+        append_args(sf->link_args, sizeof(sf->link_args), placement);
+    }
+    append_args(sf->link_args, sizeof(sf->link_args), sf->pkg_flags);
+    char ld_args[sizeof(sf->ld) + 16];
+    toolchain_ld_args(sf->ld, ld_args, sizeof(ld_args));
+    append_args(sf->link_args, sizeof(sf->link_args), ld_args);
+    if (sf->embed && toolchain_has_embed(sf->cc)) {
+        char args[PATH_MAX + 16];
+        char dir[PATH_MAX];
+        get_script_dir(sf, dir, sizeof(dir));
+        snprintf(args, sizeof(args), "--embed-dir=%s", dir);
+        append_args(sf->link_args, sizeof(sf->link_args), args);
+    }
+}
+
+void parse_source(script_file *sf, const bool shebang) {
+    size_t len = 0;
+    char * line = nullptr;
+
+    if (sf->source_size == 0) {
+        hash_source(sf);
+        return;
+    }
+    FILE *fpSource = fmemopen(sf->source, sf->source_size, "r");
+    if (fpSource == nullptr) {
+        fprintf(stderr, "script_file_open: could not read %s\n", sf->file_path);
         exit(EXIT_FAILURE);
     }
     //Read the first line and check if it is a shebang line
     alloc_string(&line, 16384);
-    if (getline(&line, &len, fpScriptFile) != -1) {
-        if (strncmp("#!", line, 2) != 0) {
-            fprintf(stderr, "script_file_open: wrong format in line 1:\n%s/n", line);
-            fclose(fpScriptFile);
-            free_string(&line);
-            exit(EXIT_FAILURE);
-        }
+    ssize_t read = getline(&line, &len, fpSource);
+    if (read != -1 && strncmp("#!", line, 2) == 0) {
+        sf->start_line = 1;
+        read = getline(&line, &len, fpSource);
+    } else if (read != -1 && shebang) {
+        fprintf(stderr, "script_file_open: wrong format in line 1:\n%s\n", line);
+        fclose(fpSource);
+        free_string(&line);
+        exit(EXIT_FAILURE);
     }
-    //Read the second line and check if it is a #gcc line
-    if (getline(&line, &len, fpScriptFile) != -1) {
+    //The header lines after the shebang line are #gcc, #use, #pkg and #cc lines and #cscript directives
+    while (read != -1) {
+        line[strcspn(line, "\n")] = '\0';
         if (strncmp("#gcc ", line, 5) == 0) {
-            line[strlen(line) - 1] = '\0';
-            strcpy(sf->gcc_args, line + 5);
-            sf->start_line = 2;
+            append_args(sf->gcc_args, sizeof(sf->gcc_args), line + 5);
+        } else if (strncmp("#use ", line, 5) == 0) {
+            append_args(sf->uses, sizeof(sf->uses), line + 5);
+        } else if (strncmp("#pkg ", line, 5) == 0) {
+            append_args(sf->pkgs, sizeof(sf->pkgs), line + 5);
+        } else if (strncmp("#cc ", line, 4) == 0) {
+            //#cc {compiler} [{linker}], both may be auto
+            char ld[sizeof(sf->ld)] = "";
+            if (sscanf(line + 4, "%4095s %63s", sf->cc, ld) < 1) {
+                fprintf(stderr, "script_file_open: missing compiler in line %d:\n%s\n", sf->start_line + 1, line);
+                exit(EXIT_FAILURE);
+            }
+            strcpy(sf->ld, ld);
+        } else if (strncmp("#cscript ", line, 9) == 0) {
+            parse_directives(sf, line + 9);
+        } else {
+            break;
         }
+        sf->start_line++;
+        read = getline(&line, &len, fpSource);
     }
-    fclose(fpScriptFile);
+    fclose(fpSource);
     free_string(&line);
+    //The directives decide how the source is hashed
+    hash_source(sf);
+}
+
+sf_handle script_file_open(const char* file_path) {
+    if (file_path == nullptr) {
+        fprintf(stderr, "script_file_open: file_path must not be null/n");
+        exit(EXIT_FAILURE);
+    }
+    script_file *sf = new_script_file(file_path, get_file_name(file_path));
+
+    //Load the script file, it is only read once
+    FILE *fpScriptFile = fopen(file_path, "r");
+    if (fpScriptFile == nullptr) {
+        fprintf(stderr, "script_file_open: could not open %s\n", file_path);
+        exit(EXIT_FAILURE);
+    }
+    sf->source = read_stream(fpScriptFile, &sf->source_size);
+    fclose(fpScriptFile);
+    if (sf->source == nullptr) {
+        fprintf(stderr, "script_file_open: could not read %s\n", file_path);
+        exit(EXIT_FAILURE);
+    }
+    parse_source(sf, true);
+
+    select_toolchain(sf);
+    resolve_deps(sf);
+    compute_key(sf);
+
+    return sf;
+}
+
+sf_handle script_file_open_source(const char* name, const char* source, const char* gcc_args) {
+    if (name == nullptr || source == nullptr) {
+        fprintf(stderr, "script_file_open_source: name and source must not be null\n");
+        exit(EXIT_FAILURE);
+    }
+    //There is no path, so the name is used for the diagnostics and the executable
+    char file_path[NAME_MAX + 3];
+    snprintf(file_path, sizeof(file_path), "<%s>", name);
+    script_file *sf = new_script_file(file_path, name);
+    sf->source_size = strlen(source);
+    sf->source = strdup(source);
+    //Shebang and #gcc line are optional
+    parse_source(sf, false);
+    if (gcc_args != nullptr && strlen(gcc_args) > 0) {
+        append_args(sf->gcc_args, sizeof(sf->gcc_args), gcc_args);
+    }
+
+    select_toolchain(sf);
+    resolve_deps(sf);
+    compute_key(sf);
 
     return sf;
 }
 
+void script_file_close(sf_handle handle) {
+    const auto sf = (script_file*)handle;
+    if (sf == nullptr) {
+        return;
+    }
+    free(sf->source);
+    free(sf);
+}
+
+void write_code(const script_file *sf, FILE *fpCFile) {
+    //Keep the diagnostics pointing to the lines of the script file
+    fprintf(fpCFile, "#line %d \"%s\"\n", sf->start_line + 1,
+            sf->file_path[0] == '<' ? sf->file_path : get_real_path(sf->file_path));
+    //Write all lines from the script file(except shebang and #gcc) into
+    //the source file.
+    const char *p = sf->source;
+    for (int l = 0; l < sf->start_line && p != nullptr; l++) {
+        p = strchr(p, '\n');
+        if (p != nullptr) {
+            p++;
+        }
+    }
+    if (p != nullptr) {
+        fwrite(p, 1, sf->source_size - (p - sf->source), fpCFile);
+    }
+}
+
 void extract_code(sf_handle handle) {
     const auto sf = (script_file*)handle;
     if (sf == nullptr) {
         fprintf(stderr, "extract_code: handle must not be null/n");
         exit(EXIT_FAILURE);
     }
-    char * line = nullptr;
-    size_t len = 0;
-    //Open the script file for reading
-    FILE *fpScriptFile = fopen(sf->file_path, "r");
-    if (fpScriptFile == nullptr) {
-        fprintf(stderr, "compile: could not open %s/n", sf->file_path);
-        exit(EXIT_FAILURE);
-    }
     //Open the source file for writing
     FILE *fpCFile = fopen(sf->source_path, "w");
     if (fpCFile == nullptr) {
         fprintf(stderr, "compile: could not open %s/n", sf->source_path);
-        fclose(fpScriptFile);
         exit(EXIT_FAILURE);
     }
-    //Write all lines from the script file(except shebang and #gcc) into
-    //the source file.
-    int l = 0;
-    alloc_string(&line, 16384);
-    while (getline(&line, &len, fpScriptFile) != -1) {
-        if (l++ < sf->start_line) continue;
-        fputs(line, fpCFile);
-    }
-    fclose(fpScriptFile);
+    write_code(sf, fpCFile);
     fclose(fpCFile);
-    free_string(&line);
 }
 
 void script_file_set_executable_path(sf_handle handle, const char* path) {
@@ -120,55 +485,351 @@ void script_file_set_executable_path(sf_handle handle, const char* path) {
         fprintf(stderr, "set_executable_path: path must not be null/n");
         exit(EXIT_FAILURE);
     }
-    sprintf(sf->executable_path, "%s/%s.bin", path, sf->file_name);
+    snprintf(sf->entry_path, sizeof(sf->entry_path), "%s", path);
+    if (sf->native) {
+        format_path(sf->executable_path, sizeof(sf->executable_path), "%s/%s.%s.bin", path, sf->file_name,
+                    cpu_fingerprint());
+    } else {
+        format_path(sf->executable_path, sizeof(sf->executable_path), "%s/%s.bin", path, sf->file_name);
+    }
+}
 
+void print_diagnostics(const char *content, const bool all) {
+    //The time reports of gcc run from a "Time variable" header to the TOTAL line, the rest are diagnostics
+    bool in_report = false;
+    for (const char *line = content; *line != '\0'; ) {
+        const char *next = strchr(line, '\n');
+        next = next != nullptr ? next + 1 : line + strlen(line);
+        const bool header = strncmp(line, "Time variable", 13) == 0;
+        const bool blank_before_header = *line == '\n' && strncmp(next, "Time variable", 13) == 0;
+        in_report = in_report || header;
+        if (all || (!in_report && !blank_before_header)) {
+            fwrite(line, 1, next - line, stderr);
+        }
+        if (in_report && strncmp(line, " TOTAL", 6) == 0) {
+            in_report = false;
+        }
+        line = next;
+    }
 }
 
-void script_file_compile(sf_handle handle) {
+void append_report(const script_file *sf, const char *extra_args, const char *report_tmp, const bool success) {
+    FILE *in = fopen(report_tmp, "r");
+    if (in == nullptr) {
+        return;
+    }
+    char *content = read_stream(in, nullptr);
+    fclose(in);
+    unlink(report_tmp);
+    if (content == nullptr) {
+        return;
+    }
+    //The diagnostics have been captured, so they are shown like without a report
+    print_diagnostics(content, !success);
+    char report[PATH_MAX + 32];
+    sprintf(report, "%s/compile-report", sf->entry_path);
+    FILE *out = fopen(report, "a");
+    if (out != nullptr) {
+        fprintf(out, "==== %s %s %s (%s)\n", sf->cc, sf->gcc_args, extra_args, success ? "ok" : "failed");
+        fputs(content, out);
+        fclose(out);
+    }
+    free(content);
+}
+
+bool script_file_compile_variant(sf_handle handle, const char *extra_args, const char *output_path) {
     const auto sf = (script_file*)handle;
-    if (sf == nullptr) {
-        fprintf(stderr, "compile: handle must not be null/n");
+    if (sf == nullptr || extra_args == nullptr || output_path == nullptr) {
+        fprintf(stderr, "compile_variant: handle, extra_args and output_path must not be null\n");
         exit(EXIT_FAILURE);
     }
     extract_code(sf);
-    char gcc_line[PATH_MAX];
+    prepare_build(sf, false);
+    //With a compile report, the diagnostics of the compiler go to a temporary file
+    char report_args[2 * PATH_MAX + 64] = "";
+    char report_tmp[PATH_MAX + 32] = "";
+    if (sf->compile_report) {
+        format_path(report_tmp, sizeof(report_tmp), "%s.report", output_path);
+        if (toolchain_is_clang(sf->cc)) {
+            format_path(report_args, sizeof(report_args), "-ftime-trace=%s/compile-trace.json 2> %s",
+                        sf->entry_path, report_tmp);
+        } else {
+            format_path(report_args, sizeof(report_args), "-ftime-report 2> %s", report_tmp);
+        }
+    }
+    char gcc_line[sizeof(sf->gcc_args) + sizeof(sf->link_args) + sizeof(report_args) + 4 * PATH_MAX + 1024];
     //Create the gcc command line
-    sprintf(gcc_line, "gcc %s -o %s %s", sf->gcc_args, sf->executable_path, sf->source_path);
+    const int length = snprintf(gcc_line, sizeof(gcc_line), "%s %s %s -o %s %s %s %s", sf->cc, sf->gcc_args,
+                                extra_args, output_path, sf->source_path, sf->link_args, report_args);
+    if (length < 0 || (size_t)length >= sizeof(gcc_line)) {
+        fprintf(stderr, "compile: command line too long\n");
+        unlink(sf->source_path);
+        return false;
+    }
 #if DEBUG == 1
     printf("GCC: %s\n", gcc_line);
 #endif
     //Execute the command line
-    if (system(gcc_line) != 0) {
-        //Delete the source file from the temp folder
-        unlink(sf->source_path);
-        fprintf(stderr, "compile: failed compiling %s/n", sf->file_name);
+    const double start = now_ms();
+    const bool result = system(gcc_line) == 0;
+    sf->compile_ms += now_ms() - start;
+    //Delete the source file from the temp folder
+    unlink(sf->source_path);
+    if (sf->compile_report) {
+        append_report(sf, extra_args, report_tmp, result);
+    }
+    return result;
+}
+
+bool script_file_compile_object(sf_handle handle, const char *output_path) {
+    const auto sf = (script_file*)handle;
+    if (sf == nullptr || output_path == nullptr) {
+        fprintf(stderr, "compile_object: handle and output_path must not be null\n");
         exit(EXIT_FAILURE);
     }
-    //Delete the source file from the temp folder
+    extract_code(sf);
+    prepare_build(sf, false);
+    //Only the include paths and defines apply to the object, the rest is used for linking
+    char args[sizeof(sf->gcc_args) + sizeof(sf->link_args) + 1];
+    char compile_args[sizeof(args)];
+    snprintf(args, sizeof(args), "%s %s", sf->gcc_args, sf->link_args);
+    toolchain_compile_args(args, compile_args, sizeof(compile_args));
+    char gcc_line[sizeof(compile_args) + 3 * PATH_MAX + NAME_MAX + 64];
+    snprintf(gcc_line, sizeof(gcc_line), "%s %s -c -o %s %s", sf->cc, compile_args, output_path, sf->source_path);
+#if DEBUG == 1
+    printf("GCC: %s\n", gcc_line);
+#endif
+    const bool result = system(gcc_line) == 0;
     unlink(sf->source_path);
+    return result;
 }
-void script_file_execute(sf_handle handle, int argc, char** argv) {
+
+const char* script_file_link_args(sf_handle handle) {
+    static char args[sizeof(((script_file*)nullptr)->gcc_args) + sizeof(((script_file*)nullptr)->link_args) + 1];
+    const auto sf = (script_file*)handle;
+    if (sf == nullptr) {
+        fprintf(stderr, "link_args: handle must not be null\n");
+        exit(EXIT_FAILURE);
+    }
+    snprintf(args, sizeof(args), "%s %s", sf->gcc_args, sf->link_args);
+    return args;
+}
+
+void script_file_compile(sf_handle handle) {
     const auto sf = (script_file*)handle;
     if (sf == nullptr) {
         fprintf(stderr, "compile: handle must not be null/n");
         exit(EXIT_FAILURE);
     }
-    char binLine[PATH_MAX] = "";
-    //Create the command line
-    strcpy(binLine, sf->executable_path);
-    //Add the arguments to the command line
-    for (int i = 2; i < argc; i++) {
-        strcat(binLine, " ");
-        strcat(binLine, argv[i]);
+    sf->compile_ms = 0.0;
+    if (sf->compile_report) {
+        char report[PATH_MAX + 32];
+        sprintf(report, "%s/compile-report", sf->entry_path);
+        unlink(report);
+    }
+    if (sf->autotune) {
+        autotune_compile(sf);
+        return;
+    }
+    if (!script_file_compile_variant(sf, "", sf->executable_path)) {
+        fprintf(stderr, "compile: failed compiling %s\n", sf->file_name);
+        exit(EXIT_FAILURE);
+    }
+}
+
+void build_native(script_file *sf) {
+    fflush(stdout);
+    fflush(stderr);
+    const pid_t pid = fork();
+    if (pid != 0) {
+        if (pid > 0) {
+            waitpid(pid, nullptr, 0);
+        }
+        return;
+    }
+    //The grandchild is reparented, so the script doesn't wait for it and it doesn't keep pipes open
+    setsid();
+    if (fork() != 0) {
+        _exit(EXIT_SUCCESS);
+    }
+    const int null_fd = open("/dev/null", O_RDWR);
+    dup2(null_fd, STDIN_FILENO);
+    dup2(null_fd, STDOUT_FILENO);
+    dup2(null_fd, STDERR_FILENO);
+    close(null_fd);
+    setpriority(PRIO_PROCESS, 0, 10);
+    script_file_set_executable_path(sf, cache_get_entry_path(sf->key));
+    format_path(sf->source_path, sizeof(sf->source_path), "%s/%s.%d.c", get_temp_dir(), sf->file_name, getpid());
+    //Concurrent runs start a single build, a lock left by a killed build expires
+    char lock[PATH_MAX + 16];
+    struct stat st;
+    snprintf(lock, sizeof(lock), "%s.lock", sf->executable_path);
+    if (stat(lock, &st) == 0 && difftime(time(nullptr), st.st_mtime) > NATIVE_BUILD_LOCK_TIMEOUT) {
+        unlink(lock);
+    }
+    const int lock_fd = open(lock, O_WRONLY | O_CREAT | O_EXCL, 0600);
+    if (lock_fd == -1) {
+        _exit(EXIT_SUCCESS);
+    }
+    close(lock_fd);
+    //Other runs pick the executable up as soon as it exists, so it is moved into place when complete
+    char executable[PATH_MAX];
+    snprintf(executable, sizeof(executable), "%s", sf->executable_path);
+    format_path(sf->executable_path, sizeof(sf->executable_path), "%s.%d", executable, getpid());
+    script_file_compile(sf);
+    if (rename(sf->executable_path, executable) == 0) {
+        snprintf(sf->executable_path, sizeof(sf->executable_path), "%s", executable);
+        cache_update(sf);
+    } else {
+        unlink(sf->executable_path);
+    }
+    unlink(lock);
+    _exit(EXIT_SUCCESS);
+}
+
+void script_file_build(sf_handle handle) {
+    const auto sf = (script_file*)handle;
+    if (sf == nullptr) {
+        fprintf(stderr, "script_file_build: handle must not be null\n");
+        exit(EXIT_FAILURE);
+    }
+    //Check if there is a current build available
+    if (!bundle_select(sf) && !cache_check(sf) && !(remote_fetch(sf) && cache_check(sf))) {
+        //If not, compile the script file
+        script_file_compile(sf);
+        //and update the hash in the cacha
+        cache_update(sf);
+        //and share it with the other hosts
+        remote_store(sf);
+    } else if (sf->native_fallback) {
+        //This run uses the build of another cpu, the build for this cpu is made in the background
+        build_native(sf);
+    }
+}
+
+int script_file_compile_memfd(sf_handle handle) {
+    const auto sf = (script_file*)handle;
+    if (sf == nullptr) {
+        fprintf(stderr, "compile_memfd: handle must not be null\n");
+        exit(EXIT_FAILURE);
+    }
+    //The memfd must survive into gcc and ld, so it is not created with MFD_CLOEXEC
+    const int fd = memfd_create(sf->file_name, MFD_ALLOW_SEALING);
+    if (fd == -1) {
+        fprintf(stderr, "compile_memfd: memfd_create failed: %s\n", strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    prepare_build(sf, true);
+    char gcc_line[sizeof(sf->gcc_args) + sizeof(sf->link_args) + 2 * PATH_MAX];
+    //Create the gcc command line. The source is piped to gcc, -pipe avoids the temporary
+    //assembler file and the remaining intermediate files are moved to /dev/shm if possible.
+    //tcc works in memory anyway and takes - as source from stdin.
+    const bool shm = dir_exists("/dev/shm") && access("/dev/shm", W_OK) == 0;
+    if (toolchain_is_tcc(sf->cc)) {
+        sprintf(gcc_line, "%s %s -o /proc/self/fd/%d - %s", sf->cc, sf->gcc_args, fd, sf->link_args);
+    } else {
+        sprintf(gcc_line, "%s%s %s -pipe -o /proc/self/fd/%d -x c - -x none %s",
+                shm ? "TMPDIR=/dev/shm " : "", sf->cc, sf->gcc_args, fd, sf->link_args);
     }
 #if DEBUG == 1
-    printf("DBG: script_file_execute: binfile %s\n", binLine);
+    printf("GCC: %s\n", gcc_line);
 #endif
-    //Execute the command line
-    if (system(binLine) != 0) {
-        fprintf(stderr, "cscript: failed executing %s/n", binLine);
+    const double start = now_ms();
+    FILE *fpGcc = popen(gcc_line, "w");
+    if (fpGcc == nullptr) {
+        fprintf(stderr, "compile_memfd: could not start gcc for %s\n", sf->file_name);
+        exit(EXIT_FAILURE);
+    }
+    write_code(sf, fpGcc);
+    if (pclose(fpGcc) != 0) {
+        fprintf(stderr, "compile_memfd: failed compiling %s\n", sf->file_name);
+        exit(EXIT_FAILURE);
+    }
+    sf->compile_ms = now_ms() - start;
+    //Seal the image, nobody may modify it between here and the exec
+    if (fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL) != 0) {
+        fprintf(stderr, "compile_memfd: could not seal image of %s: %s\n", sf->file_name, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    return fd;
+}
+
+void script_file_set_perf(sf_handle handle, const bool perf) {
+    const auto sf = (script_file*)handle;
+    if (sf == nullptr) {
+        fprintf(stderr, "set_perf: handle must not be null\n");
         exit(EXIT_FAILURE);
     }
+    sf->perf = perf;
+}
+
+char** script_file_exec_args(sf_handle handle, const int argc, char **argv) {
+    const auto sf = (script_file*)handle;
+    //The script sees its own path as argv[0], followed by its arguments
+    const int extra = sf->bundle_script[0] != '\0' ? 2 : 0;
+    char **args = malloc((argc + extra + 1) * sizeof(char*));
+    args[0] = sf->file_path;
+    if (extra > 0) {
+        //A bundle is told explicitly which of its scripts to run
+        args[1] = BUNDLE_SCRIPT_ARG;
+        args[2] = sf->bundle_script;
+    }
+    for (int i = 1; i < argc; i++) {
+        args[i + extra] = argv[i];
+    }
+    args[argc + extra] = nullptr;
+    return args;
+}
+
+void run_executable(const script_file *sf, const char *path, const int argc, char** argv) {
+    char **args = script_file_exec_args((sf_handle)sf, argc, argv);
+#if DEBUG == 1
+    printf("DBG: run_executable: %s\n", path);
+#endif
+    //The placement is kept across the exec and inherited by the child
+    placement_apply(&sf->placement);
+    if (!sf->perf) {
+        //Nothing to measure, so the script simply replaces cscript
+        fflush(stdout);
+        execv(path, args);
+        fprintf(stderr, "cscript: failed executing %s: %s\n", path, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    const process_options options = { .perf = true, .quiet = false, .cpu = -1 };
+    process_stats stats;
+    process_run(path, args, &options, &stats);
+    const char *log_path = getenv("CSCRIPT_PERF_LOG");
+    if (log_path != nullptr && strlen(log_path) > 0) {
+        process_log_json(log_path, sf->file_path, sf->key, &stats);
+    } else {
+        process_report(stderr, sf->file_name, &stats);
+    }
+    exit(process_exit_code(&stats));
+}
+
+void script_file_execute(sf_handle handle, const int argc, char** argv) {
+    const auto sf = (script_file*)handle;
+    if (sf == nullptr) {
+        fprintf(stderr, "compile: handle must not be null/n");
+        exit(EXIT_FAILURE);
+    }
+    run_executable(sf, sf->executable_path, argc, argv);
+}
+
+void script_file_execute_memfd(sf_handle handle, const int fd, const int argc, char** argv) {
+    const auto sf = (script_file*)handle;
+    if (sf == nullptr) {
+        fprintf(stderr, "execute_memfd: handle must not be null\n");
+        exit(EXIT_FAILURE);
+    }
+#if DEBUG == 1
+    printf("DBG: script_file_execute_memfd: fd %d\n", fd);
+#endif
+    //Do not leak the descriptor into the script, the exec of an ELF image still works
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+    char path[64];
+    sprintf(path, "/proc/self/fd/%d", fd);
+    run_executable(sf, path, argc, argv);
 }
 
 void script_file_dump(sf_handle handle) {
@@ -180,8 +841,12 @@ void script_file_dump(sf_handle handle) {
     printf("    sf->file_path: %s\n", sf->file_path);
     printf("    sf->file_name: %s\n", sf->file_name);
     printf("    sf->hash: %s\n", sf->hash);
+    printf("    sf->key: %s\n", sf->key);
+    printf("    sf->toolchain: %s\n", sf->toolchain);
     printf("    sf->gcc_args: %s\n", sf->gcc_args);
     printf("    sf->source_path: %s\n", sf->source_path);
     printf("    sf->executable_path: %s\n", sf->executable_path);
+    printf("    sf->autotune: %s %s\n", sf->autotune ? "true" : "false", sf->autotune_args);
+    printf("    sf->tuned_flags: %s\n", sf->tuned_flags);
     printf("    sf->start_line: %d\n", sf->start_line);
 }
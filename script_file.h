@@ -23,6 +23,28 @@ typedef const void* sf_handle;
  */
 sf_handle script_file_open(const char* file_path);
 
+/**
+ * @brief Opens a script from a string
+ *
+ * Creates the script file information for c code that doesn't come from a
+ * file, e.g. code given on the command line or read from stdin. The shebang
+ * and the @#gcc line are optional for such scripts. As there is no path, the
+ * cache key only depends on the content and the gcc arguments.
+ * @param name The name of the script, used for diagnostics and the executable
+ * @param source The c code of the script
+ * @param gcc_args Additional command line arguments for gcc, may be nullptr
+ * @return A handle to the script file information
+ */
+sf_handle script_file_open_source(const char* name, const char* source, const char* gcc_args);
+
+/**
+ * @brief Closes a script file
+ *
+ * Frees the script file information and the source it holds.
+ * @param handle A handle to the script file information, may be nullptr
+ */
+void script_file_close(sf_handle handle);
+
 /**
  * @brief Sets the file path for the executable into the structure
  * @param handle A handle to the script file information
@@ -35,17 +57,113 @@ void script_file_set_executable_path(sf_handle handle, const char* path);
  *
  * Compiles the script file according to the information in the file
  * and writes the executable to the path defined in script_file_set_executable_path().
+ * If the script contains the directive @#cscript autotune, the fastest of
+ * several flag variants is selected, see autotune_compile().
+ * If a compile report is requested (CSCRIPT_COMPILE_REPORT=1 or @#cscript compile-report),
+ * the time report of the compiler is stored in the cache entry.
  *
  * @param handle A handle to the script file information
  */
 void script_file_compile(sf_handle handle);
 
+/**
+ * @brief Provides a current build of the script file
+ *
+ * Selects the bundle containing the script, the cache entry or the entry
+ * fetched from the remote cache. Without any, the script is compiled, stored
+ * in the cache and shared with the remote cache. The executable path points
+ * to the build afterwards.
+ *
+ * @param handle A handle to the script file information
+ */
+void script_file_build(sf_handle handle);
+
+/**
+ * @brief Compiles a variant of the script file
+ *
+ * Compiles the script file with additional gcc arguments into @p output_path.
+ * Unlike script_file_compile(), a failing compilation doesn't terminate cscript.
+ *
+ * @param handle A handle to the script file information
+ * @param extra_args Additional gcc arguments, appended to those of the @#gcc line
+ * @param output_path The path of the executable
+ * @return true if the compilation succeeded
+ */
+bool script_file_compile_variant(sf_handle handle, const char *extra_args, const char *output_path);
+
+/**
+ * @brief Compiles the script file into an object
+ *
+ * Compiles the script file without linking into @p output_path. Used to
+ * link several scripts into one executable, see bundle_create().
+ *
+ * @param handle A handle to the script file information
+ * @param output_path The path of the object
+ * @return true if the compilation succeeded
+ */
+bool script_file_compile_object(sf_handle handle, const char *output_path);
+
+/**
+ * @brief Gets the arguments for executing the script file
+ *
+ * The script sees its own path as argv[0], followed by its arguments. A bundle
+ * gets the name of the script to run in front of them.
+ *
+ * @param handle A handle to the script file information
+ * @param argc The number of arguments including argv[0]
+ * @param argv The arguments, argv[0] is replaced
+ * @return The allocated, null terminated arguments
+ */
+char** script_file_exec_args(sf_handle handle, int argc, char **argv);
+
+/**
+ * @brief Gets the arguments for linking the script file
+ *
+ * Returns the arguments of the @#gcc lines followed by those for the modules,
+ * the runtime library and the packages used by the script file.
+ * Only valid after the script file has been compiled.
+ *
+ * @param handle A handle to the script file information
+ * @return The arguments
+ */
+const char* script_file_link_args(sf_handle handle);
+
+/**
+ * @brief Compiles the script file into memory
+ *
+ * Compiles the script file like script_file_compile(), but neither writes
+ * the extracted source nor the executable to the disk. The source is piped
+ * to gcc and the executable is written into an anonymous memory file
+ * (memfd_create), which is sealed against any further modification.
+ *
+ * @param handle A handle to the script file information
+ * @return The file descriptor of the sealed executable image
+ */
+int script_file_compile_memfd(sf_handle handle);
+
+/**
+ * @brief Enables the measurement of the execution
+ *
+ * If enabled, the executable is run as a child process with hardware
+ * performance counters (cycles, instructions, cache misses, branch misses
+ * and task clock) attached before it is executed. The values are reported
+ * on stderr or appended as JSON line to the file named by CSCRIPT_PERF_LOG.
+ * If perf_event_open is not available, the resource usage of the child is used.
+ *
+ * @param handle A handle to the script file information
+ * @param perf true to measure the execution
+ */
+void script_file_set_perf(sf_handle handle, bool perf);
+
 /**
  * @brief Executes the script file
  *
  * Executes the executable compiled from the script file. Provides
- * the arguments argv[2] to argv[argc-1] to the executable (These
- * are the arguments provided to the script on the shell).
+ * the arguments argv[1] to argv[argc-1] to the executable (These
+ * are the arguments provided to the script on the shell, argv[0]
+ * is the script file itself). The executable replaces the cscript
+ * process, unless the execution is measured (see script_file_set_perf()).
+ * Then cscript waits for it and exits with its exit code. Does not return.
  *
  * @param handle A handle to the script file information
  * @param argc The number of arguments provided.
@@ -53,6 +171,19 @@ void script_file_compile(sf_handle handle);
  */
 void script_file_execute(sf_handle handle, int argc, char** argv);
 
+/**
+ * @brief Executes an in-memory executable of the script file
+ *
+ * Executes the executable image referenced by @p fd (see
+ * script_file_compile_memfd()) like script_file_execute(). Does not return.
+ *
+ * @param handle A handle to the script file information
+ * @param fd The file descriptor of the executable image
+ * @param argc The number of arguments provided.
+ * @param argv array of strings containing the arguments.
+ */
+void script_file_execute_memfd(sf_handle handle, int fd, int argc, char** argv);
+
 /**
  * @brief Dumps the script file
  *
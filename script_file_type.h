@@ -8,8 +8,11 @@
  * A pointer to such a structure is used as the sf_handle.
  */
 #pragma once
+#include <stddef.h>
 #include <linux/limits.h>
 
+#include "placement.h"
+
 /**
  * @brief Defines the structure for script information
  *
@@ -20,9 +23,39 @@ typedef struct sf {
     char file_path[PATH_MAX]; /**< The file path to the script file that has been called. */
     char file_name[PATH_MAX]; /**< The file name of the script file that has been called. */
     char hash[256]; /**< The hash (SHA256) of the script file that has been called. */
+    char key[256]; /**< The cache key (SHA256) over everything that determines the executable. */
+    char toolchain[2 * PATH_MAX + 160]; /**< The identity of compiler and linker, see toolchain_identity(). */
+    char cc[PATH_MAX]; /**< The compiler, from the @#cc line, CSCRIPT_CC or the default. */
+    char ld[64]; /**< The linker, from the @#cc line or CSCRIPT_LD, empty for the default. */
     char gcc_args[16284]; /**< The command line arguments for gcc provided in the @#gcc line. */
     char source_path[PATH_MAX]; /**< The path to the temporary source file for compilation. */
     char executable_path[PATH_MAX]; /**<  The path to the compiled executable. */
+    char entry_path[PATH_MAX]; /**<  The path to the cache entry containing the executable. */
+    char bundle_script[NAME_MAX + 1]; /**< The name of the script in the bundle executable, empty if not bundled. */
+
+    char *source; /**< The content of the script file. */
+    size_t source_size; /**< The size of the content of the script file. */
+
+    bool perf; /**< Measure the execution with performance counters. */
+    bool autotune; /**< Select the fastest compiler flags, @#cscript autotune. */
+    char autotune_args[1024]; /**< The representative arguments for autotuning. */
+    char autotune_variants[1024]; /**< The flag variants to try, separated by ';', empty for the defaults. */
+    char tuned_flags[1024]; /**< The flags selected by autotuning. */
+    char tune_timings[4096]; /**< The measured median times of all variants. */
+    char uses[1024]; /**< The modules named in @#use lines. */
+    char pkgs[1024]; /**< The packages named in @#pkg lines. */
+    char pkg_flags[8192]; /**< The compiler and linker flags of the packages. */
+    bool runtime; /**< The script includes <cscript/rt.h> and is linked with the runtime library. */
+    bool embed; /**< The script embeds data files with @#embed, their hashes are part of the deps. */
+    char deps[4096]; /**< The identities of the libraries linked by cscript, part of the key. */
+    char link_args[8192]; /**< The arguments for the libraries linked by cscript, not part of the key. */
+    bool native; /**< The executable is tuned for the cpu (-march=native), one executable per cpu fingerprint. */
+    bool native_fallback; /**< The executable is the compatible build of another cpu, set by cache_check(). */
+    bool normalized_key; /**< Hash the normalized source for the key, @#cscript normalized-key. */
+    bool compile_report; /**< Store the compile time report in the cache entry, @#cscript compile-report. */
+    bool pin; /**< Keep the executable in memory when warming the cache, @#cscript pin. */
+    double compile_ms; /**< The time the last compilation took in ms. */
+    placement placement; /**< Where and how the script runs, set by the placement directives. */
 
-    int start_line; /**<  The first line of the c-source in the script file. */
+    int start_line; /**<  The number of header lines (shebang, @#gcc) before the c-source. */
 } script_file;
@@ -47,7 +47,7 @@ void sha256_init(sha256_ctx *handle) {
         exit(EXIT_FAILURE);
     }
     *ctx = (sha256ctx*)malloc(sizeof(sha256ctx));
-    memset(*ctx, 0, sizeof(sha256_ctx));
+    memset(*ctx, 0, sizeof(sha256ctx));
     memcpy((*ctx)->h, fracSquareRootPrimeTable, sizeof(fracSquareRootPrimeTable));
 }
 
@@ -195,22 +195,43 @@ char *sha256_string(const char *value) {
     return formatHash(bin_hash);
 }
 
+char *sha256_data(const void *data, size_t length) {
+    unsigned char bin_hash[SHA256_HASH_LENGTH];
+    sha256_ctx sha;
+    sha256_init(&sha);
+    //sha256_update takes the length as unsigned, so large buffers are fed in chunks
+    auto p = (const uint8_t *) data;
+    while (length > 0) {
+        const unsigned chunk = length > 0x40000000 ? 0x40000000 : (unsigned) length;
+        sha256_update(sha, p, chunk);
+        p += chunk;
+        length -= chunk;
+    }
+    sha256_final(sha);
+    sha256_hash(sha, bin_hash);
+    sha256_destroy(sha);
+    return formatHash(bin_hash);
+}
 
 char *sha256_file(const char *file_path) {
     unsigned char bin_hash[SHA256_HASH_LENGTH];
-    FILE *fp = fopen(file_path, "r");
-    char *line = nullptr;
-    alloc_string(&line, 16384);
-    size_t len = 0;
+    FILE *fp = fopen(file_path, "rb");
+    if (fp == nullptr) {
+        return nullptr;
+    }
+    //Read in chunks, the file may contain binary data
+    unsigned char *chunk = nullptr;
+    alloc_string((char **) &chunk, 65536);
+    size_t n;
     sha256_ctx sha;
     sha256_init(&sha);
-    while (getline(&line, &len, fp) != -1) {
-        sha256_update(sha, (const unsigned char *) line, strlen(line));
+    while ((n = fread(chunk, 1, 65536, fp)) > 0) {
+        sha256_update(sha, chunk, (unsigned) n);
     }
     sha256_final(sha);
     sha256_hash(sha, bin_hash);
     sha256_destroy(sha);
-    free_string(&line);
+    free(chunk);
+    fclose(fp);
     return formatHash(bin_hash);
 }
-
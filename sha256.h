@@ -10,6 +10,7 @@
 
 #pragma once
 
+#include <stddef.h>
 #include <stdint.h>
 /**
  * @brief The length of a SHA256 hash in bytes
@@ -63,6 +64,15 @@ void sha256_final(sha256_ctx ctx);
   */
 void sha256_hash(const sha256_ctx ctx, uint8_t *hash);
 
+/**
+ * @brief Destroys the hashing context
+ *
+ * Frees the hashing context created by sha256_init().
+ *
+ * @param ctx The hashing context
+ */
+void sha256_destroy(sha256_ctx ctx);
+
 /**
  * @brief Hashes a string
  *
@@ -74,6 +84,18 @@ void sha256_hash(const sha256_ctx ctx, uint8_t *hash);
  */
 char *sha256_string(const char *value);
 
+/**
+ * @brief Hashes a buffer
+ *
+ * Returns the SHA256 hash of the provided buffer
+ * as a hex string.
+ *
+ * @param data The buffer to be hashed
+ * @param length The length of the buffer
+ * @return The hash of the buffer
+ */
+char *sha256_data(const void *data, size_t length);
+
 /**
  * @brief Hashes a file
  *
@@ -81,6 +103,6 @@ char *sha256_string(const char *value);
  * provided filae as a hex string.
  *
  * @param file_path The path of file to be hashed
- * @return The hash of the file contents
+ * @return The hash of the file contents, nullptr if the file can't be read
  */
 char *sha256_file(const char *file_path);
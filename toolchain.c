@@ -0,0 +1,346 @@
+/**
+ * @file toolchain.c
+ * @author Stefan Kleinschmiodt
+ * @date 13. Nov 2024
+ * @brief Contains the implementations of the toolchain related functions for cscript.
+ *
+ * Provides the selection and the identity of the toolchain used to compile scripts.
+ */
+#include "toolchain.h"
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <linux/limits.h>
+#include <sys/stat.h>
+
+#include "cache.h"
+#include "sha256.h"
+#include "tools.h"
+
+#define TOOLCHAIN_MEMO_SIZE 8
+
+const char* resolve_program(const char *name) {
+    //The same few programs are looked up several times per run, so each PATH search is done once
+    static struct {
+        char name[80];
+        char path[PATH_MAX];
+        bool found;
+    } memo[TOOLCHAIN_MEMO_SIZE];
+    static size_t count = 0;
+    if (name == nullptr || strlen(name) == 0 || strlen(name) >= sizeof(memo[0].name)) {
+        return find_program(name);
+    }
+    for (size_t i = 0; i < count; i++) {
+        if (strcmp(memo[i].name, name) == 0) {
+            return memo[i].found ? memo[i].path : nullptr;
+        }
+    }
+    const char *path = find_program(name);
+    const size_t slot = count < TOOLCHAIN_MEMO_SIZE ? count++ : TOOLCHAIN_MEMO_SIZE - 1;
+    snprintf(memo[slot].name, sizeof(memo[slot].name), "%s", name);
+    memo[slot].found = path != nullptr;
+    if (path != nullptr) {
+        snprintf(memo[slot].path, sizeof(memo[slot].path), "%s", path);
+    }
+    return memo[slot].found ? memo[slot].path : nullptr;
+}
+
+bool run_query(const char *path, const char *query, char *target, const size_t size) {
+    char cmd[PATH_MAX + 64];
+    snprintf(cmd, sizeof(cmd), "%s %s 2>/dev/null </dev/null", path, query);
+    FILE *fp = popen(cmd, "r");
+    if (fp == nullptr) {
+        return false;
+    }
+    const size_t n = fread(target, 1, size - 1, fp);
+    target[n] = '\0';
+    target[strcspn(target, "\r\n")] = '\0';
+    return pclose(fp) == 0 && target[0] != '\0';
+}
+
+bool query_version(const char *path, char *target, const size_t size) {
+    //gcc and clang report version and target, tcc, the linkers and pkg-config at least a version line
+    static const char *queries[] = { "-dumpfullversion", "-dumpversion", "--version", "-v" };
+    if (strspn(path, "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789._+-/") != strlen(path)) {
+        return false;
+    }
+    bool found = false;
+    for (size_t i = 0; !found && i < sizeof(queries) / sizeof(queries[0]); i++) {
+        found = run_query(path, queries[i], target, size);
+    }
+    char machine[128];
+    if (found && run_query(path, "-dumpmachine", machine, sizeof(machine))) {
+        snprintf(target + strlen(target), size - strlen(target), " %s", machine);
+    }
+    return found;
+}
+
+const char* toolchain_id(const char *cc) {
+    static struct {
+        char cc[80];
+        char id[PATH_MAX + 256];
+    } memo[TOOLCHAIN_MEMO_SIZE];
+    static size_t count = 0;
+    static char id[PATH_MAX + 256];
+    for (size_t i = 0; i < count; i++) {
+        if (strcmp(memo[i].cc, cc) == 0) {
+            return memo[i].id;
+        }
+    }
+    const char *path = resolve_program(cc);
+    struct stat st;
+    if (path == nullptr || stat(path, &st) != 0) {
+        snprintf(id, sizeof(id), "missing:%s", cc);
+        return id;
+    }
+    //Running the compiler takes a few milliseconds, so its answer is kept until the file changes
+    char signature[128];
+    char version[256];
+    char memo_path[PATH_MAX];
+    snprintf(signature, sizeof(signature), "%lld:%lld.%09ld:%llu:%llu", (long long)st.st_size,
+             (long long)st.st_mtim.tv_sec, st.st_mtim.tv_nsec, (unsigned long long)st.st_ino,
+             (unsigned long long)st.st_dev);
+    memo_path[0] = '\0';
+    const char *cache_dir = cache_get_dir();
+    bool known = false;
+    if (cache_writes_enabled()) {
+        snprintf(memo_path, sizeof(memo_path), "%s/toolchain/%s", cache_dir, sha256_string(path));
+        char value[sizeof(signature)];
+        known = kv_read(memo_path, "stat", value, sizeof(value)) && strcmp(value, signature) == 0
+                && kv_read(memo_path, "version", version, sizeof(version));
+    }
+    if (known) {
+        cache_mark_used(memo_path);
+    } else if (!query_version(path, version, sizeof(version))) {
+        //Without a version the file itself has to identify the program
+        snprintf(version, sizeof(version), "%lld:%lld.%09ld", (long long)st.st_size, (long long)st.st_mtim.tv_sec,
+                 st.st_mtim.tv_nsec);
+    } else if (memo_path[0] != '\0') {
+        char dir[PATH_MAX];
+        snprintf(dir, sizeof(dir), "%s/toolchain", cache_dir);
+        mkdir_p(dir, cache_dir_mode());
+        if (kv_write(memo_path, "version", version) != 0 || kv_write(memo_path, "stat", signature) != 0) {
+            fprintf(stderr, "cscript: could not write %s\n", memo_path);
+        }
+    }
+    snprintf(id, sizeof(id), "%s:%s", path, version);
+#if DEBUG == 1
+    printf("DBG: toolchain_id: %s\n", id);
+#endif
+    if (count < TOOLCHAIN_MEMO_SIZE && strlen(cc) < sizeof(memo[0].cc)) {
+        snprintf(memo[count].cc, sizeof(memo[count].cc), "%s", cc);
+        snprintf(memo[count].id, sizeof(memo[count].id), "%s", id);
+        count++;
+    }
+    return id;
+}
+
+bool toolchain_is_clang(const char *cc) {
+    //gcc and cc may be links to clang, so the resolved path is checked
+    const char *path = resolve_program(cc);
+    return strstr(get_file_name(path != nullptr ? path : cc), "clang") != nullptr;
+}
+
+bool toolchain_is_tcc(const char *cc) {
+    const char *path = resolve_program(cc);
+    return strstr(get_file_name(path != nullptr ? path : cc), "tcc") != nullptr;
+}
+
+bool toolchain_has_embed(const char *cc) {
+    //#embed and --embed-dir came with gcc 15 and clang 19, the identity starts with the path and the version
+    const char *path = resolve_program(cc);
+    const char *id = toolchain_id(cc);
+    if (path == nullptr || toolchain_is_tcc(cc) || strncmp(id, path, strlen(path)) != 0) {
+        return false;
+    }
+    const char *version = id + strlen(path) + 1;
+    if (!isdigit((unsigned char)version[0]) || strchr(version, ':') != nullptr) {
+        return false;
+    }
+    return atoi(version) >= (toolchain_is_clang(cc) ? 19 : 15);
+}
+
+bool has_arg(const char *args, const char *arg) {
+    const size_t len = strlen(arg);
+    for (const char *p = strstr(args, arg); p != nullptr; p = strstr(p + 1, arg)) {
+        if ((p == args || p[-1] == ' ' || p[-1] == '\t') && (p[len] == '\0' || p[len] == ' ' || p[len] == '\t'
+                                                            || p[len] == '=')) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool toolchain_is_release(const char *gcc_args) {
+    return has_arg(gcc_args, "-O2") || has_arg(gcc_args, "-O3") || has_arg(gcc_args, "-Ofast")
+           || has_arg(gcc_args, "-flto");
+}
+
+bool path_signature(const char *path, char *target, const size_t size) {
+    //Installing or removing a program changes the modification time of its directory
+    target[0] = '\0';
+    while (*path != '\0') {
+        const size_t len = strcspn(path, ":");
+        if (len > 0 && len < PATH_MAX) {
+            char dir[PATH_MAX];
+            struct stat st;
+            snprintf(dir, sizeof(dir), "%.*s", (int)len, path);
+            const size_t used = strlen(target);
+            const int n = stat(dir, &st) == 0
+                              ? snprintf(target + used, size - used, "%lld.%09ld:%llu ", (long long)st.st_mtim.tv_sec,
+                                         st.st_mtim.tv_nsec, (unsigned long long)st.st_ino)
+                              : snprintf(target + used, size - used, "- ");
+            if (n < 0 || (size_t)n >= size - used) {
+                return false;
+            }
+        }
+        path += len;
+        path += *path == ':' ? 1 : 0;
+    }
+    return true;
+}
+
+const char* first_installed(const char *candidates, const bool linker) {
+    static char found[64];
+    char list[256];
+    char *save = nullptr;
+    //The auto policy runs on every start, so the choice is kept until a directory of the PATH changes
+    const char *path = getenv("PATH");
+    char signature[2048];
+    char memo[PATH_MAX];
+    memo[0] = '\0';
+    const char *cache_dir = cache_get_dir();
+    if (path != nullptr && cache_writes_enabled() && path_signature(path, signature, sizeof(signature))) {
+        char request[PATH_MAX];
+        snprintf(request, sizeof(request), "%s|%d|%.*s", candidates, linker, PATH_MAX / 2, path);
+        snprintf(memo, sizeof(memo), "%s/toolchain/%s", cache_dir, sha256_string(request));
+        char value[sizeof(signature)];
+        if (kv_read(memo, "dirs", value, sizeof(value)) && strcmp(value, signature) == 0
+            && kv_read(memo, "found", found, sizeof(found))) {
+            cache_mark_used(memo);
+            return strcmp(found, "-") != 0 ? found : nullptr;
+        }
+    }
+    snprintf(found, sizeof(found), "-");
+    snprintf(list, sizeof(list), "%s", candidates);
+    for (char *name = strtok_r(list, " ", &save); name != nullptr; name = strtok_r(nullptr, " ", &save)) {
+        char program[80];
+        snprintf(program, sizeof(program), "%s%s", linker && strcmp(name, "mold") != 0 ? "ld." : "", name);
+        if (resolve_program(program) != nullptr) {
+            snprintf(found, sizeof(found), "%s", name);
+            break;
+        }
+    }
+    if (memo[0] != '\0') {
+        char dir[PATH_MAX];
+        snprintf(dir, sizeof(dir), "%s/toolchain", cache_dir);
+        mkdir_p(dir, cache_dir_mode());
+        if (kv_write(memo, "found", found) != 0 || kv_write(memo, "dirs", signature) != 0) {
+            fprintf(stderr, "cscript: could not write %s\n", memo);
+        }
+    }
+    return strcmp(found, "-") != 0 ? found : nullptr;
+}
+
+const char* toolchain_select_cc(const char *spec, const bool release) {
+    static char cc[PATH_MAX];
+    if (spec == nullptr || strlen(spec) == 0) {
+        spec = getenv("CSCRIPT_CC");
+    }
+    if (spec == nullptr || strlen(spec) == 0) {
+        spec = TOOLCHAIN_DEFAULT_CC;
+    }
+    if (strcmp(spec, "auto") == 0) {
+        spec = first_installed(release ? TOOLCHAIN_RELEASE_CCS : TOOLCHAIN_QUICK_CCS, false);
+        spec = spec != nullptr ? spec : TOOLCHAIN_DEFAULT_CC;
+    }
+    //The name ends up on a command line
+    if (strspn(spec, "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789._+-/") != strlen(spec)
+        || resolve_program(spec) == nullptr) {
+        fprintf(stderr, "cscript: compiler %s not found\n", spec);
+        exit(EXIT_FAILURE);
+    }
+    snprintf(cc, sizeof(cc), "%s", spec);
+#if DEBUG == 1
+    printf("DBG: toolchain_select_cc: %s\n", cc);
+#endif
+    return cc;
+}
+
+const char* toolchain_select_ld(const char *spec, const char *cc, const char *gcc_args) {
+    static char ld[64];
+    if (spec == nullptr || strlen(spec) == 0) {
+        spec = getenv("CSCRIPT_LD");
+    }
+    ld[0] = '\0';
+    if (spec == nullptr || strlen(spec) == 0 || toolchain_is_tcc(cc)) {
+        return ld;
+    }
+    if (strcmp(spec, "auto") == 0) {
+        //Not every linker works with the lto plugin of every compiler, so lto keeps the default
+        spec = has_arg(gcc_args, "-flto") ? nullptr : first_installed(TOOLCHAIN_AUTO_LDS, true);
+    } else if (strcmp(spec, "bfd") != 0 && strcmp(spec, "gold") != 0 && strcmp(spec, "lld") != 0
+               && strcmp(spec, "mold") != 0) {
+        fprintf(stderr, "cscript: unknown linker %s, use bfd, gold, lld, mold or auto\n", spec);
+        exit(EXIT_FAILURE);
+    } else if (first_installed(spec, true) == nullptr) {
+        fprintf(stderr, "cscript: linker %s not found\n", spec);
+        exit(EXIT_FAILURE);
+    }
+    if (spec != nullptr) {
+        snprintf(ld, sizeof(ld), "%s", spec);
+    }
+#if DEBUG == 1
+    printf("DBG: toolchain_select_ld: %s\n", ld);
+#endif
+    return ld;
+}
+
+const char* toolchain_identity(const char *cc, const char *ld) {
+    static char identity[2 * PATH_MAX + 160];
+    snprintf(identity, sizeof(identity), "%s", toolchain_id(cc));
+    if (ld != nullptr && ld[0] != '\0') {
+        char program[80];
+        snprintf(program, sizeof(program), "%s%s", strcmp(ld, "mold") != 0 ? "ld." : "", ld);
+        snprintf(identity + strlen(identity), sizeof(identity) - strlen(identity), " ld=%s", toolchain_id(program));
+    }
+    return identity;
+}
+
+void toolchain_ld_args(const char *ld, char *target, const size_t size) {
+    if (ld == nullptr || ld[0] == '\0') {
+        target[0] = '\0';
+    } else {
+        snprintf(target, size, "-fuse-ld=%s", ld);
+    }
+}
+
+void toolchain_compile_args(const char *gcc_args, char *target, const size_t size) {
+    //Linker arguments and input files of the script don't apply to a module
+    static const char *with_value[] = { "-I", "-D", "-U", "-include", "-isystem", "-iquote", "-idirafter", "-x" };
+    target[0] = '\0';
+    char *copy = strdup(gcc_args);
+    char *save = nullptr;
+    bool keep_next = false;
+    for (char *arg = strtok_r(copy, " \t", &save); arg != nullptr; arg = strtok_r(nullptr, " \t", &save)) {
+        bool keep = keep_next;
+        keep_next = false;
+        if (strcmp(arg, "-l") == 0 || strcmp(arg, "-L") == 0 || strcmp(arg, "-Xlinker") == 0) {
+            strtok_r(nullptr, " \t", &save);
+            continue;
+        }
+        if (!keep && arg[0] == '-' && strncmp(arg, "-l", 2) != 0 && strncmp(arg, "-L", 2) != 0
+            && strncmp(arg, "-Wl,", 4) != 0) {
+            keep = true;
+            for (size_t i = 0; i < sizeof(with_value) / sizeof(with_value[0]); i++) {
+                keep_next |= strcmp(arg, with_value[i]) == 0;
+            }
+        }
+        if (keep) {
+            snprintf(target + strlen(target), size - strlen(target), "%s%s", target[0] != '\0' ? " " : "", arg);
+        }
+    }
+    free(copy);
+}
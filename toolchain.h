@@ -0,0 +1,149 @@
+/**
+ * @file toolchain.h
+ * @author Stefan Kleinschmiodt
+ * @date 13. Nov 2024
+ * @brief Contains the toolchain related functions for cscript.
+ *
+ * Provides the selection and the identity of the toolchain used to compile
+ * scripts. The identity is part of the cache key, so a changed compiler or
+ * linker invalidates the cache entries, and it is used to check if imported
+ * cache entries are compatible.
+ */
+#pragma once
+
+#include <stddef.h>
+
+/**
+ * @brief The compiler used when nothing else has been selected
+ */
+#define TOOLCHAIN_DEFAULT_CC "gcc"
+
+/**
+ * @brief The compilers tried by the auto policy for quick builds, fastest first
+ */
+#define TOOLCHAIN_QUICK_CCS "tcc gcc clang"
+
+/**
+ * @brief The compilers tried by the auto policy for optimized builds, best first
+ */
+#define TOOLCHAIN_RELEASE_CCS "gcc clang"
+
+/**
+ * @brief The linkers tried by the auto policy, fastest first
+ */
+#define TOOLCHAIN_AUTO_LDS "mold lld gold"
+
+/**
+ * @brief Gets the identity of a compiler
+ *
+ * Returns a string identifying the compiler @p cc. The compiler is searched
+ * in the PATH and identified by its canonical path and the version and target
+ * it reports, so the same compiler has the same identity on every host. The
+ * version is remembered in the cache until the file of the compiler changes,
+ * so it is only queried again after an update.
+ * The pointer to the buffer containing the identity will be overwritten
+ * on a subsequent use of this function. Not thread safe!
+ *
+ * @param cc The name or path of the compiler
+ * @return The identity of the compiler, "missing:{cc}" if it can't be found
+ */
+const char* toolchain_id(const char *cc);
+
+/**
+ * @brief Checks if a compiler is clang
+ *
+ * @param cc The name or path of the compiler
+ * @return true if the compiler is clang
+ */
+bool toolchain_is_clang(const char *cc);
+
+/**
+ * @brief Checks if a compiler is tcc
+ *
+ * @param cc The name or path of the compiler
+ * @return true if the compiler is tcc
+ */
+bool toolchain_is_tcc(const char *cc);
+
+/**
+ * @brief Checks if a compiler understands #embed and --embed-dir
+ *
+ * @param cc The name or path of the compiler
+ * @return true for gcc 15 and clang 19 or later
+ */
+bool toolchain_has_embed(const char *cc);
+
+/**
+ * @brief Checks if compiler arguments request an optimized build
+ *
+ * @param gcc_args The compiler arguments
+ * @return true if the arguments contain -O2, -O3, -Ofast or -flto
+ */
+bool toolchain_is_release(const char *gcc_args);
+
+/**
+ * @brief Selects the compiler
+ *
+ * Selects the compiler named by @p spec, or by CSCRIPT_CC if @p spec is
+ * nullptr, or gcc if neither is given. For "auto", the first installed
+ * compiler of TOOLCHAIN_QUICK_CCS is used for quick builds and the first
+ * of TOOLCHAIN_RELEASE_CCS for optimized builds. A compiler that can't be
+ * found terminates cscript.
+ * The pointer to the buffer containing the name will be overwritten
+ * on a subsequent use of this function. Not thread safe!
+ *
+ * @param spec The compiler or "auto", may be nullptr
+ * @param release true for an optimized build
+ * @return The compiler
+ */
+const char* toolchain_select_cc(const char *spec, bool release);
+
+/**
+ * @brief Selects the linker
+ *
+ * Selects the linker (bfd, gold, lld or mold) named by @p spec, or by
+ * CSCRIPT_LD if @p spec is nullptr. For "auto", the first installed linker of
+ * TOOLCHAIN_AUTO_LDS is used, except for -flto builds, which keep the default
+ * linker. tcc always uses its own linker. A linker that can't be found
+ * terminates cscript.
+ *
+ * @param spec The linker or "auto", may be nullptr
+ * @param cc The selected compiler
+ * @param gcc_args The compiler arguments
+ * @return The linker, empty for the default linker of the compiler
+ */
+const char* toolchain_select_ld(const char *spec, const char *cc, const char *gcc_args);
+
+/**
+ * @brief Gets the identity of a compiler and a linker
+ *
+ * Like toolchain_id(), but includes the identity of the linker if one is selected.
+ * The pointer to the buffer containing the identity will be overwritten
+ * on a subsequent use of this function. Not thread safe!
+ *
+ * @param cc The compiler
+ * @param ld The linker, empty for the default linker
+ * @return The identity
+ */
+const char* toolchain_identity(const char *cc, const char *ld);
+
+/**
+ * @brief Gets the compiler argument selecting the linker
+ *
+ * @param ld The linker, empty for the default linker
+ * @param target Receives the argument, e.g. -fuse-ld=mold
+ * @param size The size of @p target
+ */
+void toolchain_ld_args(const char *ld, char *target, size_t size);
+
+/**
+ * @brief Gets the compiler arguments for compiling without linking
+ *
+ * Removes the linker arguments (-l, -L, -Wl,...) and input files from
+ * @p gcc_args, so they can be used with -c.
+ *
+ * @param gcc_args The compiler arguments
+ * @param target Receives the arguments for compiling
+ * @param size The size of @p target
+ */
+void toolchain_compile_args(const char *gcc_args, char *target, size_t size);
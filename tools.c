@@ -10,9 +10,12 @@
 #include "tools.h"
 
 #include <errno.h>
+#include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
+#include <linux/limits.h>
 #include <sys/stat.h>
 #include <uuid/uuid.h>
 
@@ -103,6 +106,174 @@ const char* get_temp_dir() {
     return result;
 }
 
+void format_path(char *target, const size_t size, const char *format, ...) {
+    va_list args;
+    va_start(args, format);
+    const int len = vsnprintf(target, size, format, args);
+    va_end(args);
+    if (len < 0 || (size_t)len >= size) {
+        fprintf(stderr, "cscript: path too long: %s...\n", target);
+        exit(EXIT_FAILURE);
+    }
+}
+
+const char* find_program(const char *name) {
+    static char result[PATH_MAX];
+    if (name == nullptr || strlen(name) == 0) {
+        return nullptr;
+    }
+    if (strchr(name, '/') != nullptr) {
+        if (access(name, X_OK) != 0 || realpath(name, result) == nullptr) {
+            return nullptr;
+        }
+        return result;
+    }
+    const char *path = getenv("PATH");
+    if (path == nullptr) {
+        path = "/usr/local/bin:/usr/bin:/bin";
+    }
+    char candidate[PATH_MAX];
+    while (*path != '\0') {
+        const char *end = strchr(path, ':');
+        const size_t len = end == nullptr ? strlen(path) : (size_t)(end - path);
+        if (len > 0 && len + strlen(name) + 2 < sizeof(candidate)) {
+            sprintf(candidate, "%.*s/%s", (int)len, path, name);
+            if (access(candidate, X_OK) == 0 && realpath(candidate, result) != nullptr) {
+                return result;
+            }
+        }
+        if (end == nullptr) {
+            break;
+        }
+        path = end + 1;
+    }
+    return nullptr;
+}
+
+bool kv_read(const char *path, const char *name, char *value, const size_t size) {
+    FILE *fp = fopen(path, "r");
+    if (fp == nullptr) {
+        return false;
+    }
+    char *line = nullptr;
+    size_t len = 0;
+    const size_t name_len = strlen(name);
+    bool found = false;
+    while (!found && getline(&line, &len, fp) != -1) {
+        if (strncmp(line, name, name_len) == 0 && line[name_len] == '=') {
+            line[strcspn(line, "\n")] = '\0';
+            snprintf(value, size, "%s", line + name_len + 1);
+            found = true;
+        }
+    }
+    free(line);
+    fclose(fp);
+    return found;
+}
+
+int kv_write(const char *path, const char *name, const char *value) {
+    char tmp_path[PATH_MAX + 16];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.%d", path, getpid());
+    FILE *out = fopen(tmp_path, "w");
+    if (out == nullptr) {
+        return -1;
+    }
+    //Copy all other values, then add the new one
+    FILE *in = fopen(path, "r");
+    if (in != nullptr) {
+        char *line = nullptr;
+        size_t len = 0;
+        const size_t name_len = strlen(name);
+        while (getline(&line, &len, in) != -1) {
+            if (strncmp(line, name, name_len) != 0 || line[name_len] != '=') {
+                fputs(line, out);
+            }
+        }
+        free(line);
+        fclose(in);
+    }
+    fprintf(out, "%s=%s\n", name, value);
+    if (fclose(out) != 0 || rename(tmp_path, path) != 0) {
+        unlink(tmp_path);
+        return -1;
+    }
+    return 0;
+}
+
+char* read_stream(FILE *fp, size_t *size) {
+    size_t capacity = 16384;
+    size_t length = 0;
+    char *buffer = malloc(capacity + 1);
+    size_t n;
+    while (buffer != nullptr && (n = fread(buffer + length, 1, capacity - length, fp)) > 0) {
+        length += n;
+        if (length == capacity) {
+            capacity *= 2;
+            char *grown = realloc(buffer, capacity + 1);
+            if (grown == nullptr) {
+                free(buffer);
+            }
+            buffer = grown;
+        }
+    }
+    if (buffer == nullptr || ferror(fp)) {
+        free(buffer);
+        return nullptr;
+    }
+    buffer[length] = '\0';
+    if (size != nullptr) {
+        *size = length;
+    }
+    return buffer;
+}
+
+double now_ms() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1000.0 + (double)ts.tv_nsec / 1000000.0;
+}
+
+bool env_flag(const char *name) {
+    const char *val = getenv(name);
+    return val != nullptr && strlen(val) > 0 && strcmp(val, "0") != 0;
+}
+
+double parse_duration(const char *text) {
+    char *end;
+    const double value = strtod(text, &end);
+    if (end == text || value < 0) {
+        return -1;
+    }
+    double unit;
+    switch (*end) {
+        case 's': unit = 1; break;
+        case 'm': unit = 60; break;
+        case 'h': unit = 3600; break;
+        case '\0':
+        case 'd': unit = 86400; break;
+        case 'w': unit = 7 * 86400; break;
+        default: return -1;
+    }
+    return *end == '\0' || end[1] == '\0' ? value * unit : -1;
+}
+
+double parse_size(const char *text) {
+    char *end;
+    const double value = strtod(text, &end);
+    if (end == text || value < 0) {
+        return -1;
+    }
+    double unit;
+    switch (*end) {
+        case '\0': unit = 1; break;
+        case 'k': case 'K': unit = 1024.0; break;
+        case 'm': case 'M': unit = 1024.0 * 1024; break;
+        case 'g': case 'G': unit = 1024.0 * 1024 * 1024; break;
+        default: return -1;
+    }
+    return *end == '\0' || end[1] == '\0' ? value * unit : -1;
+}
+
 void alloc_string(char ** string, const size_t size) {
     if (string == nullptr) {
         fprintf(stderr, "alloc_string: null pointer error\n");
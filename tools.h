@@ -9,6 +9,7 @@
 #pragma once
 #include <dirent.h>
 #include <stdint.h>
+#include <stdio.h>
 #include <unistd.h>
 #include <sys/types.h>
 
@@ -72,6 +73,104 @@ const char* get_file_name(const char* filePath);
  * @return the path to the temporary directory
  */
 const char* get_temp_dir();
+/**
+ * @brief Formats a path into a buffer
+ *
+ * Like snprintf, but a path that doesn't fit into @p target is reported
+ * and terminates cscript instead of being silently truncated.
+ *
+ * @param target The buffer receiving the path
+ * @param size The size of @p target
+ * @param format The printf format of the path
+ */
+[[gnu::format(printf, 3, 4)]]
+void format_path(char *target, size_t size, const char *format, ...);
+/**
+ * @brief Finds a program in the PATH
+ *
+ * Searches the directories of the PATH environment variable for
+ * an executable named @p name and returns its canonical path.
+ * If @p name contains a slash, it is used as path directly.
+ * The pointer to the buffer containing the path will be overwritten
+ * on a subsequent use of this function. Not thread safe!
+ *
+ * @param name The name of the program
+ * @return The canonical path of the program or nullptr if not found
+ */
+const char* find_program(const char *name);
+/**
+ * @brief Reads a value from a key value file
+ *
+ * Key value files contain one "name=value" pair per line.
+ *
+ * @param path The path of the key value file
+ * @param name The name of the value
+ * @param value The buffer for the value
+ * @param size The size of the buffer
+ * @return true if the file exists and contains the value
+ */
+bool kv_read(const char *path, const char *name, char *value, size_t size);
+/**
+ * @brief Writes a value to a key value file
+ *
+ * Replaces the value @p name in the key value file or appends it if
+ * it does not exist yet. The file is created if necessary and is
+ * replaced atomically.
+ *
+ * @param path The path of the key value file
+ * @param name The name of the value
+ * @param value The value, must not contain line breaks
+ * @return 0 on success, otherwise errno contains the last error
+ */
+int kv_write(const char *path, const char *name, const char *value);
+/**
+ * @brief Reads a stream completely
+ *
+ * Reads everything from @p fp into a newly allocated, null terminated
+ * buffer. The buffer must be freed using free().
+ *
+ * @param fp The stream to read
+ * @param size Receives the number of bytes read, may be nullptr
+ * @return The buffer or nullptr on a read error
+ */
+char* read_stream(FILE *fp, size_t *size);
+/**
+ * @brief Gets a timestamp
+ *
+ * Returns the time of the monotonic clock in ms, to measure durations.
+ *
+ * @return The timestamp in ms
+ */
+double now_ms();
+/**
+ * @brief Checks an environment flag
+ *
+ * Checks if the environment variable @p name is set to a value
+ * that enables a feature, i.e. it is set, not empty and not "0".
+ *
+ * @param name The name of the environment variable
+ * @return true if the flag is set
+ */
+bool env_flag(const char *name);
+/**
+ * @brief Parses a duration
+ *
+ * Parses a duration like 90s, 30m, 12h, 7d or 2w. A number without a unit
+ * is taken as days.
+ *
+ * @param text The duration
+ * @return The duration in seconds, or -1 if @p text is not a duration
+ */
+double parse_duration(const char *text);
+/**
+ * @brief Parses a size
+ *
+ * Parses a size in bytes like 4096, 512K, 32M or 1G.
+ *
+ * @param text The size
+ * @return The size in bytes, or -1 if @p text is not a size
+ */
+double parse_size(const char *text);
 /**
  * @brief Allocates a string
  *
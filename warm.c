@@ -0,0 +1,314 @@
+/**
+ * @file warm.c
+ * @author Stefan Kleinschmiodt
+ * @date 13. Nov 2024
+ * @brief Contains the implementations of the page cache warmup functions for cscript.
+ *
+ * Provides the readahead of the executables and their libraries and the pin helper.
+ */
+#define _GNU_SOURCE
+#include "warm.h"
+
+#include <dlfcn.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <linux/limits.h>
+#include <sys/mman.h>
+#include <sys/prctl.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include "bundle.h"
+#include "cache.h"
+#include "elf.h"
+#include "script_file.h"
+#include "script_file_type.h"
+#include "tools.h"
+
+#define WARM_PIN_BUDGET (32.0 * 1024 * 1024)
+#define WARM_PIN_NAME "cscript-pin"
+#define WARM_PIN_FILE "pin.pid"
+#define WARM_SYSTEM_DIRS "/lib64:/usr/lib64:/lib:/usr/lib:/usr/local/lib"
+
+/**
+ * @brief The files read ahead so far, each file is only read once.
+ */
+typedef struct {
+    char **paths; /**< The real paths of the files. */
+    int count; /**< The number of files. */
+    double bytes; /**< The total size of the files. */
+} warm_set;
+
+bool warm_seen(warm_set *set, const char *path) {
+    for (int i = 0; i < set->count; i++) {
+        if (strcmp(set->paths[i], path) == 0) {
+            return true;
+        }
+    }
+    char **paths = (char**)realloc(set->paths, (set->count + 1) * sizeof(char*));
+    if (paths == nullptr) {
+        return true;
+    }
+    set->paths = paths;
+    set->paths[set->count++] = strdup(path);
+    return false;
+}
+
+bool warm_file(warm_set *set, const char *path) {
+    const int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) == 0 && readahead(fd, 0, st.st_size) == 0) {
+        set->bytes += (double)st.st_size;
+    }
+    close(fd);
+    return true;
+}
+
+const char* warm_system_dirs() {
+    //The directory of the libc of cscript is the directory of the system libraries (e.g. /lib/x86_64-linux-gnu)
+    static char dirs[PATH_MAX + sizeof(WARM_SYSTEM_DIRS) + 1] = "";
+    if (dirs[0] == '\0') {
+        Dl_info info;
+        if (dladdr((void*)printf, &info) != 0 && info.dli_fname != nullptr && strrchr(info.dli_fname, '/') != nullptr) {
+            snprintf(dirs, sizeof(dirs), "%.*s:%s", (int)(strrchr(info.dli_fname, '/') - info.dli_fname),
+                     info.dli_fname, WARM_SYSTEM_DIRS);
+        } else {
+            snprintf(dirs, sizeof(dirs), "%s", WARM_SYSTEM_DIRS);
+        }
+    }
+    return dirs;
+}
+
+bool warm_search(const char *name, const char *dirs, const char *origin, char *path, const size_t size) {
+    char list[8192];
+    snprintf(list, sizeof(list), "%s", dirs);
+    char *save = nullptr;
+    for (const char *dir = strtok_r(list, ":", &save); dir != nullptr; dir = strtok_r(nullptr, ":", &save)) {
+        //$ORIGIN is the directory of the object naming the library
+        const char *rest = nullptr;
+        if (strncmp(dir, "$ORIGIN", 7) == 0) {
+            rest = dir + 7;
+        } else if (strncmp(dir, "${ORIGIN}", 9) == 0) {
+            rest = dir + 9;
+        }
+        if (rest != nullptr) {
+            snprintf(path, size, "%s%s/%s", origin, rest, name);
+        } else {
+            snprintf(path, size, "%s/%s", dir, name);
+        }
+        if (file_exists(path)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void warm_tree(warm_set *set, const char *path) {
+    char real_path[PATH_MAX];
+    if (realpath(path, real_path) == nullptr || warm_seen(set, real_path) || !warm_file(set, real_path)) {
+        return;
+    }
+    char interp[PATH_MAX];
+    char needed[4096];
+    char runpath[4096];
+    char origin[PATH_MAX];
+    if (!elf_dependencies(real_path, interp, sizeof(interp), needed, sizeof(needed), runpath, sizeof(runpath))) {
+        return;
+    }
+    snprintf(origin, sizeof(origin), "%s", real_path);
+    *strrchr(origin, '/') = '\0';
+    if (interp[0] != '\0') {
+        warm_tree(set, interp);
+    }
+    //The libraries are searched like the dynamic loader does, without its cache (/etc/ld.so.cache)
+    const char *library_path = getenv("LD_LIBRARY_PATH");
+    library_path = library_path != nullptr ? library_path : "";
+    const size_t dirs_size = strlen(runpath) + strlen(library_path) + strlen(warm_system_dirs()) + 3;
+    char *dirs = malloc(dirs_size);
+    if (dirs == nullptr) {
+        return;
+    }
+    snprintf(dirs, dirs_size, "%s:%s:%s", runpath, library_path, warm_system_dirs());
+    char *save = nullptr;
+    for (const char *name = strtok_r(needed, " ", &save); name != nullptr; name = strtok_r(nullptr, " ", &save)) {
+        char lib[PATH_MAX];
+        if (strchr(name, '/') != nullptr) {
+            warm_tree(set, name);
+        } else if (warm_search(name, dirs, origin, lib, sizeof(lib))) {
+            warm_tree(set, lib);
+        }
+#if DEBUG == 1
+        else {
+            printf("DBG: warm_tree: library %s of %s not found\n", name, real_path);
+        }
+#endif
+    }
+    free(dirs);
+}
+
+void warm_stop_pins(const char *pid_file) {
+    char value[32];
+    if (!kv_read(pid_file, "pid", value, sizeof(value))) {
+        return;
+    }
+    //Only stop the process if it is still the pin helper, the pid may have been reused
+    const pid_t pid = (pid_t)atol(value);
+    char comm_path[64];
+    char comm[32] = "";
+    snprintf(comm_path, sizeof(comm_path), "/proc/%d/comm", (int)pid);
+    FILE *fp = fopen(comm_path, "r");
+    if (fp != nullptr) {
+        if (fgets(comm, sizeof(comm), fp) != nullptr) {
+            comm[strcspn(comm, "\n")] = '\0';
+        }
+        fclose(fp);
+    }
+    if (pid > 0 && strcmp(comm, WARM_PIN_NAME) == 0) {
+        kill(pid, SIGTERM);
+    }
+    unlink(pid_file);
+}
+
+int warm_lock(char **paths, const int count, const double budget) {
+    //Raise the soft limit for locked memory as far as allowed
+    struct rlimit rl;
+    if (getrlimit(RLIMIT_MEMLOCK, &rl) == 0 && rl.rlim_cur != RLIM_INFINITY && (double)rl.rlim_cur < budget) {
+        rl.rlim_cur = rl.rlim_max == RLIM_INFINITY || (double)rl.rlim_max > budget ? (rlim_t)budget : rl.rlim_max;
+        setrlimit(RLIMIT_MEMLOCK, &rl);
+    }
+    const long page_size = sysconf(_SC_PAGESIZE);
+    double used = 0;
+    int pinned = 0;
+    for (int i = 0; i < count; i++) {
+        const int fd = open(paths[i], O_RDONLY | O_CLOEXEC);
+        struct stat st;
+        if (fd == -1 || fstat(fd, &st) != 0 || st.st_size == 0) {
+            fprintf(stderr, "cscript: can't pin %s\n", paths[i]);
+            if (fd != -1) {
+                close(fd);
+            }
+            continue;
+        }
+        const double size = (double)((st.st_size + page_size - 1) / page_size * page_size);
+        if (used + size > budget) {
+            fprintf(stderr, "cscript: not pinning %s, it exceeds the budget of %.0f bytes (CSCRIPT_PIN_BUDGET)\n",
+                    paths[i], budget);
+            close(fd);
+            continue;
+        }
+        //The mapping keeps the pages locked until the helper ends, the file may be closed
+        void *data = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        close(fd);
+        if (data == MAP_FAILED) {
+            fprintf(stderr, "cscript: can't pin %s: %s\n", paths[i], strerror(errno));
+            continue;
+        }
+        if (mlock(data, st.st_size) != 0) {
+            fprintf(stderr, "cscript: can't pin %s: %s\n", paths[i], strerror(errno));
+            munmap(data, st.st_size);
+            continue;
+        }
+        used += size;
+        pinned++;
+        printf("pinned %s (%.0f KiB)\n", paths[i], size / 1024);
+    }
+    fflush(stdout);
+    return pinned;
+}
+
+void warm_pin(char **paths, const int count) {
+    double budget = WARM_PIN_BUDGET;
+    const char *budget_env = getenv("CSCRIPT_PIN_BUDGET");
+    if (budget_env != nullptr && (budget = parse_size(budget_env)) < 0) {
+        fprintf(stderr, "cscript: invalid CSCRIPT_PIN_BUDGET: %s\n", budget_env);
+        exit(EXIT_FAILURE);
+    }
+    char pid_file[PATH_MAX];
+    snprintf(pid_file, sizeof(pid_file), "%s/%s", cache_get_dir(), WARM_PIN_FILE);
+
+    //The helper locks the executables, reports the number of pinned ones and keeps them locked in the background
+    int fds[2];
+    if (pipe(fds) != 0) {
+        fprintf(stderr, "warm_pin: could not create pipe\n");
+        exit(EXIT_FAILURE);
+    }
+    const pid_t pid = fork();
+    if (pid == -1) {
+        fprintf(stderr, "warm_pin: could not start the pin helper\n");
+        exit(EXIT_FAILURE);
+    }
+    if (pid == 0) {
+        close(fds[0]);
+        setsid();
+        prctl(PR_SET_NAME, WARM_PIN_NAME);
+        const int pinned = warm_lock(paths, count, budget);
+        if (write(fds[1], &pinned, sizeof(pinned)) != sizeof(pinned) || pinned == 0) {
+            _exit(EXIT_SUCCESS);
+        }
+        close(fds[1]);
+        const int null_fd = open("/dev/null", O_RDWR);
+        dup2(null_fd, STDIN_FILENO);
+        dup2(null_fd, STDOUT_FILENO);
+        dup2(null_fd, STDERR_FILENO);
+        close(null_fd);
+        for (;;) {
+            pause();
+        }
+    }
+    close(fds[1]);
+    int pinned = 0;
+    if (read(fds[0], &pinned, sizeof(pinned)) != sizeof(pinned)) {
+        pinned = 0;
+    }
+    close(fds[0]);
+    if (pinned == 0) {
+        waitpid(pid, nullptr, 0);
+    } else {
+        char value[32];
+        snprintf(value, sizeof(value), "%d", (int)pid);
+        kv_write(pid_file, "pid", value);
+    }
+}
+
+void warm_scripts(const int count, char **scripts) {
+    //The executables pinned by the last warmup are released, also if none is pinned this time
+    char pid_file[PATH_MAX];
+    snprintf(pid_file, sizeof(pid_file), "%s/%s", cache_get_dir(), WARM_PIN_FILE);
+    warm_stop_pins(pid_file);
+    warm_set set = {nullptr, 0, 0};
+    char **pins = (char**)calloc(count, sizeof(char*));
+    int pin_count = 0;
+    for (int i = 0; i < count; i++) {
+        const auto sf = (script_file*)script_file_open(scripts[i]);
+        //Compile now, so the first real run doesn't have to
+        script_file_build(sf);
+        const int files = set.count;
+        const double bytes = set.bytes;
+        warm_tree(&set, sf->executable_path);
+        printf("warmed %s: %d files, %.0f KiB\n", scripts[i], set.count - files, (set.bytes - bytes) / 1024);
+        if (sf->pin && pins != nullptr) {
+            pins[pin_count++] = strdup(sf->executable_path);
+        }
+        script_file_close(sf);
+    }
+    fflush(stdout);
+    if (pin_count > 0) {
+        warm_pin(pins, pin_count);
+    }
+    for (int i = 0; i < pin_count; i++) {
+        free(pins[i]);
+    }
+    free(pins);
+    for (int i = 0; i < set.count; i++) {
+        free(set.paths[i]);
+    }
+    free(set.paths);
+}
@@ -0,0 +1,28 @@
+/**
+ * @file warm.h
+ * @author Stefan Kleinschmiodt
+ * @date 13. Nov 2024
+ * @brief Contains the page cache warmup functions for cscript.
+ *
+ * After a reboot or under memory pressure, the first run of a script waits for
+ * its executable and its shared libraries to be read from the disk. Warming
+ * reads them into the page cache ahead of time, pinning keeps the executables
+ * of latency-critical scripts (@#cscript pin) locked in memory.
+ */
+#pragma once
+
+/**
+ * @brief Warms the page cache for scripts
+ *
+ * Gets current builds of the scripts like a run does (see script_file_build()),
+ * then reads ahead their executables,
+ * the dynamic loader and the shared libraries they load, as listed in their
+ * dynamic sections. The executables of scripts with the directive @#cscript pin
+ * are locked in memory by a helper process. The helper of a previous warmup is
+ * stopped first, also if no script is pinned this time. The pinned memory is
+ * limited by CSCRIPT_PIN_BUDGET (default 32M).
+ *
+ * @param count The number of script files
+ * @param scripts The paths of the script files
+ */
+void warm_scripts(int count, char **scripts);